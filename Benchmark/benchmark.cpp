@@ -0,0 +1,1253 @@
+// Throughput benchmarks for the Json, Xml and Xss parsers over generated corpora.
+//
+// Every benchmark reports MB/s, nodes/s, heap allocations per iteration and the
+// process's peak resident set size so far.
+//
+// Baselines:
+//		--save_baseline=<file>	Writes each benchmark's time per iteration to file
+//		--baseline=<file>		Compares this run against a saved baseline
+//
+// All other flags are passed to Google Benchmark.
+
+#define XELA_PARSE_STATS
+
+#include "XelaAsync.hpp"
+
+#define XELA_JSON_IMPLEMENTATION
+#include "XelaJson.hpp"
+
+#define XELA_XML_IMPLEMENTATION
+#include "XelaXml.hpp"
+
+#define XELA_XSS_IMPLEMENTATION
+#include "XelaStyleSheet.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+#include <map>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Heap allocations, counted by replacing the global operator new
+static std::atomic<size_t> allocations = 0;
+
+// The replacements stay out of line. Inlined, GCC would see malloc and free where callers use new and delete, and
+// report them as mismatched.
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+BENCH_NOINLINE void *operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *ptr = std::malloc(size > 0 ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+BENCH_NOINLINE void operator delete(void *ptr) noexcept {
+	std::free(ptr);
+}
+BENCH_NOINLINE void operator delete(void *ptr, size_t) noexcept {
+	operator delete(ptr);
+}
+
+// The default memory resource allocates through the aligned forms, so pmr containers are counted too
+BENCH_NOINLINE void *operator new(size_t size, std::align_val_t align) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	size_t alignment = (size_t)align;
+#ifdef _WIN32
+	void *ptr = _aligned_malloc(size > 0 ? size : 1, alignment);
+#else
+	void *ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+	if (ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+BENCH_NOINLINE void operator delete(void *ptr, std::align_val_t) noexcept {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+BENCH_NOINLINE void operator delete(void *ptr, size_t, std::align_val_t align) noexcept {
+	operator delete(ptr, align);
+}
+
+static size_t peakRss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Corpora
+// Each is built once, from a fixed seed so runs are comparable
+static std::string jsonNumeric() {
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> real(-1000.0f, 1000.0f);
+	std::uniform_int_distribution<int> integer(-100000, 100000);
+
+	std::string ret = "[";
+	for (int row = 0; row < 20000; row++) {
+		ret += row > 0 ? ",\n[" : "\n[";
+		for (int col = 0; col < 16; col++) {
+			ret += col > 0 ? ", " : "";
+			ret += col % 2 == 0 ? std::to_string(integer(rng)) : std::to_string(real(rng));
+		}
+		ret += "]";
+	}
+	return ret + "\n]";
+}
+static std::string jsonStrings() {
+	std::mt19937 rng(2);
+	std::uniform_int_distribution<int> length(4, 120);
+	std::uniform_int_distribution<int> letter('a', 'z');
+
+	auto word = [&]() {
+		std::string ret(length(rng), ' ');
+		for (char &c : ret) {
+			c = (char)letter(rng);
+		}
+		return ret;
+	};
+
+	std::string ret = "[";
+	for (int i = 0; i < 20000; i++) {
+		ret += i > 0 ? ",\n" : "\n";
+		ret += "{ \"name\": \"" + word() + "\", \"title\": \"" + word() + "\", \"body\": \"" + word() + " " + word() + "\" }";
+	}
+	return ret + "\n]";
+}
+static std::string jsonNested() {
+	std::string block;
+	for (int depth = 0; depth < 256; depth++) {
+		block += depth % 2 == 0 ? "{ \"child\": " : "[ ";
+	}
+	block += "true";
+	for (int depth = 256; depth-- > 0;) {
+		block += depth % 2 == 0 ? " }" : " ]";
+	}
+
+	std::string ret = "[";
+	for (int i = 0; i < 1000; i++) {
+		ret += (i > 0 ? ",\n" : "\n") + block;
+	}
+	return ret + "\n]";
+}
+static std::string jsonWide() {
+	std::string ret = "{";
+	for (int i = 0; i < 100000; i++) {
+		ret += (i > 0 ? ",\n\"key" : "\n\"key") + std::to_string(i) + "\": " + std::to_string(i);
+	}
+	return ret + "\n}";
+}
+// A tenant's configuration, about 1.2k values. Tenants differ only in their name, quota and region.
+static std::string jsonTenant(int tenant) {
+	static const char *regions[] = { "eu-west", "us-east", "us-west", "ap-south" };
+
+	std::string ret = "{ \"name\": \"tenant" + std::to_string(tenant) + "\", \"quota\": " + std::to_string(tenant % 7 * 100) +
+		", \"region\": \"" + regions[tenant % 4] + "\",\n\"features\": {";
+	for (int feature = 0; feature < 100; feature++) {
+		ret += (feature > 0 ? ", \"f" : " \"f") + std::to_string(feature) + "\": " + (feature % 3 == 0 ? "true" : "false");
+	}
+	ret += " },\n\"limits\": [";
+	for (int limit = 0; limit < 100; limit++) {
+		ret += (limit > 0 ? ",\n" : "\n") + std::string("{ \"resource\": \"r") + std::to_string(limit) + "\", \"max\": " +
+			std::to_string(limit % 16) + ", \"burst\": [1, 2, 3] }";
+	}
+	return ret + "\n] }";
+}
+// A small settings file, as found by the thousand in a configuration directory
+static std::string jsonSettings(int index) {
+	return "{ \"id\": " + std::to_string(index) + ", \"name\": \"service" + std::to_string(index) + "\", \"enabled\": " +
+		(index % 2 == 0 ? "true" : "false") + ", \"tags\": [\"a\", \"b\"], \"limits\": { \"cpu\": " + std::to_string(index % 8) +
+		", \"memory\": 512 } }";
+}
+static std::string xmlSections(size_t bytes) {
+	std::string ret = "<document>\n";
+	for (int section = 0; ret.size() < bytes; section++) {
+		ret += "\t<section id=\"s" + std::to_string(section) + "\">\n\t\t<!-- section " + std::to_string(section) + " -->\n";
+		for (int item = 0; item < 20; item++) {
+			ret += "\t\t<item id=\"" + std::to_string(item) + "\" kind=\"entry\"><name></name><value><unit/></value></item>\n";
+		}
+		ret += "\t</section>\n";
+	}
+	return ret + "</document>\n";
+}
+static std::string xmlWide() {
+	std::string ret = "<document>\n";
+	for (int item = 0; item < 200000; item++) {
+		ret += item % 100 == 0 ? "\t<!-- item -->\n" : "";
+		ret += "\t<n" + std::to_string(item % 100) + "/>\n";
+	}
+	return ret + "</document>\n";
+}
+static std::string xmlDeep() {
+	std::string chain;
+	for (int depth = 0; depth < 1000; depth++) {
+		chain += "<level><leaf/>";
+	}
+	for (int depth = 0; depth < 1000; depth++) {
+		chain += "</level>";
+	}
+
+	std::string ret = "<document>\n";
+	for (int i = 0; i < 100; i++) {
+		ret += chain + "\n";
+	}
+	return ret + "</document>\n";
+}
+// Prose with markup, mostly clean runs with the odd entity and CDATA section
+static std::string xmlText() {
+	std::string ret = "<document>\n";
+	for (int para = 0; ret.size() < (4 << 20); para++) {
+		ret += "\t<p id=\"p" + std::to_string(para) + "\">The quick brown fox jumps over the lazy dog, then rests for a while "
+			"in the shade before going home. <b>Fish &amp; chips</b> cost &#163;" + std::to_string(para % 10) + " at the "
+			"corner shop, which is open every day until late in the evening.</p>\n";
+		if (para % 10 == 0) {
+			ret += "\t<code><![CDATA[if (a < b && c > d) { return; }]]></code>\n";
+		}
+	}
+	return ret + "</document>\n";
+}
+// A million elements with unique ids, in groups of a thousand
+static std::string xmlRecords() {
+	std::string ret = "<document>\n";
+	for (int group = 0; group < 1000; group++) {
+		ret += "\t<group>\n";
+		for (int record = 1; record < 1000; record++) {
+			ret += "\t\t<record id=\"r" + std::to_string(group * 1000 + record) + "\"/>\n";
+		}
+		ret += "\t</group>\n";
+	}
+	return ret + "</document>\n";
+}
+static std::string xmlLarge() {
+	return xmlSections(4 << 20);
+}
+static std::string xmlHuge() {
+	return xmlSections(100 << 20);
+}
+static std::string xssLarge() {
+	std::string ret;
+	for (int style = 0; style < 5000; style++) {
+		ret += "#style" + std::to_string(style) + " {\n";
+		ret += "\tcolor : \"red\";\n\tfont : \"Helvetica Neue\";\n\tdisplay : block ;\n";
+		ret += "\t.hover {\n\t\tcolor : \"blue\";\n\t\tcursor : pointer ;\n\t}\n";
+		ret += "}\n";
+	}
+	return ret;
+}
+
+static const std::string &corpus(std::string (*generate)()) {
+	static std::map<std::string (*)(), std::string> built;
+	auto it = built.find(generate);
+	if (it == built.end()) {
+		it = built.emplace(generate, generate()).first;
+	}
+	return it->second;
+}
+
+// count settings files in a temporary directory, written on first use and removed when the program exits
+static const std::vector<std::filesystem::path> &settingsFiles(size_t count) {
+	struct Files {
+		std::filesystem::path directory;
+		std::vector<std::filesystem::path> paths;
+
+		~Files() {
+			std::filesystem::remove_all(directory);
+		}
+	};
+	static std::map<size_t, Files> built;
+
+	auto it = built.find(count);
+	if (it == built.end()) {
+		it = built.try_emplace(count).first;
+		Files &files = it->second;
+		files.directory = std::filesystem::temp_directory_path() / ("xela_benchmark_" + std::to_string(count));
+		std::filesystem::remove_all(files.directory);
+		std::filesystem::create_directories(files.directory);
+
+		for (size_t i = 0; i < count; i++) {
+			files.paths.push_back(files.directory / ("settings" + std::to_string(i) + ".json"));
+			std::ofstream(files.paths.back(), std::ios::binary) << jsonSettings((int)i);
+		}
+	}
+	return it->second.paths;
+}
+
+// Counters shared by every benchmark
+static void report(benchmark::State &state, size_t bytes, size_t nodes, size_t allocated) {
+	state.SetBytesProcessed((int64_t)(bytes * state.iterations()));
+	state.counters["nodes/s"] = benchmark::Counter((double)(nodes * state.iterations()), benchmark::Counter::kIsRate);
+	state.counters["allocs"] = benchmark::Counter((double)allocated / (double)state.iterations());
+	state.counters["peak_rss_MB"] = benchmark::Counter((double)peakRss() / (1024.0 * 1024.0));
+}
+
+// Json
+static void jsonParse(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Json::Stats stats;
+	Xela::Json::ParseOptions counted;
+	counted.stats = &stats;
+	Xela::Json::destroy(Xela::Json::fromString(text, counted));
+
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Json *json = Xela::Json::fromString(text);
+		benchmark::DoNotOptimize(json);
+		Xela::Json::destroy(json);
+	}
+	report(state, text.size(), stats.total(), allocations - before);
+}
+static void jsonParseArena(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Json::Stats stats;
+	Xela::Json::ParseOptions counted;
+	counted.stats = &stats;
+	Xela::Json::destroy(Xela::Json::fromString(text, counted));
+
+	std::pmr::monotonic_buffer_resource arena(1 << 20);
+	Xela::Json::ParseOptions options;
+	options.resource = &arena;
+
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Json *json = Xela::Json::fromString(text, options);
+		benchmark::DoNotOptimize(json);
+		arena.release();
+	}
+	report(state, text.size(), stats.total(), allocations - before);
+}
+// The top level array split across state.range(0) runs on the shared pool, each filling an arena of its own. Timed by
+// the wall clock, since that is what threads save.
+static void jsonParseParallel(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Json::Stats stats;
+	Xela::Json::ParseOptions counted;
+	counted.stats = &stats;
+	Xela::Json::destroy(Xela::Json::fromString(text, counted));
+
+	Xela::Json::ParseOptions options;
+	options.threads = (size_t)state.range(0);
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Json *json = Xela::Json::fromString(text, options);
+		benchmark::DoNotOptimize(json);
+		Xela::Json::destroy(json);
+	}
+	report(state, text.size(), stats.total(), allocations - before);
+}
+static void jsonWrite(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Json::Stats stats;
+	Xela::Json::ParseOptions counted;
+	counted.stats = &stats;
+	Xela::Json *json = Xela::Json::fromString(text, counted);
+
+	size_t bytes = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		std::ostringstream out;
+		json->write(false, out);
+		bytes = (size_t)out.tellp();
+	}
+	report(state, bytes, stats.total(), allocations - before);
+
+	Xela::Json::destroy(json);
+}
+static void jsonWriter(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Json::Stats stats;
+	Xela::Json::ParseOptions counted;
+	counted.stats = &stats;
+	Xela::Json *json = Xela::Json::fromString(text, counted);
+
+	size_t bytes = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Json::Writer writer;
+		writer.value(*json);
+		bytes = writer.str().size();
+	}
+	report(state, bytes, stats.total(), allocations - before);
+
+	Xela::Json::destroy(json);
+}
+
+// Readers on every thread load the current version of a frozen config and look a key up in it, while the first thread
+// also publishes a new version every 1024 reads
+static void jsonSnapshot(benchmark::State &state) {
+	static Xela::Json::Snapshot snapshot;
+	static std::shared_ptr<const Xela::Json> versions[2];
+	if (state.thread_index() == 0) {
+		for (int i = 0; i < 2; i++) {
+			std::string text = jsonTenant(i);
+			versions[i] = Xela::Json::fromString(text)->freeze();
+		}
+		snapshot.store(versions[0]);
+	}
+
+	const std::string key = "region";
+	size_t reads = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		std::shared_ptr<const Xela::Json> config = snapshot.load();
+		benchmark::DoNotOptimize(&(*config)(key));
+
+		if (state.thread_index() == 0 && ++reads % 1024 == 0) {
+			snapshot.store(versions[reads / 1024 % 2]);
+		}
+	}
+	// Counters are summed over the threads, so reads/s is the total and the rest come from the first thread alone
+	state.counters["reads/s"] = benchmark::Counter((double)state.iterations(), benchmark::Counter::kIsRate);
+	if (state.thread_index() == 0) {
+		report(state, 0, 0, allocations - before);
+
+		snapshot.store(nullptr);
+		versions[0] = nullptr;
+		versions[1] = nullptr;
+	}
+}
+// A full parse that records locations, which is what reparse needs to start from
+static void jsonParseLocated(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Json::Stats stats;
+	Xela::Json::SourceMap locations;
+	Xela::Json::ParseOptions options;
+	options.stats = &stats;
+	options.locations = &locations;
+
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Json *json = Xela::Json::fromString(text, options);
+		benchmark::DoNotOptimize(json);
+		Xela::Json::destroy(json);
+	}
+	report(state, text.size(), stats.total(), allocations - before);
+}
+// One character inside a string in the middle of the document changed, and changed back on the next iteration
+static void jsonReparse(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Json::SourceMap locations;
+	Xela::Json::ParseOptions options;
+	options.locations = &locations;
+	Xela::Json *json = Xela::Json::fromString(text, options);
+
+	size_t offset = text.find(": \"", text.size() / 2) + 3;
+	Xela::Json::Edit edits[2] = { { offset, 1, "#" }, { offset, 1, std::string(1, text[offset]) } };
+
+	size_t next = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		json = Xela::Json::reparse(json, locations, edits[next++ % 2]);
+		benchmark::DoNotOptimize(json);
+	}
+	state.counters["edits/s"] = benchmark::Counter((double)state.iterations(), benchmark::Counter::kIsRate);
+	report(state, 0, 0, allocations - before);
+
+	Xela::Json::destroy(json);
+}
+// Two copies of a corpus that differ in ten strings spread through it. Hashed afresh by every diff, or once while
+// parsing and reused when state.range(0) is set.
+static void jsonDiff(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+	std::string changed = text;
+	for (size_t part = 0; part < 10; part++) {
+		changed[changed.find(": \"", changed.size() * part / 10) + 3] = '#';
+	}
+
+	Xela::Json::Stats stats;
+	Xela::Json::Digests digests;
+	Xela::Json::ParseOptions options;
+	options.stats = &stats;
+	if (state.range(0) != 0) {
+		options.hashes = &digests;
+	}
+	Xela::Json *from = Xela::Json::fromString(text, options);
+	Xela::Json *to = Xela::Json::fromString(changed, options);
+
+	size_t ops = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Json *patch = state.range(0) != 0 ? Xela::Json::diff(from, to, digests) : Xela::Json::diff(from, to);
+		ops = patch->size();
+		Xela::Json::destroy(patch);
+	}
+	state.counters["ops"] = benchmark::Counter((double)ops);
+	report(state, text.size() + changed.size(), stats.total() * 2, allocations - before);
+
+	Xela::Json::destroy(from);
+	Xela::Json::destroy(to);
+}
+// A thousand tenant configs parsed and kept as plain trees, or interned into a store. held is the number of values
+// alive once they are all loaded.
+static void jsonTenants(benchmark::State &state, bool intern) {
+	std::vector<std::string> texts;
+	for (int tenant = 0; tenant < 1000; tenant++) {
+		texts.push_back(jsonTenant(tenant));
+	}
+
+	Xela::Json::Stats stats;
+	Xela::Json::ParseOptions options;
+	options.stats = &stats;
+
+	size_t bytes = 0;
+	size_t nodes = 0;
+	size_t held = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Json::Store store;
+		std::vector<Xela::Json *> trees;
+
+		bytes = 0;
+		nodes = 0;
+		for (std::string &text : texts) {
+			Xela::Json *json = Xela::Json::fromString(text, options);
+			bytes += text.size();
+			nodes += stats.total();
+
+			if (intern) {
+				benchmark::DoNotOptimize(store.intern(json));
+			}
+			else {
+				trees.push_back(json);
+			}
+		}
+		held = intern ? store.size() : nodes;
+
+		for (Xela::Json *json : trees) {
+			Xela::Json::destroy(json);
+		}
+	}
+	state.counters["held"] = benchmark::Counter((double)held);
+	report(state, bytes, nodes, allocations - before);
+}
+// The corpus parsed and then walked against a schema, or checked while it is parsed
+static void jsonValidate(benchmark::State &state, bool fused) {
+	std::string text = corpus(jsonStrings);
+	std::string schemaText = R"({ "type": "array", "items": { "type": "object", "required": ["name", "title", "body"], "properties": {
+		"name": { "type": "string", "minLength": 4, "maxLength": 120 },
+		"title": { "type": "string", "minLength": 4, "maxLength": 120 },
+		"body": { "type": "string", "minLength": 9, "maxLength": 241 } } } })";
+	Xela::Json *schemaJson = Xela::Json::fromString(schemaText);
+	Xela::Json::Schema schema = Xela::Json::Schema::fromJson(schemaJson);
+	Xela::Json::destroy(schemaJson);
+
+	Xela::Json::Stats stats;
+	Xela::Json::ParseOptions counted;
+	counted.stats = &stats;
+	Xela::Json::destroy(Xela::Json::fromString(text, counted));
+
+	Xela::Json::ParseOptions options;
+	if (fused) {
+		options.schema = &schema;
+	}
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Json *json = Xela::Json::fromString(text, options);
+		if (!fused) {
+			schema.validate(json);
+		}
+		benchmark::DoNotOptimize(json);
+		Xela::Json::destroy(json);
+	}
+	report(state, text.size(), stats.total(), allocations - before);
+}
+// state.range(0) settings files loaded one after another, all at once with fromFileAsync, or with fromFiles.
+// Timed by the wall clock, since the work is spread over the shared pools.
+enum class Load {
+	Sequential,
+	Async,
+	Batch,
+};
+static void jsonLoad(benchmark::State &state, Load mode) {
+	const std::vector<std::filesystem::path> &files = settingsFiles((size_t)state.range(0));
+
+	size_t bytes = 0;
+	for (const std::filesystem::path &file : files) {
+		bytes += std::filesystem::file_size(file);
+	}
+
+	size_t before = allocations;
+	for (auto _ : state) {
+		std::vector<Xela::Json *> trees;
+		trees.reserve(files.size());
+
+		switch (mode) {
+		case Load::Sequential:
+			for (const std::filesystem::path &file : files) {
+				trees.push_back(Xela::Json::fromFile(file));
+			}
+			break;
+		case Load::Async: {
+			std::vector<Xela::Json::Loading> loads;
+			loads.reserve(files.size());
+			for (const std::filesystem::path &file : files) {
+				loads.push_back(Xela::Json::fromFileAsync(file));
+			}
+			for (Xela::Json::Loading &load : loads) {
+				trees.push_back(load.get());
+			}
+			break;
+		}
+		case Load::Batch:
+			for (Xela::Json::Loaded &loaded : Xela::Json::fromFiles(files)) {
+				trees.push_back(loaded.json);
+			}
+			break;
+		}
+
+		for (Xela::Json *json : trees) {
+			Xela::Json::destroy(json);
+		}
+	}
+	state.counters["files/s"] = benchmark::Counter((double)(files.size() * state.iterations()), benchmark::Counter::kIsRate);
+	report(state, bytes, 0, allocations - before);
+}
+
+BENCHMARK_CAPTURE(jsonParse, numeric, jsonNumeric)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonParse, strings, jsonStrings)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonParse, nested, jsonNested)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonParse, wide, jsonWide)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonParseArena, numeric, jsonNumeric)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonParseArena, strings, jsonStrings)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonParseParallel, numeric, jsonNumeric)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonParseParallel, strings, jsonStrings)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonWrite, numeric, jsonNumeric)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonWrite, strings, jsonStrings)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonWriter, numeric, jsonNumeric)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonWriter, strings, jsonStrings)->Unit(benchmark::kMillisecond);
+BENCHMARK(jsonSnapshot)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(jsonParseLocated, strings, jsonStrings)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonReparse, strings, jsonStrings)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(jsonDiff, strings, jsonStrings)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonTenants, plain, false)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonTenants, store, true)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonValidate, walk, false)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonValidate, fused, true)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonLoad, sequential, Load::Sequential)->Arg(1000)->Arg(10000)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonLoad, async, Load::Async)->Arg(1000)->Arg(10000)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(jsonLoad, batch, Load::Batch)->Arg(1000)->Arg(10000)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Xml
+static void xmlParse(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xml::fromString(text, counted);
+
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml *xml = Xela::Xml::fromString(text);
+		benchmark::DoNotOptimize(xml);
+		delete xml;
+	}
+	report(state, text.size(), stats.tags + stats.comments + stats.texts, allocations - before);
+}
+
+// Times only the iterative destructor, which should not allocate however deep the tree goes
+static void xmlDestroy(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xml::fromString(text, counted);
+
+	size_t freed = 0;
+	for (auto _ : state) {
+		state.PauseTiming();
+		Xela::Xml *xml = Xela::Xml::fromString(text);
+		size_t before = allocations;
+		state.ResumeTiming();
+
+		delete xml;
+		freed += allocations - before;
+	}
+	report(state, text.size(), stats.tags + stats.comments + stats.texts, freed);
+}
+static void xmlWrite(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	Xela::Xml *xml = Xela::Xml::fromString(text, counted);
+
+	size_t bytes = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		std::ostringstream out;
+		xml->write(false, out);
+		bytes = (size_t)out.tellp();
+	}
+	report(state, bytes, stats.tags + stats.comments + stats.texts, allocations - before);
+
+	delete xml;
+}
+static void xmlWriter(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	Xela::Xml *xml = Xela::Xml::fromString(text, counted);
+
+	size_t bytes = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml::Writer writer;
+		writer.value(*xml);
+		bytes = writer.str().size();
+	}
+	report(state, bytes, stats.tags + stats.comments + stats.texts, allocations - before);
+
+	delete xml;
+}
+
+// Frees each tree by releasing the document arena instead of deleting node by node
+static void xmlParseDocument(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xml::fromString(text, counted);
+
+	Xela::Xml::Document document;
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml *xml = document.parse(text);
+		benchmark::DoNotOptimize(xml);
+		document.clear();
+	}
+	report(state, text.size(), stats.tags + stats.comments + stats.texts, allocations - before);
+}
+
+// Like xmlParseDocument, with nodes pointing into text instead of copying from it
+static void xmlParseBorrowed(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xml::fromString(text, counted);
+
+	Xela::Xml::Document document;
+	Xela::Xml::ParseOptions options;
+	options.borrow = true;
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml *xml = document.parse(text, options);
+		benchmark::DoNotOptimize(xml);
+		document.clear();
+	}
+	report(state, text.size(), stats.tags + stats.comments + stats.texts, allocations - before);
+}
+
+// Writes a corpus to a temporary file that is removed when the returned handle is
+static std::shared_ptr<const std::filesystem::path> corpusFile(std::string (*generate)()) {
+	auto file = std::make_shared<std::filesystem::path>(std::filesystem::temp_directory_path() / "xela_benchmark.xml");
+	{
+		const std::string &text = corpus(generate);
+		std::ofstream out(*file, std::ios::binary);
+		out.write(text.data(), text.size());
+	}
+	return std::shared_ptr<const std::filesystem::path>(file.get(), [file](const std::filesystem::path *) {
+		std::filesystem::remove(*file);
+	});
+}
+
+static void xmlParseFile(benchmark::State &state, std::string (*generate)()) {
+	auto handle = corpusFile(generate);
+	const std::filesystem::path &file = *handle;
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xml::fromFile(file, counted);
+
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml *xml = Xela::Xml::fromFile(file);
+		benchmark::DoNotOptimize(xml);
+		delete xml;
+	}
+	report(state, stats.bytes, stats.tags + stats.comments + stats.texts, allocations - before);
+}
+static void xmlReadFile(benchmark::State &state, std::string (*generate)()) {
+	auto handle = corpusFile(generate);
+	const std::filesystem::path &file = *handle;
+
+	size_t bytes = std::filesystem::file_size(file);
+	size_t nodes = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		std::ifstream in(file, std::ios::binary);
+		Xela::Xml::Reader reader(in);
+
+		nodes = 0;
+		for (auto event = reader.next(); event != Xela::Xml::Reader::Event::End; event = reader.next()) {
+			nodes += event != Xela::Xml::Reader::Event::EndElement;
+		}
+	}
+	report(state, bytes, nodes, allocations - before);
+}
+
+static void xmlIterate(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+	Xela::Xml *xml = Xela::Xml::fromString(text);
+
+	// Every node in document order, without recursion
+	size_t nodes = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		nodes = 0;
+		for (Xela::Xml *curr = xml; curr != nullptr; ) {
+			nodes++;
+			if (curr->getFirstChild() != nullptr) {
+				curr = curr->getFirstChild();
+				continue;
+			}
+			while (curr != nullptr && curr->getNextSibling() == nullptr) {
+				curr = curr->getParent();
+			}
+			curr = curr != nullptr ? curr->getNextSibling() : nullptr;
+		}
+		benchmark::DoNotOptimize(nodes);
+	}
+	report(state, 0, nodes, allocations - before);
+
+	delete xml;
+}
+static void xmlLookup(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+	Xela::Xml *xml = Xela::Xml::fromString(text);
+
+	std::vector<std::string> names;
+	for (int name = 0; name < 100; name++) {
+		names.push_back("n" + std::to_string(name));
+	}
+
+	// The first lookup builds the index, which is left out of the timing
+	xml->getChildren();
+
+	size_t found = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		for (const std::string &name : names) {
+			found += xml->getChildren().find(name)->second.size();
+		}
+	}
+	benchmark::DoNotOptimize(found);
+	state.counters["lookups/s"] = benchmark::Counter((double)(names.size() * state.iterations()), benchmark::Counter::kIsRate);
+	report(state, 0, 0, allocations - before);
+
+	delete xml;
+}
+static void xmlIndex(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+	Xela::Xml *xml = Xela::Xml::fromString(text);
+
+	// Renaming a child drops the index, so each lookup builds it from scratch
+	Xela::Xml *last = xml->getLastChild();
+	size_t before = allocations;
+	for (auto _ : state) {
+		last->setType(last->getType());
+		benchmark::DoNotOptimize(&xml->getChildren());
+	}
+	report(state, 0, xml->getChildCount(), allocations - before);
+
+	delete xml;
+}
+
+// The same lookups as xmlQuery paths, written out by hand against the sibling links
+static size_t findSectionItem(Xela::Xml *xml) {
+	// /document/section[@id="s500"]/item[3]
+	size_t found = 0;
+	for (Xela::Xml *section = xml->getFirstChild(); section != nullptr; section = section->getNextSibling()) {
+		const Xela::Xml::Attribute *id = section->isComment() || section->isText() ? nullptr : section->findAttribute("id");
+		if (section->getType() != "section" || id == nullptr || id->value != "s500") {
+			continue;
+		}
+		size_t position = 0;
+		for (Xela::Xml *item = section->getFirstChild(); item != nullptr; item = item->getNextSibling()) {
+			if (!item->isComment() && !item->isText() && item->getType() == "item" && ++position == 3) {
+				found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
+static size_t findItems(Xela::Xml *xml) {
+	// //item[@id="7"]
+	size_t found = 0;
+	for (Xela::Xml *curr = xml; curr != nullptr; ) {
+		if (!curr->isComment() && !curr->isText() && curr->getType() == "item") {
+			const Xela::Xml::Attribute *id = curr->findAttribute("id");
+			found += id != nullptr && id->value == "7";
+		}
+		if (curr->getFirstChild() != nullptr) {
+			curr = curr->getFirstChild();
+			continue;
+		}
+		while (curr != nullptr && curr->getNextSibling() == nullptr) {
+			curr = curr->getParent();
+		}
+		curr = curr != nullptr ? curr->getNextSibling() : nullptr;
+	}
+	return found;
+}
+static void xmlQuery(benchmark::State &state, const char *path) {
+	std::string text = corpus(xmlLarge);
+	Xela::Xml *xml = Xela::Xml::fromString(text);
+
+	// Compiled once and run repeatedly
+	Xela::Xml::Query query = Xela::Xml::Query::compile(path);
+	size_t found = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		found = query.select(xml).size();
+	}
+	state.counters["matches"] = (double)found;
+	report(state, 0, 0, allocations - before);
+
+	delete xml;
+}
+static void xmlQueryManual(benchmark::State &state, size_t (*find)(Xela::Xml *xml)) {
+	std::string text = corpus(xmlLarge);
+	Xela::Xml *xml = Xela::Xml::fromString(text);
+
+	size_t found = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		found = find(xml);
+		benchmark::DoNotOptimize(found);
+	}
+	state.counters["matches"] = (double)found;
+	report(state, 0, 0, allocations - before);
+
+	delete xml;
+}
+// Matching while reading, so only the matches are ever built
+static void xmlQueryStream(benchmark::State &state, const char *path) {
+	std::string text = corpus(xmlLarge);
+
+	Xela::Xml::Query query = Xela::Xml::Query::compile(path);
+	size_t found = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		found = 0;
+		Xela::Xml::Reader reader{ std::string_view(text) };
+		query.select(reader, [&](Xela::Xml *match) {
+			found++;
+			delete match;
+		});
+	}
+	state.counters["matches"] = (double)found;
+	report(state, text.size(), 0, allocations - before);
+}
+
+// Like xmlParse, entering every id in a key table as well
+static void xmlParseKeys(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xml::fromString(text, counted);
+
+	Xela::Xml::Keys keys{ "id" };
+	Xela::Xml::ParseOptions options;
+	options.keys = &keys;
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml *xml = Xela::Xml::fromString(text, options);
+		benchmark::DoNotOptimize(xml);
+		delete xml;
+	}
+	report(state, text.size(), stats.tags + stats.comments + stats.texts, allocations - before);
+}
+// Ids spread over the whole corpus, looked up in turn
+static std::vector<std::string> recordIds() {
+	std::vector<std::string> ret;
+	for (int i = 0; i < 1000; i++) {
+		ret.push_back("r" + std::to_string((i * 7919) % 1000 * 1000 + 1 + i % 999));
+	}
+	return ret;
+}
+static void xmlKeysFind(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+	Xela::Xml::Keys keys{ "id" };
+	Xela::Xml::ParseOptions options;
+	options.keys = &keys;
+	Xela::Xml *xml = Xela::Xml::fromString(text, options);
+
+	std::vector<std::string> ids = recordIds();
+	size_t next = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml *found = keys.find("id", ids[next++ % ids.size()]);
+		benchmark::DoNotOptimize(found);
+	}
+	state.counters["lookups/s"] = benchmark::Counter((double)state.iterations(), benchmark::Counter::kIsRate);
+	report(state, 0, 0, allocations - before);
+
+	delete xml;
+}
+// The same lookups by walking the tree until the id turns up
+static void xmlKeysTraverse(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+	Xela::Xml *xml = Xela::Xml::fromString(text);
+
+	std::vector<std::string> ids = recordIds();
+	size_t next = 0;
+	size_t before = allocations;
+	for (auto _ : state) {
+		const std::string &id = ids[next++ % ids.size()];
+		Xela::Xml *found = nullptr;
+		for (Xela::Xml *curr = xml; curr != nullptr && found == nullptr; ) {
+			const Xela::Xml::Attribute *attr = curr->findAttribute("id");
+			if (attr != nullptr && attr->value == id) {
+				found = curr;
+			}
+			if (curr->getFirstChild() != nullptr) {
+				curr = curr->getFirstChild();
+				continue;
+			}
+			while (curr != nullptr && curr->getNextSibling() == nullptr) {
+				curr = curr->getParent();
+			}
+			curr = curr != nullptr ? curr->getNextSibling() : nullptr;
+		}
+		benchmark::DoNotOptimize(found);
+	}
+	state.counters["lookups/s"] = benchmark::Counter((double)state.iterations(), benchmark::Counter::kIsRate);
+	report(state, 0, 0, allocations - before);
+
+	delete xml;
+}
+
+// The root's children split across state.range(0) threads. Timed by the wall clock, since that is what threads save.
+static void xmlParseParallel(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xml::fromString(text, counted);
+
+	Xela::Xml::ParseOptions options;
+	options.threads = (size_t)state.range(0);
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml *xml = Xela::Xml::fromString(text, options);
+		benchmark::DoNotOptimize(xml);
+		delete xml;
+	}
+	report(state, text.size(), stats.tags + stats.comments + stats.texts, allocations - before);
+}
+// Like xmlParseParallel, with each thread filling its own arena in the document
+static void xmlParseDocumentParallel(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xml::fromString(text, counted);
+
+	Xela::Xml::Document document;
+	Xela::Xml::ParseOptions options;
+	options.threads = (size_t)state.range(0);
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xml *xml = document.parse(text, options);
+		benchmark::DoNotOptimize(xml);
+	}
+	report(state, text.size(), stats.tags + stats.comments + stats.texts, allocations - before);
+}
+
+BENCHMARK_CAPTURE(xmlParse, large, xmlLarge)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParse, wide, xmlWide)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParse, deep, xmlDeep)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParse, text, xmlText)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlDestroy, wide, xmlWide)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlDestroy, deep, xmlDeep)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseDocument, large, xmlLarge)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseDocument, wide, xmlWide)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseBorrowed, large, xmlLarge)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseBorrowed, wide, xmlWide)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseBorrowed, text, xmlText)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlWrite, large, xmlLarge)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlWrite, text, xmlText)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlWriter, large, xmlLarge)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlWriter, text, xmlText)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlIterate, wide, xmlWide)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlIterate, deep, xmlDeep)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlLookup, wide, xmlWide)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(xmlIndex, wide, xmlWide)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlQuery, section, "/document/section[@id='s500']/item[3]")->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(xmlQueryManual, section, findSectionItem)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(xmlQueryStream, section, "/document/section[@id='s500']/item[3]")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlQuery, items, "//item[@id='7']")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlQueryManual, items, findItems)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlQueryStream, items, "//item[@id='7']")->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParse, records, xmlRecords)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseKeys, records, xmlRecords)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlKeysFind, records, xmlRecords);
+BENCHMARK_CAPTURE(xmlKeysTraverse, records, xmlRecords)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseParallel, large, xmlLarge)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseParallel, records, xmlRecords)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseDocumentParallel, records, xmlRecords)->RangeMultiplier(2)->Range(1, 16)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(xmlParseFile, huge, xmlHuge)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_CAPTURE(xmlReadFile, huge, xmlHuge)->Unit(benchmark::kMillisecond)->Iterations(3);
+
+// Xss
+static void xssParse(benchmark::State &state, std::string (*generate)()) {
+	std::string text = corpus(generate);
+
+	Xela::Xss::Stats stats;
+	Xela::Xss::ParseOptions counted;
+	counted.stats = &stats;
+	delete Xela::Xss::fromString(text, counted);
+
+	size_t before = allocations;
+	for (auto _ : state) {
+		Xela::Xss *xss = Xela::Xss::fromString(text);
+		benchmark::DoNotOptimize(xss);
+		delete xss;
+	}
+	report(state, text.size(), stats.styles + stats.specs, allocations - before);
+}
+
+BENCHMARK_CAPTURE(xssParse, large, xssLarge)->Unit(benchmark::kMillisecond);
+
+// Baselines
+// Prints as usual and keeps each benchmark's time per iteration, in nanoseconds
+class Recorder : public benchmark::ConsoleReporter {
+public:
+	std::map<std::string, double> times;
+
+	void ReportRuns(const std::vector<Run> &runs) override {
+		for (const Run &run : runs) {
+			if (run.run_type == Run::RT_Iteration && run.iterations > 0) {
+				times[run.benchmark_name()] = run.GetAdjustedRealTime() * nanoseconds(run.time_unit);
+			}
+		}
+		ConsoleReporter::ReportRuns(runs);
+	}
+
+private:
+	static double nanoseconds(benchmark::TimeUnit unit) {
+		switch (unit) {
+		case benchmark::kSecond:
+			return 1e9;
+		case benchmark::kMillisecond:
+			return 1e6;
+		case benchmark::kMicrosecond:
+			return 1e3;
+		default:
+			return 1;
+		}
+	}
+};
+
+static void saveBaseline(const std::string &file, const std::map<std::string, double> &times) {
+	std::ofstream out(file, std::ios::binary);
+	Xela::Json::Writer writer(out, true);
+	writer.beginObject();
+	for (auto &[name, time] : times) {
+		writer.key(name).value(time);
+	}
+	writer.endObject();
+	writer.flush();
+}
+static void compareBaseline(const std::string &file, const std::map<std::string, double> &times) {
+	Xela::Json *baseline = Xela::Json::fromFile(file);
+
+	std::printf("\nComparison with %s (time per iteration, negative is faster)\n", file.c_str());
+	for (auto &[name, time] : times) {
+		auto it = baseline->asObject().find(name);
+		if (it == baseline->asObject().end()) {
+			std::printf("%-40s %12s %12.3f ms\n", name.c_str(), "new", time / 1e6);
+			continue;
+		}
+
+		const Xela::Json &old = *it->second;
+		double before = old.type() == Xela::Json::Type::Integer ? (double)old.asInt() : (double)old.asFloat();
+		std::printf("%-40s %9.3f ms %9.3f ms %+7.1f%%\n", name.c_str(), before / 1e6, time / 1e6, (time - before) / before * 100.0);
+	}
+
+	Xela::Json::destroy(baseline);
+}
+
+int main(int argc, char **argv) {
+	// Baseline flags are removed before Google Benchmark sees the rest
+	std::string save, compare;
+	std::vector<char *> args;
+	for (int i = 0; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg.rfind("--save_baseline=", 0) == 0) {
+			save = arg.substr(16);
+		}
+		else if (arg.rfind("--baseline=", 0) == 0) {
+			compare = arg.substr(11);
+		}
+		else {
+			args.push_back(argv[i]);
+		}
+	}
+
+	int count = (int)args.size();
+	benchmark::Initialize(&count, args.data());
+	if (benchmark::ReportUnrecognizedArguments(count, args.data())) {
+		return 1;
+	}
+
+	Recorder recorder;
+	benchmark::RunSpecifiedBenchmarks(&recorder);
+	benchmark::Shutdown();
+
+	if (!save.empty()) {
+		saveBaseline(save, recorder.times);
+	}
+	if (!compare.empty()) {
+		compareBaseline(compare, recorder.times);
+	}
+
+	return 0;
+}
@@ -0,0 +1,560 @@
+// Xela Async
+//
+// Author: Alex Morse
+//
+// Worker pool, file reading and arenas shared by the parallel parses and asynchronous loaders of the Xela parsers.
+// Everything is defined inline, so each parser can include it without another implementation define, and any number
+// of source files can use it. co_await support needs a compiler with coroutines enabled.
+//
+// This software is dual-licensed to the public domain and under the following
+// license: you are granted a perpetual, irrevocable license to copy, modify,
+// publish, and distribute this file as you see fit.
+
+#ifndef _XELA_ASYNC_HPP
+#define _XELA_ASYNC_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define _XELA_ASYNC_COROUTINES
+#endif
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#define _XELA_ASYNC_PREAD
+#endif
+
+#define _XELA_ASYNC_START namespace Xela {  extern "C" {
+#define _XELA_ASYNC_END } }
+
+_XELA_ASYNC_START // C style structs and functions
+
+// Runs submitted tasks on a fixed set of threads. Every worker has its own queue: tasks submitted by a worker go on
+// its queue and tasks from other threads are dealt out in turn. Workers take their newest task first and, once their
+// queue is empty, steal the oldest task from another. Queued tasks finish before the pool is destroyed.
+class ThreadPool {
+public:
+	ThreadPool(size_t threads);
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+	~ThreadPool();
+
+	void submit(std::function<void()> task);
+	// Calls task(index, worker) for every index below count and returns once all calls are done. worker identifies
+	// the thread: below size() on pool threads, and size() on the calling thread, which runs tasks while it waits.
+	void run(size_t count, std::function<void(size_t index, size_t worker)> task);
+	size_t size() const;
+
+	// Pool with one thread per core, used by the loaders when none is given
+	static ThreadPool &shared();
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	// Tasks waiting in any queue, and the queue the next task from outside the pool goes on
+	std::atomic<size_t> queued = 0;
+	std::atomic<size_t> nextQueue = 0;
+
+	// Guards sleeping and stopping
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	// The pool and worker index of the calling thread, if it belongs to a pool
+	static inline thread_local const ThreadPool *currentPool = nullptr;
+	static inline thread_local size_t currentWorker = 0;
+
+	size_t self() const;
+	bool take(size_t worker, std::function<void()> &task);
+	void work(size_t worker);
+};
+
+// Reads whole files for the asynchronous loaders. done may be called from any thread, with the file's contents or
+// with a message describing why it could not be read.
+class IoBackend {
+public:
+	using Callback = std::function<void(std::string contents, std::string error)>;
+
+	virtual ~IoBackend() = default;
+	virtual void read(const std::filesystem::path &file, Callback done) = 0;
+
+	// Backend used by the loaders when none is given. Starts as a PoolIo; setShared(nullptr) goes back to it.
+	static IoBackend &shared();
+	static void setShared(IoBackend *io);
+
+private:
+	static inline std::atomic<IoBackend *> sharedIo = nullptr;
+};
+
+// Blocking reads spread over their own threads, so many files are read at once while parsing runs on other threads.
+// Uses pread where it is available.
+class PoolIo : public IoBackend {
+public:
+	PoolIo(size_t threads);
+
+	void read(const std::filesystem::path &file, Callback done) override;
+
+private:
+	ThreadPool pool;
+};
+
+// Loads many files at once
+class Batch {
+public:
+	// Regular files beneath directory, at any depth, whose names match pattern, in sorted order.
+	// '*' matches any run of characters and '?' any single one.
+	static std::vector<std::filesystem::path> find(const std::filesystem::path &directory, std::string_view pattern);
+
+	// Reads every file on pool and passes its contents to parse, which must not throw. Each thread reads into one
+	// buffer it keeps for every file it handles. error is empty unless the file could not be read.
+	static void load(const std::vector<std::filesystem::path> &files, ThreadPool &pool,
+		std::function<void(size_t index, std::string &contents, const std::string &error)> parse);
+
+	// Reads a whole file into contents, keeping its capacity. Returns why it failed, or an empty string.
+	static std::string read(const std::filesystem::path &file, std::string &contents);
+
+private:
+	static bool match(std::string_view name, std::string_view pattern);
+};
+
+// Monotonic memory for a tree built on a worker thread. Freeing is a no-op, but every allocation keeps the arena
+// alive: it deletes itself once release() has been called and everything allocated from it has been freed, so trees
+// may outlive whoever created it. Like the trees in it, it allocates for one thread at a time.
+class Arena : public std::pmr::memory_resource {
+public:
+	// Must be created with new
+	Arena();
+	// Bytes to set aside for the first block
+	Arena(size_t initialSize);
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	// Gives up the creator's hold on the arena
+	void release();
+
+protected:
+	void *do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+private:
+	std::pmr::monotonic_buffer_resource memory;
+	// Allocations not yet freed, plus one until release()
+	std::atomic<size_t> holds = 1;
+
+	void drop();
+};
+
+// Result of an asynchronous load. Wait with get() or co_await the typed result in each parser; a coroutine is resumed
+// on the thread that finished the load. A result nobody takes is freed once the load completes.
+class Pending {
+public:
+	Pending(Pending &&) = default;
+	Pending &operator=(Pending &&) = default;
+
+	bool ready() const;
+	void wait() const;
+
+#ifdef _XELA_ASYNC_COROUTINES
+	bool await_ready() const noexcept;
+	bool await_suspend(std::coroutine_handle<> handle);
+#endif
+
+	// Reads file with io and then parses its contents on pool. parse throws if error is not empty.
+	// done receives what parse returned or the exception that was thrown.
+	static void load(const std::filesystem::path &file, IoBackend &io, ThreadPool &pool,
+		std::function<void *(std::string &contents, const std::string &error)> parse,
+		std::function<void(void *value, std::exception_ptr error)> done);
+
+protected:
+	struct State {
+		std::mutex lock;
+		std::condition_variable finished;
+		bool done = false;
+		void *value = nullptr;
+		std::exception_ptr error;
+#ifdef _XELA_ASYNC_COROUTINES
+		std::coroutine_handle<> waiter;
+#endif
+		void (*discard)(void *value) = nullptr;
+
+		~State();
+	};
+	std::shared_ptr<State> state;
+
+	Pending(void (*discard)(void *value));
+
+	// Callback that completes this result
+	std::function<void(void *value, std::exception_ptr error)> completer() const;
+	// Waits, then hands over the value or rethrows the load's exception. Only the first call receives the value.
+	void *take();
+};
+
+// Thread pool
+inline ThreadPool::ThreadPool(size_t threads) {
+	threads = threads > 0 ? threads : 1;
+	for (size_t i = 0; i < threads; i++) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+	for (size_t i = 0; i < threads; i++) {
+		workers.emplace_back(&ThreadPool::work, this, i);
+	}
+}
+inline ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+inline void ThreadPool::submit(std::function<void()> task) {
+	size_t worker = self();
+	Queue &queue = *queues[worker < queues.size() ? worker : nextQueue++ % queues.size()];
+
+	// Counted before it is queued so the count never drops below zero
+	queued++;
+	{
+		std::lock_guard<std::mutex> guard(queue.lock);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	// Notifying under the lock keeps the pool alive until the call is done, even if the task finishes first and
+	// its waiter destroys the pool
+	std::lock_guard<std::mutex> guard(lock);
+	wake.notify_one();
+}
+inline void ThreadPool::run(size_t count, std::function<void(size_t index, size_t worker)> task) {
+	size_t remaining = count;
+	std::mutex doneLock;
+	std::condition_variable done;
+
+	for (size_t index = 0; index < count; index++) {
+		submit([&, index] {
+			task(index, self());
+
+			// The count and the notify share the lock, so the caller can't return and free them mid-call
+			std::lock_guard<std::mutex> guard(doneLock);
+			if (--remaining == 0)
+				done.notify_all();
+		});
+	}
+
+	// Helping here also keeps a pool thread that calls run from sitting idle
+	std::function<void()> next;
+	while (take(self(), next)) {
+		next();
+		next = nullptr;
+	}
+
+	std::unique_lock<std::mutex> guard(doneLock);
+	done.wait(guard, [&] { return remaining == 0; });
+}
+inline size_t ThreadPool::size() const {
+	return workers.size();
+}
+
+inline ThreadPool &ThreadPool::shared() {
+	static ThreadPool pool(std::thread::hardware_concurrency());
+	return pool;
+}
+
+inline size_t ThreadPool::self() const {
+	return currentPool == this ? currentWorker : queues.size();
+}
+inline bool ThreadPool::take(size_t worker, std::function<void()> &task) {
+	// Own queue from the back, then other queues from the front
+	for (size_t i = 0; i < queues.size() && queued.load() > 0; i++) {
+		size_t idx = (worker + i) % queues.size();
+		Queue &queue = *queues[idx];
+
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.tasks.empty()) {
+			continue;
+		}
+
+		if (idx == worker) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		queued--;
+		return true;
+	}
+	return false;
+}
+inline void ThreadPool::work(size_t worker) {
+	currentPool = this;
+	currentWorker = worker;
+
+	while (true) {
+		std::function<void()> task;
+		if (take(worker, task)) {
+			task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(lock);
+		wake.wait(guard, [&] { return stopping || queued.load() > 0; });
+		if (stopping && queued.load() == 0) {
+			return;
+		}
+	}
+}
+
+// I/O backends
+inline IoBackend &IoBackend::shared() {
+	// Reads block, so there are more reading threads than cores
+	static PoolIo io(16);
+	IoBackend *current = sharedIo.load();
+	return current != nullptr ? *current : io;
+}
+inline void IoBackend::setShared(IoBackend *io) {
+	sharedIo.store(io);
+}
+
+inline PoolIo::PoolIo(size_t threads) : pool(threads) {}
+
+inline void PoolIo::read(const std::filesystem::path &file, Callback done) {
+	pool.submit([file, done = std::move(done)] {
+		std::string contents;
+		std::string error = Batch::read(file, contents);
+		done(std::move(contents), std::move(error));
+	});
+}
+
+// Batches
+inline std::vector<std::filesystem::path> Batch::find(const std::filesystem::path &directory, std::string_view pattern) {
+	std::vector<std::filesystem::path> ret;
+	for (const std::filesystem::directory_entry &entry : std::filesystem::recursive_directory_iterator(directory)) {
+		if (entry.is_regular_file() && match(entry.path().filename().string(), pattern)) {
+			ret.push_back(entry.path());
+		}
+	}
+
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+inline void Batch::load(const std::vector<std::filesystem::path> &files, ThreadPool &pool,
+	std::function<void(size_t index, std::string &contents, const std::string &error)> parse) {
+	// Indexed by worker, with the calling thread last
+	std::vector<std::string> buffers(pool.size() + 1);
+
+	pool.run(files.size(), [&](size_t index, size_t worker) {
+		std::string &buffer = buffers[worker];
+		std::string error = read(files[index], buffer);
+		parse(index, buffer, error);
+	});
+}
+
+inline std::string Batch::read(const std::filesystem::path &file, std::string &contents) {
+#ifdef _XELA_ASYNC_PREAD
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return "Failed to open file: " + file.string();
+	}
+
+	struct stat info;
+	contents.resize(::fstat(fd, &info) == 0 ? (size_t)info.st_size : 0);
+
+	size_t total = 0;
+	while (total < contents.size()) {
+		ssize_t count = ::pread(fd, contents.data() + total, contents.size() - total, (off_t)total);
+		if (count <= 0) {
+			break;
+		}
+		total += (size_t)count;
+	}
+	contents.resize(total);
+	::close(fd);
+#else
+	std::ifstream in(file, std::ios::binary);
+	if (!in.is_open()) {
+		return "Failed to open file: " + file.string();
+	}
+
+	std::error_code error;
+	contents.resize((size_t)std::filesystem::file_size(file, error));
+	in.read(contents.data(), contents.size());
+	contents.resize((size_t)in.gcount());
+#endif
+
+	return "";
+}
+
+inline bool Batch::match(std::string_view name, std::string_view pattern) {
+	// On a mismatch, the last '*' is retried one character further along
+	size_t n = 0, p = 0, star = std::string_view::npos, resume = 0;
+	while (n < name.size()) {
+		if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+			n++;
+			p++;
+		}
+		else if (p < pattern.size() && pattern[p] == '*') {
+			star = p++;
+			resume = n;
+		}
+		else if (star != std::string_view::npos) {
+			p = star + 1;
+			n = ++resume;
+		}
+		else {
+			return false;
+		}
+	}
+
+	while (p < pattern.size() && pattern[p] == '*') {
+		p++;
+	}
+	return p == pattern.size();
+}
+
+// Arenas
+inline Arena::Arena() {}
+inline Arena::Arena(size_t initialSize) : memory(initialSize) {}
+
+inline void Arena::release() {
+	drop();
+}
+
+inline void *Arena::do_allocate(size_t bytes, size_t alignment) {
+	holds.fetch_add(1, std::memory_order_relaxed);
+	return memory.allocate(bytes, alignment);
+}
+inline void Arena::do_deallocate(void *, size_t, size_t) {
+	drop();
+}
+inline bool Arena::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+	return this == &other;
+}
+
+inline void Arena::drop() {
+	// The last hold out frees the arena, after every other thread's frees are visible
+	if (holds.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		delete this;
+	}
+}
+
+// Pending results
+inline Pending::State::~State() {
+	if (value != nullptr && discard != nullptr) {
+		discard(value);
+	}
+}
+
+inline Pending::Pending(void (*discard)(void *value)) : state(std::make_shared<State>()) {
+	state->discard = discard;
+}
+
+inline bool Pending::ready() const {
+	std::lock_guard<std::mutex> guard(state->lock);
+	return state->done;
+}
+inline void Pending::wait() const {
+	std::unique_lock<std::mutex> guard(state->lock);
+	state->finished.wait(guard, [&] { return state->done; });
+}
+
+#ifdef _XELA_ASYNC_COROUTINES
+inline bool Pending::await_ready() const noexcept {
+	std::lock_guard<std::mutex> guard(state->lock);
+	return state->done;
+}
+inline bool Pending::await_suspend(std::coroutine_handle<> handle) {
+	// The load may have finished since await_ready, in which case the coroutine continues without suspending
+	std::lock_guard<std::mutex> guard(state->lock);
+	if (state->done) {
+		return false;
+	}
+
+	state->waiter = handle;
+	return true;
+}
+#endif
+
+inline void Pending::load(const std::filesystem::path &file, IoBackend &io, ThreadPool &pool,
+	std::function<void *(std::string &contents, const std::string &error)> parse,
+	std::function<void(void *value, std::exception_ptr error)> done) {
+	io.read(file, [&pool, parse = std::move(parse), done = std::move(done)](std::string contents, std::string error) mutable {
+		// Parsing moves off the reading thread so it can start on the next file
+		pool.submit([contents = std::move(contents), error = std::move(error), parse = std::move(parse), done = std::move(done)]() mutable {
+			void *value = nullptr;
+			try {
+				value = parse(contents, error);
+			}
+			catch (...) {
+				done(nullptr, std::current_exception());
+				return;
+			}
+			done(value, nullptr);
+		});
+	});
+}
+
+inline std::function<void(void *value, std::exception_ptr error)> Pending::completer() const {
+	return [state = state](void *value, std::exception_ptr error) {
+#ifdef _XELA_ASYNC_COROUTINES
+		std::coroutine_handle<> waiter;
+#endif
+		{
+			std::lock_guard<std::mutex> guard(state->lock);
+			state->value = value;
+			state->error = error;
+			state->done = true;
+#ifdef _XELA_ASYNC_COROUTINES
+			waiter = state->waiter;
+#endif
+		}
+		state->finished.notify_all();
+
+#ifdef _XELA_ASYNC_COROUTINES
+		if (waiter) {
+			waiter.resume();
+		}
+#endif
+	};
+}
+inline void *Pending::take() {
+	wait();
+
+	std::lock_guard<std::mutex> guard(state->lock);
+	if (state->error != nullptr) {
+		std::rethrow_exception(state->error);
+	}
+
+	void *value = state->value;
+	state->value = nullptr;
+	return value;
+}
+
+_XELA_ASYNC_END
+#endif
@@ -8,6 +8,9 @@
 //		String parser does not support the following escape sequences:
 //			Octal values, hex values, and unicode values
 // 
+// Define XELA_PARSE_STATS before including to fill in ParseOptions::stats.
+// Without it the counters are compiled out and the option is ignored.
+// 
 // This software is dual-licensed to the public domain and under the following
 // license: you are granted a perpetual, irrevocable license to copy, modify,
 // publish, and distribute this file as you see fit.
@@ -18,10 +21,35 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <functional>
+#include <charconv>
+#include <cstdio>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <string_view>
+#include <chrono>
+#include <bit>
+
+#include "XelaAsync.hpp"
+#include "XelaLines.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define _XELA_JSON_SSE2
+#endif
 
 #define _XELA_JSON_START namespace Xela {  extern "C" {
 #define _XELA_JSON_END } }
@@ -53,16 +81,223 @@ public:
 	json_file_error(const std::string &str) : runtime_error(str) {}
 	json_file_error(const char *str) : runtime_error(str) {}
 };
+class json_patch_error : public std::runtime_error {
+public:
+	json_patch_error(const std::string &str) : runtime_error(str) {}
+	json_patch_error(const char *str) : runtime_error(str) {}
+};
+class json_schema_error : public std::runtime_error {
+public:
+	json_schema_error(const std::string &str) : runtime_error(str) {}
+	json_schema_error(const char *str) : runtime_error(str) {}
+};
+class json_write_error : public std::runtime_error {
+public:
+	json_write_error(const std::string &str) : runtime_error(str) {}
+	json_write_error(const char *str) : runtime_error(str) {}
+};
 
 struct Json {
 public:
-	using Object = std::unordered_map<std::string, Json *>;
-	using Array = std::vector<Json *>;
+	using Object = std::pmr::unordered_map<std::string, Json *>;
+	using Array = std::pmr::vector<Json *>;
 	enum class Type {
 		Object, Array, String, Integer, Float, Bool, Null
 	};
 
+	struct Location {
+		size_t line;
+		size_t col;
+	};
+
+	// Byte offset of each node produced by a parse, kept beside the tree so nodes stay the same size.
+	// Recording is off unless one is passed through ParseOptions::locations.
+	class SourceMap {
+	public:
+		// Byte offset where node starts, or std::string::npos if it was not recorded
+		size_t offset(const Json *node) const;
+		// Line and column where node starts, or { 0, 0 } if it was not recorded
+		Location locate(const Json *node) const;
+
+		const std::string &source() const;
+		size_t size() const;
+		void clear();
+
+	private:
+		friend struct Json;
+
+		std::string text;
+
+		// Parallel arrays in the order nodes were parsed. ends holds the offset just past each value.
+		std::vector<const Json *> nodes;
+		std::vector<size_t> offsets;
+		std::vector<size_t> ends;
+
+		// Positions in nodes sorted by address, built on the first lookup
+		mutable std::vector<size_t> sorted;
+
+		void record(const Json *node, size_t offset, size_t end);
+	};
+
+	// Content hash of each object and array produced by a parse, computed bottom-up as containers close.
+	// Hashing is off unless one is passed through ParseOptions::hashes. reparse and patch keep the hashes they are
+	// given up to date; a tree changed by hand needs changed() before its hashes are used again.
+	class Digests {
+	public:
+		// Hash of node and everything beneath it. Containers that were not recorded are hashed now and remembered.
+		std::uint64_t hash(const Json *node);
+		// Whether a and b hold the same content, going by their hashes alone. The hashes must be fresh: taken from
+		// trees that have not changed since, such as frozen or Store trees, or kept up to date with changed().
+		bool same(const Json *a, const Json *b);
+		// Drops the hashes that cover the value at pointer below root: every container on the way down to it, and
+		// everything beneath it. Call it after changing a tree by hand, and before freeing anything taken out of it.
+		void changed(const Json *root, const std::string &pointer);
+
+		size_t size() const;
+		void clear();
+
+	private:
+		friend struct Json;
+
+		std::unordered_map<const Json *, std::uint64_t> hashes;
+
+		// Drops the entries of node and everything beneath it
+		void forget(const Json *node);
+	};
+
+	// What a parse did, filled in when passed through ParseOptions::stats and XELA_PARSE_STATS is defined.
+	// Each parse starts from zero.
+	class Stats {
+	public:
+		// Input bytes consumed
+		size_t bytes = 0;
+		// Values created, indexed by Type
+		size_t nodes[(size_t)Type::Null + 1] = {};
+		// Deepest value, with the root at 1
+		size_t maxDepth = 0;
+		// Allocations made for values and their contents, and their total size. Storage that objects, arrays and
+		// strings grow into is not counted; parse into a counting memory resource to see it.
+		size_t allocations = 0;
+		size_t allocated = 0;
+		// Time spent reading the input, by fromFile and fromStream, and parsing it
+		std::chrono::nanoseconds read{};
+		std::chrono::nanoseconds parse{};
+
+		size_t total() const;
+		void clear();
+
+	private:
+		friend struct Json;
+
+		void record(const Json *value, size_t depth);
+		// Adds the counts of a part of the document whose root sat at depth
+		void merge(const Stats &other, size_t depth);
+	};
+
+	// A compiled subset of JSON Schema: type, required, properties, items, enum, minimum, maximum, minLength,
+	// maxLength, minItems and maxItems. Other keywords are ignored.
+	class Schema {
+	public:
+		static Schema fromJson(const Json *schema);
+
+		// Walks an existing tree and throws a json_schema_error at the first value that does not match
+		void validate(const Json *json) const;
+
+	private:
+		friend struct Json;
+
+		// One per schema object. Child rules are indices into rules, or std::string::npos when unconstrained.
+		struct Rule {
+			unsigned types = ~0u;
+			std::vector<std::string> required;
+			std::unordered_map<std::string, size_t> properties;
+			size_t items = std::string::npos;
+			std::vector<std::shared_ptr<const Json>> choices;
+			double minimum = -std::numeric_limits<double>::infinity();
+			double maximum = std::numeric_limits<double>::infinity();
+			size_t minLength = 0;
+			size_t maxLength = std::string::npos;
+			size_t minItems = 0;
+			size_t maxItems = std::string::npos;
+		};
+		// The root rule is first
+		std::vector<Rule> rules;
+
+		size_t member(size_t rule, const std::string &key) const;
+		size_t item(size_t rule) const;
+
+		// Describes why value breaks rule, or returns an empty string. Objects and arrays are checked once when they
+		// open, before any children exist, and again when they close.
+		std::string checkOpen(size_t rule, const Json *value) const;
+		std::string checkClosed(size_t rule, const Json *value) const;
+	};
+
+	struct ParseOptions {
+		// Objects and arrays nested deeper than this fail with a json_parse_error
+		size_t maxDepth = 1024;
+		// When set, receives the offset of every parsed value
+		SourceMap *locations = nullptr;
+		// When set, receives the hash of every parsed object and array
+		Digests *hashes = nullptr;
+		// When set, each value is checked as soon as it is read and the first mismatch throws a json_schema_error
+		const Schema *schema = nullptr;
+		// Values above 1 split a top level array into this many runs parsed on pool. Without a resource, each run
+		// allocates from an Arena of its own, freed once the last of its nodes is.
+		size_t threads = 1;
+		// Runs the parallel parse, or ThreadPool::shared() when not set
+		ThreadPool *pool = nullptr;
+		// When set, nodes and their objects and arrays are allocated from it instead of the global heap. Strings
+		// longer than the small string buffer still use the heap. It must be thread safe when threads is above 1.
+		std::pmr::memory_resource *resource = nullptr;
+		// When set, receives counts and timings for the parse
+		Stats *stats = nullptr;
+	};
+
+	// Replaces removed bytes at offset with inserted
+	struct Edit {
+		size_t offset;
+		size_t removed;
+		std::string inserted;
+	};
+
 private:
+	// Read position within the buffer being parsed. Mirrors the parts of std::istream the parser uses.
+	// Only the byte offset is tracked; line and column are computed by locate() when an error is built.
+	struct Cursor {
+		const char *begin;
+		const char *curr;
+		const char *end;
+		// Where new nodes are allocated, or nullptr for new
+		std::pmr::memory_resource *resource = nullptr;
+
+		int peek() const {
+			return curr < end ? (unsigned char)*curr : EOF;
+		}
+		int get() {
+			const char *c = curr++;
+			return c < end ? (unsigned char)*c : EOF;
+		}
+		void ignore() {
+			curr++;
+		}
+		void unget() {
+			curr--;
+		}
+		bool eof() const {
+			return curr >= end;
+		}
+
+		size_t offset() const {
+			return (curr < end ? curr : end) - begin;
+		}
+		std::string where() const {
+			// Errors are reported at the last character read
+			size_t last = offset();
+			Location loc = locate(std::string_view(begin, end - begin), last > 0 ? last - 1 : 0);
+			return std::to_string(loc.line) + ", " + std::to_string(loc.col);
+		}
+	};
+
 	union {
 		Object *map;
 		Array *arr;
@@ -73,6 +308,10 @@ private:
 		void *ptr = nullptr;
 	};
 	Type dataType = Type::Null;
+	// Holds this node and its data, or nullptr if both were made with new
+	std::pmr::memory_resource *resource = nullptr;
+
+	static Json *create(std::pmr::memory_resource *resource);
 
 	void initMap();
 	void initArray();
@@ -86,21 +325,63 @@ private:
 	static bool isNumeric(char c);
 	static bool isEndOfValue(char c);
 
-	static void consumeWhitespace(std::istream &in, size_t &line, size_t &col);
-	static void consumeComment(std::istream &in, size_t &line, size_t &col);
-
-	static char getEscapeCharacter(std::istream &in, size_t &line, size_t &col);
-	static std::string readString(std::istream &in, size_t &line, size_t &col);
-
-	static Json *parseObject(std::istream &in, size_t &line, size_t &col);
-	static Json *parseArray(std::istream &in, size_t &line, size_t &col);
-	static Json *parseString(std::istream &in, size_t &line, size_t &col);
-	static Json *parseNumber(std::istream &in, size_t &line, size_t &col);
-	static Json *parseKeyword(std::istream &in, size_t &line, size_t &col);
+	static void consumeWhitespace(Cursor &in);
+	static void consumeComment(Cursor &in);
+
+	static char getEscapeCharacter(Cursor &in);
+	static void readUnicodeEscape(Cursor &in, std::string &out);
+	static std::string readString(Cursor &in);
+
+	static Json *parseObject(Cursor &in);
+	static Json *parseArray(Cursor &in);
+	static Json *parseString(Cursor &in);
+	static Json *parseNumber(Cursor &in);
+	static Json *parseKeyword(Cursor &in);
+
+	static Json *parseValue(Cursor &in, const ParseOptions &options, size_t rule = 0);
+
+	static bool splitArray(Cursor in, std::vector<Cursor> &elements);
+	static Json *parseParallel(Cursor &in, const ParseOptions &options);
+
+	static std::uint64_t mixHash(std::uint64_t seed, std::uint64_t value);
+	static std::uint64_t hashScalar(const Json *val);
+	static std::uint64_t hashContainer(const Json *val, const std::unordered_map<const Json *, std::uint64_t> &hashes);
+	static void hashTree(const Json *root, std::unordered_map<const Json *, std::uint64_t> &hashes);
+	static bool sameChildren(const Json *a, const Json *b);
+
+	static std::string escapePointer(const std::string &key);
+	static std::vector<std::string> splitPointer(const std::string &path);
+	static size_t pointerIndex(const std::string &token, size_t size);
+	static Json *resolvePointer(Json *root, const std::vector<std::string> &tokens, size_t count);
+
+	// Changes made by a patch so far, undone in reverse if an operation fails. A step with a value put that value back
+	// at key or index, one without removes what was inserted there, and one without a parent restores the root.
+	struct PatchLog {
+		struct Step {
+			Json *parent;
+			std::string key;
+			size_t index;
+			Json *value;
+		};
+		std::vector<Step> steps;
+		// Copies the patch made, freed if it fails, and values it took out, freed once it succeeds
+		std::vector<Json *> created;
+		std::vector<Json *> removed;
+	};
 
-	static Json *parseValue(std::istream &in, size_t &line, size_t &col);
+	static void addPatchOp(Json *ops, const char *op, const std::string &path, const Json *value);
+	static Json *patchAdd(Json *root, const std::string &path, Json *value, PatchLog &log);
+	static Json *patchDetach(Json *&root, const std::string &path, PatchLog &log);
+	static void patchUndo(Json *&root, PatchLog &log);
+	static Json *applyPatch(Json *root, const Json *ops, Digests *hashes);
 
 	static void writeTab(std::ostream &out, size_t indent);
+	// First quote, backslash or control character, which have to be escaped inside quotes, or end if there is none
+	static const char *findEscape(const char *curr, const char *end);
+	// Escape for a character findEscape stopped at. Control characters without a short form are written into
+	// spare, which holds 7 characters.
+	static const char *escapeCharacter(unsigned char c, char *spare);
+	static void writeEscaped(std::ostream &out, std::string_view str);
 
 	static void writeObject(Json *val, std::ostream &out, size_t indent, bool pretty);
 	static void writeArray(Json *val, std::ostream &out, size_t indent, bool pretty);
@@ -116,10 +397,83 @@ public:
 	Json();
 	~Json();
 
+	// Nodes parsed into a memory resource are returned to it, so every node is deleted the same way
+	void operator delete(Json *json, std::destroying_delete_t);
+
 	static Json *fromStream(std::istream &in);
+	static Json *fromStream(std::istream &in, const ParseOptions &options);
 	static Json *fromFile(std::filesystem::path file);
+	static Json *fromFile(std::filesystem::path file, const ParseOptions &options);
 	static Json *fromString(std::string &str);
+	static Json *fromString(std::string &str, const ParseOptions &options);
 	static Json *fromType(Type type);
+	static Json *fromType(Type type, std::pmr::memory_resource *resource);
+
+	using LoadCallback = std::function<void(Json *json, std::exception_ptr error)>;
+
+	// Result of fromFileAsync. The tree belongs to whoever takes it with get() or co_await.
+	class Loading : public Pending {
+	public:
+		Json *get();
+		Json *await_resume();
+
+	private:
+		friend struct Json;
+
+		Loading();
+	};
+
+	// Reads the file on an IoBackend and parses it on a ThreadPool, the shared ones unless others are given.
+	// Anything options points to must outlive the load. done is called on a pool thread.
+	static Loading fromFileAsync(std::filesystem::path file);
+	static Loading fromFileAsync(std::filesystem::path file, const ParseOptions &options);
+	static Loading fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool);
+	static void fromFileAsync(std::filesystem::path file, const ParseOptions &options, LoadCallback done);
+	static void fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool, LoadCallback done);
+
+	// One file of a batch: its tree, or why it failed
+	struct Loaded {
+		std::filesystem::path file;
+		Json *json = nullptr;
+		std::exception_ptr error;
+	};
+
+	// Reads and parses every file on a ThreadPool, the shared one unless another is given. Results are in the same
+	// order as files, and a failed file does not stop the rest. Each tree belongs to the caller.
+	// Source maps, digests and stats are ignored, since they cannot be shared between files, and each file uses one
+	// thread. The trees outlive the batch, so rather than a worker reusing one arena for its files, each file is
+	// parsed into an Arena of its own that its tree frees, in place of any memory resource given.
+	static std::vector<Loaded> fromFiles(const std::vector<std::filesystem::path> &files);
+	static std::vector<Loaded> fromFiles(const std::vector<std::filesystem::path> &files, const ParseOptions &options, ThreadPool &pool);
+	// Every file beneath directory whose name matches pattern, as found by Batch::find
+	static std::vector<Loaded> fromDirectory(const std::filesystem::path &directory, std::string_view pattern);
+
+	// Line and column of the character at a byte offset within source. Both start at 1.
+	static Location locate(std::string_view source, size_t offset);
+
+	// Deletes a value and every value beneath it
+	static void destroy(Json *json);
+
+	// Applies edit to the text recorded in locations and updates the tree parsed from it. Only the smallest object or
+	// array enclosing the edit is parsed again and spliced in place; if the edit changes structure outside of it the
+	// whole document is parsed again. Returns the root, which is only replaced by a full parse.
+	static Json *reparse(Json *root, SourceMap &locations, const Edit &edit);
+	static Json *reparse(Json *root, SourceMap &locations, const Edit &edit, const ParseOptions &options);
+
+	// Hash of a value and everything beneath it. Object member order does not affect the hash.
+	static std::uint64_t hash(const Json *json);
+	static bool equals(const Json *a, const Json *b);
+	static Json *copy(const Json *json);
+
+	// JSON Patch (RFC 6902) that turns from into to, as an array of operation objects. Subtrees with equal hashes
+	// are skipped without being compared, so hashes must not be stale.
+	static Json *diff(const Json *from, const Json *to);
+	static Json *diff(const Json *from, const Json *to, Digests &hashes);
+	// Applies a JSON Patch in place and returns the root, which is only replaced by operations on the root itself.
+	// The patch applies as a whole: if any operation fails, the earlier ones are undone before the error is thrown.
+	// Given hashes, drops those of everything the patch changes.
+	static Json *patch(Json *root, const Json *ops);
+	static Json *patch(Json *root, const Json *ops, Digests &hashes);
 
 	void write(bool pretty = false, std::ostream &out = std::cout);
 
@@ -130,6 +484,14 @@ public:
 	float &asFloat();
 	bool &asBool();
 
+	// Const accessors never change the value, so a tree may be read from many threads as long as none write to it
+	const Object &asObject() const;
+	const Array &asArray() const;
+	const std::string &asString() const;
+	const long long &asInt() const;
+	const float &asFloat() const;
+	const bool &asBool() const;
+
 	explicit operator Object &();
 	explicit operator Array &();
 	explicit operator std::string &();
@@ -139,13 +501,122 @@ public:
 
 	const Json &operator()(std::string &key);
 	const Json &operator[](size_t idx);
+	const Json &operator()(const std::string &key) const;
+	const Json &operator[](size_t idx) const;
 
 	Object::iterator find(std::string &key);
 	const Json &at(size_t idx);
+	Object::const_iterator find(const std::string &key) const;
+	const Json &at(size_t idx) const;
+
+	inline bool valid() const;
+	inline Type type() const;
+	inline size_t size() const;
+
+	// Hands this tree to a shared read-only handle. The tree is destroyed when the last handle is released.
+	std::shared_ptr<const Json> freeze();
+
+	// Holds the current version of a frozen document for hot reloading.
+	// Readers keep the version they loaded for as long as they hold it; store() publishes a new version
+	// and the old one is destroyed once its last reader lets go.
+	class Snapshot {
+	public:
+		Snapshot() = default;
+		Snapshot(std::shared_ptr<const Json> json);
+
+		std::shared_ptr<const Json> load() const;
+		void store(std::shared_ptr<const Json> json);
+		std::shared_ptr<const Json> exchange(std::shared_ptr<const Json> json);
+
+	private:
+		std::atomic<std::shared_ptr<const Json>> current;
+	};
+
+	// Shares identical subtrees between the documents added to it. Values held by a store are immutable and owned by
+	// it, and two values from the same store have equal content exactly when they are the same pointer.
+	// A store must not be added to from several threads at once.
+	class Store {
+	public:
+		Store() = default;
+		Store(const Store &) = delete;
+		Store &operator=(const Store &) = delete;
+		~Store();
+
+		// Takes ownership of json and returns its shared equivalent. Nodes already held are reused and the
+		// duplicates in json are deleted.
+		const Json *intern(Json *json);
+
+		// Distinct values held, and values passed through intern() in total
+		size_t size() const;
+		size_t interned() const;
+
+	private:
+		std::unordered_multimap<std::uint64_t, Json *> values;
+		std::unordered_map<const Json *, std::uint64_t> hashes;
+		size_t total = 0;
+	};
 
-	inline bool valid();
-	inline Type type();
-	inline size_t size();
+	// Produces Json text directly from a sequence of calls, without building a tree. The text matches what write()
+	// gives for the same values. It is buffered and handed to the sink whenever about chunkSize bytes are waiting;
+	// without a sink it collects in str(). Calls that break nesting throw a json_write_error in debug builds.
+	class Writer {
+	public:
+		using Sink = std::function<void(const char *data, size_t size)>;
+
+		Writer(bool pretty = false);
+		Writer(std::ostream &out, bool pretty = false, size_t chunkSize = 1 << 16);
+		Writer(Sink sink, bool pretty = false, size_t chunkSize = 1 << 16);
+		Writer(const Writer &) = delete;
+		Writer &operator=(const Writer &) = delete;
+		~Writer();
+
+		Writer &beginObject();
+		Writer &endObject();
+		Writer &beginArray();
+		Writer &endArray();
+		Writer &key(std::string_view name);
+
+		Writer &value(std::string_view str);
+		Writer &value(const char *str);
+		Writer &value(int num);
+		Writer &value(long num);
+		Writer &value(long long num);
+		Writer &value(unsigned num);
+		Writer &value(unsigned long num);
+		Writer &value(unsigned long long num);
+		Writer &value(float num);
+		// Json stores floats, so the value is narrowed to float and written with float precision
+		Writer &value(double num);
+		Writer &value(bool b);
+		Writer &null();
+		// Writes an existing value and everything beneath it
+		Writer &value(const Json &json);
+
+		// Hands everything buffered to the sink. The destructor flushes too, but drops any error the sink throws.
+		void flush();
+		// Text that has not been handed to a sink
+		const std::string &str() const;
+
+	private:
+		struct Level {
+			bool object;
+			bool first;
+			bool hasKey;
+		};
+
+		std::string buffer;
+		Sink sink;
+		bool pretty;
+		size_t chunkSize;
+		std::vector<Level> levels;
+		bool done = false;
+
+		void beginValue();
+		void endValue();
+		void writeTab(size_t indent);
+		void writeEscaped(std::string_view str);
+		void fail(const char *message);
+	};
 };
 _XELA_JSON_END
 
@@ -154,7 +625,13 @@ _XELA_JSON_END
 // #define XELA_JSON_IMPLEMENTATION
 #ifdef XELA_JSON_IMPLEMENTATION
 
-#define JSON_ERR(line, col) std::string("Json [" + std::to_string(line) + ", " + std::to_string(col) + "]: ") +
+#define JSON_ERR(in) std::string("Json [" + in.where() + "]: ") +
+
+#ifdef XELA_PARSE_STATS
+#define JSON_STATS(stmt) if (options.stats != nullptr) { stmt; }
+#else
+#define JSON_STATS(stmt)
+#endif
 
 _XELA_JSON_START //C style structs and functions
 
@@ -166,34 +643,26 @@ bool Json::isEndOfValue(char c) {
 	return c == '}' || c == ']' || c == ',' || c == ':' || c == EOF || std::isspace(c) || c == '/';
 }
 
-void Json::consumeWhitespace(std::istream &in, size_t &line, size_t &col) {
+void Json::consumeWhitespace(Cursor &in) {
 	while (std::isspace(in.peek())) {
-		char c = in.get();
-		col++;
-		if (c == '\n') {
-			line++;
-			col = 0;
-		}
+		in.ignore();
 	}
 	if (in.peek() == '/') {
 		if ((in.get(), in.peek()) == '/') {
-			consumeComment(in, line, col);
-			consumeWhitespace(in, line, col);
+			consumeComment(in);
+			consumeWhitespace(in);
 		}
 		else {
 			in.unget();
-			col--;
 		}
 	}
 }
-void Json::consumeComment(std::istream &in, size_t &line, size_t &col) {
-	while (in.get() != '\n') { col++; }
-	line++;
+void Json::consumeComment(Cursor &in) {
+	while (!in.eof() && in.get() != '\n') {}
 }
 
-char Json::getEscapeCharacter(std::istream &in, size_t &line, size_t &col) {
+char Json::getEscapeCharacter(Cursor &in) {
 	char c = in.get();
-	col++;
 
 	switch (c) {
 	case '\'':
@@ -232,170 +701,155 @@ char Json::getEscapeCharacter(std::istream &in, size_t &line, size_t &col) {
 	case '0':
 		return '\0';
 	default:
-		throw json_parse_error(JSON_ERR(line, col) "Unrecognized escape sequence : \"\\" + c + "\"");
+		throw json_parse_error(JSON_ERR(in) "Unrecognized escape sequence : \"\\" + c + "\"");
 		break;
 	}
 
 	return '\0';
 }
-std::string Json::readString(std::istream &in, size_t &line, size_t &col) {
+std::string Json::readString(Cursor &in) {
 	// '"' _* '"'
 	char c = in.get();
-	col++;
 
 	if (c != '"') {
-		throw json_parse_error(JSON_ERR(line, col) "Strings must be enclosed in quotes");
+		throw json_parse_error(JSON_ERR(in) "Strings must be enclosed in quotes");
 	}
-	c = in.get();
-	col++;
 
 	std::string ret = "";
 
-	while (c != '"') {
-		if (c == '\\') {
-			c = getEscapeCharacter(in, line, col);
+	while (true) {
+		// Copy everything up to the next quote or escape at once
+		const char *start = in.curr;
+		while (in.curr < in.end && *in.curr != '"' && *in.curr != '\\') {
+			in.curr++;
 		}
-
-		ret += c;
+		ret.append(start, in.curr - start);
 
 		c = in.get();
-		col++;
+		if (c == '"') {
+			return ret;
+		}
 		if (c == EOF) {
-			throw json_parse_error(JSON_ERR(line, col) "Unexpected end of file parsing string");
+			throw json_parse_error(JSON_ERR(in) "Unexpected end of file parsing string");
 		}
+
+		if (in.peek() == 'u') {
+			readUnicodeEscape(in, ret);
+			continue;
+		}
+		ret += getEscapeCharacter(in);
 	}
+}
+void Json::readUnicodeEscape(Cursor &in, std::string &out) {
+	// 'u' hex hex hex hex, with characters beyond the first plane written as a surrogate pair of escapes.
+	// Appended as UTF-8.
+	auto readHex = [&]() {
+		unsigned value = 0;
+		for (int i = 0; i < 4; i++) {
+			int c = in.get();
+			int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+			if (digit < 0) {
+				throw json_parse_error(JSON_ERR(in) "Invalid unicode escape sequence");
+			}
+			value = value * 16 + (unsigned)digit;
+		}
+		return value;
+	};
 
-	return ret;
+	in.ignore();
+	unsigned code = readHex();
+	if (code >= 0xD800 && code < 0xDC00 && in.end - in.curr >= 6 && in.curr[0] == '\\' && in.curr[1] == 'u') {
+		in.curr += 2;
+		unsigned low = readHex();
+		if (low < 0xDC00 || low >= 0xE000) {
+			throw json_parse_error(JSON_ERR(in) "Invalid unicode surrogate pair");
+		}
+		code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+	}
+
+	if (code < 0x80) {
+		out += (char)code;
+	}
+	else if (code < 0x800) {
+		out += (char)(0xC0 | (code >> 6));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000) {
+		out += (char)(0xE0 | (code >> 12));
+		out += (char)(0x80 | ((code >> 6) & 0x3F));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	else {
+		out += (char)(0xF0 | (code >> 18));
+		out += (char)(0x80 | ((code >> 12) & 0x3F));
+		out += (char)(0x80 | ((code >> 6) & 0x3F));
+		out += (char)(0x80 | (code & 0x3F));
+	}
 }
 
 // Private parsing functions
-Json *Json::parseObject(std::istream &in, size_t &line, size_t &col) {
-	// '{' [String ':' Value] ',' ... '}'
+Json *Json::parseObject(Cursor &in) {
+	// '{'
+	// Members are read by parseValue so nesting does not grow the call stack
 	char c = in.get();
-	col++;
 	if (c != '{') {
-		throw json_parse_error(JSON_ERR(line, col) "Unexpected start of object: \"" + c + "\"");
+		throw json_parse_error(JSON_ERR(in) "Unexpected start of object: \"" + c + "\"");
 	}
 
-	Json *ret = new Json();
+	Json *ret = create(in.resource);
 	ret->initMap();
 
-	// Whitespace may appear at start of object
-	consumeWhitespace(in, line, col);
-
-	for (c = in.peek(); c != '}'; c = in.peek()) {
-		if (c == ',') {
-			// Comma indicates another key/value is coming
-			in.ignore();
-			col++;
-			continue;
-		}
-		else {
-			// Whitespace may appear here
-			consumeWhitespace(in, line, col);
-
-			// Read name
-			std::string name = readString(in, line, col);
-
-			// Whitespace may appear here
-			consumeWhitespace(in, line, col);
-
-			// Colon should split key/value
-			char c = in.get();
-			col++;
-			if (c != ':') {
-				throw json_parse_error(JSON_ERR(line, col) "Unexpected token while parsing key/value pair: \"" + c + "\"");
-			}
-
-			// Read value
-			Json *value = parseValue(in, line, col);
-
-			// Store key/value
-			ret->map->emplace(name, value);
-		}
-	}
-
-	//Ignore '}'
-	in.ignore();
-	col++;
-
 	return ret;
 }
-Json *Json::parseArray(std::istream &in, size_t &line, size_t &col) {
-	// '[' [Value] ',' ... ']'
+Json *Json::parseArray(Cursor &in) {
+	// '['
+	// Elements are read by parseValue so nesting does not grow the call stack
 	char c = in.get();
-	col++;
 	if (c != '[') {
-		throw json_parse_error(JSON_ERR(line, col) "Unexpected start of array: \"" + c + "\"");
+		throw json_parse_error(JSON_ERR(in) "Unexpected start of array: \"" + c + "\"");
 	}
 
-	Json *ret = new Json();
+	Json *ret = create(in.resource);
 	ret->initArray();
 
-	for (c = in.peek(); c != ']'; c = in.peek()) {
-		if (std::isspace(c)) {
-			// Whitespace may appear at start or end of array
-			consumeWhitespace(in, line, col);
-		}
-		else if (c == ',') {
-			// Comma indicates another value is coming
-			in.ignore();
-			col++;
-			continue;
-		}
-		else {
-			// Read value
-			Json *value = parseValue(in, line, col);
-
-			// Store value
-			ret->arr->push_back(value);
-		}
-	}
-
-	//Ignore ']'
-	in.ignore();
-	col++;
-
 	return ret;
 }
-Json *Json::parseString(std::istream &in, size_t &line, size_t &col) {
+Json *Json::parseString(Cursor &in) {
 	// '"' _* '"'
-	std::string str = readString(in, line, col);
+	std::string str = readString(in);
 
-	Json *ret = new Json();
+	Json *ret = create(in.resource);
 	ret->initString();
-	*ret->str = str;
+	*ret->str = std::move(str);
 
 	return ret;
 }
-Json *Json::parseNumber(std::istream &in, size_t &line, size_t &col) {
+Json *Json::parseNumber(Cursor &in) {
 	// ['-'] ('0'-'9')* ['.' ('0'-'9')*]
-	std::string res = "";
+	const char *start = in.curr;
 
 	do {
 		char c = in.get();
-		col++;
 
 		if (!Json::isNumeric(c)) {
-			throw json_parse_error(JSON_ERR(line, col) "Unexpected token reading number: \"" + c + "\"");
+			throw json_parse_error(JSON_ERR(in) "Unexpected token reading number: \"" + c + "\"");
 		}
-
-		res += c;
 	} while (!isEndOfValue(in.peek()));
 
-	Json *ret = new Json();
+	std::string res(start, in.curr - start);
 	float f;
 	try {
 		f = std::stof(res);
 	}
 	catch (std::invalid_argument err) {
-		throw json_parse_error(JSON_ERR(line, col) "Could not convert to number: " + res + "\n" + err.what());
+		throw json_parse_error(JSON_ERR(in) "Could not convert to number: " + res + "\n" + err.what());
 	}
 	catch (std::out_of_range err) {
-		throw json_parse_error(JSON_ERR(line, col) "Number out of range: " + res + "\n" + err.what());
+		throw json_parse_error(JSON_ERR(in) "Number out of range: " + res + "\n" + err.what());
 	}
 
-	if (std::fabsf(std::truncf(f) - f) < 0.000001f) {
+	Json *ret = create(in.resource);
+	if (std::fabs(std::trunc(f) - f) < 0.000001f) {
 		ret->initInt();
 		*ret->i = (long long)f;
 	}
@@ -406,22 +860,25 @@ Json *Json::parseNumber(std::istream &in, size_t &line, size_t &col) {
 
 	return ret;
 }
-Json *Json::parseKeyword(std::istream &in, size_t &line, size_t &col) {
+Json *Json::parseKeyword(Cursor &in) {
 	// 'True' | 'False' | 'Null'
 	std::string res = "";
 
 	do {
 		char c = in.get();
-		col++;
 
 		if ((c < 'a' || c > 'z') && (c < 'A' || c > 'Z')) {
-			throw json_parse_error(JSON_ERR(line, col) "Unexpected token reading keyword: \"" + c + "\"");
+			throw json_parse_error(JSON_ERR(in) "Unexpected token reading keyword: \"" + c + "\"");
 		}
 
 		res += std::tolower(c);
 	} while (!isEndOfValue(in.peek()));
 
-	Json *ret = new Json();
+	if (res != "true" && res != "false" && res != "null") {
+		throw json_parse_error(JSON_ERR(in) "Unrecognized keyword: " + res);
+	}
+
+	Json *ret = create(in.resource);
 
 	if (res == "true") {
 		ret->initBool();
@@ -431,100 +888,1769 @@ Json *Json::parseKeyword(std::istream &in, size_t &line, size_t &col) {
 		ret->initBool();
 		*ret->b = false;
 	}
-	else if (res != "null") {
-		throw json_parse_error(JSON_ERR(line, col) "Unrecognized keyword: " + res);
-	}
 
 	return ret;
 }
 
-Json *Json::parseValue(std::istream &in, size_t &line, size_t &col) {
+Json *Json::parseValue(Cursor &in, const ParseOptions &options, size_t rule) {
 	//	Object | Array | String | Number | Keyword
+	// Object: '{' [String ':' Value] ',' ... '}'
+	// Array: '[' [Value] ',' ... ']'
 
 	// TODO - Support for read references
 
-	// Get rid of leading whitespace
-	consumeWhitespace(in, line, col);
+	// Open objects and arrays, innermost last. Each object also holds the key its next value is stored under.
+	// When hashing, hash accumulates the children seen so far and keyHash is the hash of key.
+	// rule is the schema rule the container is checked against. stored is false for the value of a repeated key,
+	// which is freed when it closes, and kept is false within one, where nothing is hashed or located.
+	struct Frame {
+		Json *container;
+		std::string key;
+		size_t location;
+		std::uint64_t hash;
+		std::uint64_t keyHash;
+		size_t rule;
+		bool stored;
+		bool kept;
+	};
+	std::vector<Frame> stack;
+	stack.reserve(options.maxDepth < 64 ? options.maxDepth : 64);
+
+	Json *root = nullptr;
+
+	// Folds a child's hash into its parent. Matches hashContainer.
+	auto fold = [](Frame &parent, std::uint64_t hash) {
+		if (parent.container->dataType == Type::Object) {
+			parent.hash += mixHash(parent.keyHash, hash);
+		}
+		else {
+			parent.hash = mixHash(parent.hash, hash);
+		}
+	};
+	auto close = [&](size_t end) {
+		Frame &top = stack.back();
+		if (top.rule != std::string::npos) {
+			std::string problem = options.schema->checkClosed(top.rule, top.container);
+			if (!problem.empty()) {
+				throw json_schema_error(JSON_ERR(in) problem);
+			}
+		}
+
+		if (options.locations != nullptr && top.kept) {
+			options.locations->ends[top.location] = end;
+		}
+
+		Json *container = top.container;
+		bool stored = top.stored;
+		if (options.hashes != nullptr && top.kept) {
+			std::uint64_t hash = top.hash;
+			if (top.container->dataType == Type::Object) {
+				hash = mixHash(mixHash(mixHash(0, (std::uint64_t)Type::Object), top.container->map->size()), hash);
+			}
+			else {
+				hash = mixHash(hash, top.container->arr->size());
+			}
+			options.hashes->hashes[top.container] = hash;
+
+			stack.pop_back();
+			if (!stack.empty()) {
+				fold(stack.back(), hash);
+			}
+		}
+		else {
+			stack.pop_back();
+		}
+
+		if (!stored) {
+			destroy(container);
+		}
+	};
+
+	try {
+		while (true) {
+			// Get rid of leading whitespace
+			consumeWhitespace(in);
+
+			// Error check
+			if (in.eof()) {
+				throw json_parse_error(JSON_ERR(in) "Unexpected end of file while parsing value");
+			}
+
+			// Determine what type of value to parse
+			size_t start = in.offset();
+			char first = in.peek();
+			Json *value = nullptr;
+			if (first == '{' || first == '[') {
+				if (stack.size() >= options.maxDepth) {
+					throw json_parse_error(JSON_ERR(in) "Maximum nesting depth exceeded: " + std::to_string(options.maxDepth));
+				}
+
+				// Object or array
+				value = first == '{' ? parseObject(in) : parseArray(in);
+			}
+			else if (first == '"') {
+				// String
+				value = parseString(in);
+			}
+			else if (first == '-' || first == '+' || (first >= '0' && first <= '9')) {
+				// Number
+				value = parseNumber(in);
+			}
+			else {
+				// Keyword
+				value = parseKeyword(in);
+			}
+
+			// Check the value against the rule its parent gives it
+			size_t valueRule = std::string::npos;
+			if (options.schema != nullptr) {
+				if (stack.empty()) {
+					valueRule = rule;
+				}
+				else if (stack.back().rule != std::string::npos) {
+					Frame &top = stack.back();
+					valueRule = top.container->dataType == Type::Object ? options.schema->member(top.rule, top.key) : options.schema->item(top.rule);
+				}
+
+				if (valueRule != std::string::npos) {
+					std::string problem = options.schema->checkOpen(valueRule, value);
+					if (!problem.empty()) {
+						destroy(value);
+						throw json_schema_error(JSON_ERR(in) problem);
+					}
+				}
+			}
+
+			JSON_STATS(options.stats->record(value, stack.size() + 1));
+
+			// Store value in its parent as soon as it exists so a failed parse can free everything. A repeated key
+			// keeps its first value; the repeat is still parsed, then freed without being hashed or located.
+			bool stored = true;
+			bool kept = stack.empty() || stack.back().kept;
+			if (root == nullptr) {
+				root = value;
+			}
+			else if (stack.back().container->dataType == Type::Object) {
+				stored = stack.back().container->map->emplace(std::move(stack.back().key), value).second;
+				kept = kept && stored;
+			}
+			else {
+				stack.back().container->arr->push_back(value);
+			}
+
+			// Containers have their end filled in when they close
+			size_t location = 0;
+			if (options.locations != nullptr && kept) {
+				location = options.locations->size();
+				options.locations->record(value, start, in.offset());
+			}
+
+			if (value->dataType == Type::Object || value->dataType == Type::Array) {
+				stack.push_back({ value, "", location, value->dataType == Type::Array ? mixHash(0, (std::uint64_t)Type::Array) : 0, 0, valueRule, stored, kept });
+			}
+			else if (!stored) {
+				destroy(value);
+			}
+			else if (options.hashes != nullptr && kept && !stack.empty()) {
+				fold(stack.back(), hashScalar(value));
+			}
+
+			// Close finished containers until the next value is found
+			while (!stack.empty()) {
+				Frame &top = stack.back();
+
+				// Whitespace may appear before a member, a comma, or the end of a container
+				consumeWhitespace(in);
+
+				char c = in.peek();
+				if (in.eof()) {
+					throw json_parse_error(JSON_ERR(in) "Unexpected end of file while parsing " + (top.container->dataType == Type::Object ? "object" : "array"));
+				}
+
+				if (top.container->dataType == Type::Object) {
+					if (c == '}') {
+						//Ignore '}'
+						in.ignore();
+						close(in.offset());
+						continue;
+					}
+					if (c == ',') {
+						// Comma indicates another key/value is coming
+						in.ignore();
+						continue;
+					}
+
+					// Read name
+					top.key = readString(in);
+					if (options.hashes != nullptr) {
+						top.keyHash = std::hash<std::string>()(top.key);
+					}
+
+					// Whitespace may appear here
+					consumeWhitespace(in);
+
+					// Colon should split key/value
+					c = in.get();
+					if (c != ':') {
+						throw json_parse_error(JSON_ERR(in) "Unexpected token while parsing key/value pair: \"" + c + "\"");
+					}
+					break;
+				}
+				else {
+					if (c == ']') {
+						//Ignore ']'
+						in.ignore();
+						close(in.offset());
+						continue;
+					}
+					if (c == ',') {
+						// Comma indicates another value is coming
+						in.ignore();
+						continue;
+					}
+					break;
+				}
+			}
+
+			if (stack.empty()) {
+				// Remove trailing whitespace
+				consumeWhitespace(in);
+
+				return root;
+			}
+		}
+	}
+	catch (...) {
+		if (options.hashes != nullptr && root != nullptr) {
+			options.hashes->forget(root);
+		}
+		destroy(root);
+		for (Frame &frame : stack) {
+			if (!frame.stored) {
+				destroy(frame.container);
+			}
+		}
+		throw;
+	}
+}
 
-	// Error check
-	if (in.eof()) {
-		throw json_parse_error(JSON_ERR(line, col) "Unexpected end of file while parsing value");
+bool Json::splitArray(Cursor in, std::vector<Cursor> &elements) {
+	// Finds the top level commas of an array, skipping strings and comments and tracking bracket depth.
+	// Returns false if the input is not a complete array so the sequential parser can report the error.
+	if (in.get() != '[') {
+		return false;
+	}
+
+	const char *start = in.curr;
+	size_t depth = 0;
+	for (const char *curr = in.curr; curr < in.end; curr++) {
+		switch (*curr) {
+		case '"':
+			for (curr++; curr < in.end && *curr != '"'; curr++) {
+				if (*curr == '\\') {
+					curr++;
+				}
+			}
+			if (curr >= in.end) {
+				return false;
+			}
+			break;
+		case '/':
+			if (curr + 1 < in.end && curr[1] == '/') {
+				curr = (const char *)std::memchr(curr, '\n', in.end - curr);
+				if (curr == nullptr) {
+					return false;
+				}
+			}
+			break;
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			if (depth == 0) {
+				if (*curr != ']') {
+					return false;
+				}
+				elements.push_back({ in.begin, start, curr, in.resource });
+				return true;
+			}
+			depth--;
+			break;
+		case ',':
+			if (depth == 0) {
+				elements.push_back({ in.begin, start, curr, in.resource });
+				start = curr + 1;
+			}
+			break;
+		}
 	}
 
-	// Determine what type of value to parse
-	char first = in.peek();
-	Json *ret = nullptr;
-	if (first == '{') {
-		// Object
-		ret = parseObject(in, line, col);
+	return false;
+}
+Json *Json::parseParallel(Cursor &in, const ParseOptions &options) {
+	// '[' [Value] ',' ... ']' split into contiguous runs of elements, one per thread
+
+	consumeWhitespace(in);
+	size_t start = in.offset();
+
+	// A schema that rejects the root array is left to the sequential parser to report
+	if (options.schema != nullptr && (options.schema->rules[0].types & (1u << (unsigned)Type::Array)) == 0) {
+		return nullptr;
 	}
-	else if (first == '[') {
-		// Array
-		ret = parseArray(in, line, col);
+
+	std::vector<Cursor> elements;
+	if (options.maxDepth == 0 || !splitArray(in, elements)) {
+		return nullptr;
 	}
-	else if (first == '"') {
-		// String
-		ret = parseString(in, line, col);
+
+	// Elements sit one level below the root array
+	ParseOptions elementOptions = options;
+	elementOptions.maxDepth--;
+	size_t elementRule = options.schema != nullptr ? options.schema->item(0) : std::string::npos;
+
+	// Group elements so each thread gets a similar number of bytes
+	size_t threads = std::min(options.threads, elements.size());
+	size_t bytes = elements.back().end - elements.front().curr;
+	std::vector<size_t> bounds{ 0 };
+	for (size_t i = 0, taken = 0; i < elements.size() && bounds.size() < threads; i++) {
+		taken += elements[i].end - elements[i].curr;
+		if (taken >= bytes / threads * bounds.size()) {
+			bounds.push_back(i + 1);
+		}
 	}
-	else if (first == '-' || first == '+' || (first >= '0' && first <= '9')) {
-		// Number
-		ret = parseNumber(in, line, col);
+	if (bounds.back() != elements.size()) {
+		bounds.push_back(elements.size());
 	}
-	else {
-		// Keyword
-		ret = parseKeyword(in, line, col);
+
+	// Each run is parsed into its own array and source map, then stitched in order
+	struct Run {
+		Array values;
+		SourceMap locations;
+		Digests hashes;
+		Stats stats;
+		std::exception_ptr error;
+	};
+	std::vector<Run> runs(bounds.size() - 1);
+
+	auto parseRun = [&](size_t idx, size_t) {
+		Run &run = runs[idx];
+		ParseOptions runOptions = elementOptions;
+		runOptions.locations = options.locations != nullptr ? &run.locations : nullptr;
+		runOptions.hashes = options.hashes != nullptr ? &run.hashes : nullptr;
+		runOptions.stats = options.stats != nullptr ? &run.stats : nullptr;
+
+		// Without a resource to share, the run fills an arena that its nodes keep alive after the parse
+		Arena *arena = in.resource == nullptr ? new Arena(elements[bounds[idx + 1] - 1].end - elements[bounds[idx]].curr) : nullptr;
+
+		try {
+			for (size_t i = bounds[idx]; i < bounds[idx + 1]; i++) {
+				Cursor element = elements[i];
+				if (arena != nullptr) {
+					element.resource = arena;
+				}
+
+				// Values are read until the next top level comma, matching parseValue
+				for (consumeWhitespace(element); !element.eof(); consumeWhitespace(element)) {
+					run.values.push_back(parseValue(element, runOptions, elementRule));
+				}
+			}
+		}
+		catch (...) {
+			run.error = std::current_exception();
+		}
+
+		if (arena != nullptr) {
+			arena->release();
+		}
+	};
+	(options.pool != nullptr ? *options.pool : ThreadPool::shared()).run(runs.size(), parseRun);
+
+	Json *ret = create(in.resource);
+	ret->initArray();
+	JSON_STATS(options.stats->record(ret, 1));
+
+	if (options.locations != nullptr) {
+		options.locations->record(ret, start, elements.back().end + 1 - in.begin);
+	}
+
+	std::exception_ptr error = nullptr;
+	for (Run &run : runs) {
+		ret->arr->insert(ret->arr->end(), run.values.begin(), run.values.end());
+		if (error == nullptr) {
+			error = run.error;
+		}
+		JSON_STATS(options.stats->merge(run.stats, 1));
+
+		if (options.locations != nullptr) {
+			options.locations->nodes.insert(options.locations->nodes.end(), run.locations.nodes.begin(), run.locations.nodes.end());
+			options.locations->offsets.insert(options.locations->offsets.end(), run.locations.offsets.begin(), run.locations.offsets.end());
+			options.locations->ends.insert(options.locations->ends.end(), run.locations.ends.begin(), run.locations.ends.end());
+		}
+	}
+
+	if (error != nullptr) {
+		destroy(ret);
+		std::rethrow_exception(error);
 	}
-	
+
+	// Continue after the closing bracket
+	in.curr = elements.back().end + 1;
+
+	if (options.schema != nullptr) {
+		std::string problem = options.schema->checkClosed(0, ret);
+		if (!problem.empty()) {
+			destroy(ret);
+			throw json_schema_error(JSON_ERR(in) problem);
+		}
+	}
+
+	if (options.hashes != nullptr) {
+		for (Run &run : runs) {
+			options.hashes->hashes.merge(run.hashes.hashes);
+		}
+		options.hashes->hashes[ret] = hashContainer(ret, options.hashes->hashes);
+	}
+
 	// Remove trailing whitespace
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	return ret;
 }
 
 // Read JX
 Json *Json::fromStream(std::istream &in) {
-	size_t line = 1, col = 0;
-	return parseValue(in, line, col);
+	return fromStream(in, ParseOptions());
+}
+Json *Json::fromStream(std::istream &in, const ParseOptions &options) {
+	std::chrono::steady_clock::time_point started;
+	JSON_STATS(started = std::chrono::steady_clock::now());
+
+	std::ostringstream buffer;
+	buffer << in.rdbuf();
+	std::string str = buffer.str();
+
+	std::chrono::nanoseconds read{};
+	JSON_STATS(read = std::chrono::steady_clock::now() - started);
+
+	Json *ret = fromString(str, options);
+	JSON_STATS(options.stats->read = read);
+	return ret;
 }
 Json *Json::fromFile(std::filesystem::path file) {
+	return fromFile(file, ParseOptions());
+}
+Json *Json::fromFile(std::filesystem::path file, const ParseOptions &options) {
+	std::chrono::steady_clock::time_point started;
+	JSON_STATS(started = std::chrono::steady_clock::now());
+
 	std::ifstream in;
-	in.open(file);
+	in.open(file, std::ios::binary);
 
 	if (!in.is_open()) {
 		throw json_file_error("Json: Failed to open file: " + file.string());
 	}
 
-	return fromStream(in);
+	std::string str;
+	str.resize((size_t)std::filesystem::file_size(file));
+	in.read(str.data(), str.size());
+	str.resize((size_t)in.gcount());
+
+	std::chrono::nanoseconds read{};
+	JSON_STATS(read = std::chrono::steady_clock::now() - started);
+
+	Json *ret = fromString(str, options);
+	JSON_STATS(options.stats->read = read);
+	return ret;
 }
 Json *Json::fromString(std::string &str) {
-	std::istringstream in(str);
-	return fromStream(in);
+	return fromString(str, ParseOptions());
+}
+Json *Json::fromString(std::string &str, const ParseOptions &options) {
+	if (options.locations != nullptr) {
+		options.locations->clear();
+		options.locations->text = str;
+	}
+
+	std::chrono::steady_clock::time_point started;
+	JSON_STATS(options.stats->clear(); started = std::chrono::steady_clock::now());
+
+	Cursor in{ str.data(), str.data(), str.data() + str.size(), options.resource };
+
+	Json *ret = nullptr;
+	if (options.threads > 1) {
+		// Falls through to the sequential parser when the document is not a top level array
+		ret = parseParallel(in, options);
+		if (ret == nullptr) {
+			in.curr = in.begin;
+		}
+	}
+	if (ret == nullptr) {
+		ret = parseValue(in, options);
+	}
+
+	JSON_STATS(options.stats->bytes = in.offset(); options.stats->parse = std::chrono::steady_clock::now() - started);
+	return ret;
 }
 Json *Json::fromType(Type type) {
-	Json *json = new Json();
+	return fromType(type, nullptr);
+}
+Json *Json::fromType(Type type, std::pmr::memory_resource *resource) {
+	Json *json = create(resource);
+
+	switch (type) {
+	case Type::Object:
+		json->initMap();
+		break;
+	case Type::Array:
+		json->initArray();
+		break;
+	case Type::String:
+		json->initString();
+		break;
+	case Type::Integer:
+		json->initInt();
+		break;
+	case Type::Float:
+		json->initFloat();
+		break;
+	case Type::Bool:
+		json->initBool();
+		break;
+	}
+
+	return json;
+}
+
+// Read JX asynchronously
+Json::Loading::Loading() : Pending([](void *value) { destroy((Json *)value); }) {}
+
+Json *Json::Loading::get() {
+	return (Json *)take();
+}
+Json *Json::Loading::await_resume() {
+	return (Json *)take();
+}
+
+Json::Loading Json::fromFileAsync(std::filesystem::path file) {
+	return fromFileAsync(file, ParseOptions());
+}
+Json::Loading Json::fromFileAsync(std::filesystem::path file, const ParseOptions &options) {
+	return fromFileAsync(file, options, IoBackend::shared(), ThreadPool::shared());
+}
+Json::Loading Json::fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool) {
+	Loading ret;
+	fromFileAsync(file, options, io, pool, [done = ret.completer()](Json *json, std::exception_ptr error) {
+		done(json, error);
+	});
+	return ret;
+}
+void Json::fromFileAsync(std::filesystem::path file, const ParseOptions &options, LoadCallback done) {
+	fromFileAsync(file, options, IoBackend::shared(), ThreadPool::shared(), std::move(done));
+}
+void Json::fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool, LoadCallback done) {
+	auto parse = [options](std::string &contents, const std::string &error) -> void * {
+		if (!error.empty()) {
+			throw json_file_error("Json: " + error);
+		}
+		return fromString(contents, options);
+	};
+	Pending::load(file, io, pool, parse, [done = std::move(done)](void *value, std::exception_ptr error) {
+		done((Json *)value, error);
+	});
+}
+
+// Read many files
+std::vector<Json::Loaded> Json::fromFiles(const std::vector<std::filesystem::path> &files) {
+	return fromFiles(files, ParseOptions(), ThreadPool::shared());
+}
+std::vector<Json::Loaded> Json::fromFiles(const std::vector<std::filesystem::path> &files, const ParseOptions &options, ThreadPool &pool) {
+	ParseOptions fileOptions = options;
+	fileOptions.locations = nullptr;
+	fileOptions.hashes = nullptr;
+	fileOptions.threads = 1;
+	fileOptions.stats = nullptr;
+
+	std::vector<Loaded> ret(files.size());
+	Batch::load(files, pool, [&](size_t index, std::string &contents, const std::string &error) {
+		Loaded &result = ret[index];
+		result.file = files[index];
+
+		ParseOptions arenaOptions = fileOptions;
+		Arena *arena = new Arena(contents.size());
+		arenaOptions.resource = arena;
+
+		try {
+			if (!error.empty()) {
+				throw json_file_error("Json: " + error);
+			}
+			result.json = fromString(contents, arenaOptions);
+		}
+		catch (...) {
+			result.error = std::current_exception();
+		}
+
+		arena->release();
+	});
+
+	return ret;
+}
+std::vector<Json::Loaded> Json::fromDirectory(const std::filesystem::path &directory, std::string_view pattern) {
+	return fromFiles(Batch::find(directory, pattern));
+}
+
+void Json::destroy(Json *json) {
+	// Children are queued instead of visited recursively so deep trees cannot overflow the stack
+	std::vector<Json *> pending{ json };
+	while (!pending.empty()) {
+		Json *val = pending.back();
+		pending.pop_back();
+
+		if (val == nullptr) {
+			continue;
+		}
+
+		if (val->dataType == Type::Object) {
+			for (auto &pair : *val->map) {
+				pending.push_back(pair.second);
+			}
+		}
+		else if (val->dataType == Type::Array) {
+			pending.insert(pending.end(), val->arr->begin(), val->arr->end());
+		}
+
+		delete val;
+	}
+}
+
+Json::Location Json::locate(std::string_view source, size_t offset) {
+	auto [line, column] = Lines::locate(source, offset);
+	return { line, column };
+}
+
+// Source map
+size_t Json::SourceMap::offset(const Json *node) const {
+	if (sorted.size() != nodes.size()) {
+		sorted.resize(nodes.size());
+		std::iota(sorted.begin(), sorted.end(), 0);
+		std::sort(sorted.begin(), sorted.end(), [this](size_t a, size_t b) {
+			return std::less<const Json *>()(nodes[a], nodes[b]);
+		});
+	}
+
+	auto it = std::lower_bound(sorted.begin(), sorted.end(), node, [this](size_t idx, const Json *val) {
+		return std::less<const Json *>()(nodes[idx], val);
+	});
+	if (it == sorted.end() || nodes[*it] != node) {
+		return std::string::npos;
+	}
+
+	return offsets[*it];
+}
+Json::Location Json::SourceMap::locate(const Json *node) const {
+	size_t off = offset(node);
+	if (off == std::string::npos) {
+		return { 0, 0 };
+	}
+
+	return Json::locate(text, off);
+}
+
+const std::string &Json::SourceMap::source() const {
+	return text;
+}
+size_t Json::SourceMap::size() const {
+	return nodes.size();
+}
+void Json::SourceMap::clear() {
+	text.clear();
+	nodes.clear();
+	offsets.clear();
+	ends.clear();
+	sorted.clear();
+}
+
+void Json::SourceMap::record(const Json *node, size_t offset, size_t end) {
+	nodes.push_back(node);
+	offsets.push_back(offset);
+	ends.push_back(end);
+}
+
+// Content hashes
+std::uint64_t Json::Digests::hash(const Json *node) {
+	if (node->dataType != Type::Object && node->dataType != Type::Array) {
+		return hashScalar(node);
+	}
+
+	hashTree(node, hashes);
+	return hashes[node];
+}
+bool Json::Digests::same(const Json *a, const Json *b) {
+	return a == b || hash(a) == hash(b);
+}
+void Json::Digests::changed(const Json *root, const std::string &pointer) {
+	// Stops early at a key or index that does not exist yet, such as one about to be added
+	const Json *curr = root;
+	for (const std::string &token : splitPointer(pointer)) {
+		hashes.erase(curr);
+
+		const Json *next = nullptr;
+		if (curr->dataType == Type::Object) {
+			auto it = curr->map->find(token);
+			next = it != curr->map->end() ? it->second : nullptr;
+		}
+		else if (curr->dataType == Type::Array) {
+			bool index = !token.empty() && token.size() <= 19 && token.find_first_not_of("0123456789") == std::string::npos;
+			size_t idx = index ? (size_t)std::stoull(token) : curr->arr->size();
+			next = idx < curr->arr->size() ? (*curr->arr)[idx] : nullptr;
+		}
+
+		if (next == nullptr) {
+			return;
+		}
+		curr = next;
+	}
+	forget(curr);
+}
+
+size_t Json::Digests::size() const {
+	return hashes.size();
+}
+void Json::Digests::clear() {
+	hashes.clear();
+}
+
+void Json::Digests::forget(const Json *node) {
+	std::vector<const Json *> pending{ node };
+	while (!pending.empty()) {
+		const Json *val = pending.back();
+		pending.pop_back();
+
+		if (val->dataType == Type::Object) {
+			hashes.erase(val);
+			for (auto &pair : *val->map) {
+				pending.push_back(pair.second);
+			}
+		}
+		else if (val->dataType == Type::Array) {
+			hashes.erase(val);
+			pending.insert(pending.end(), val->arr->begin(), val->arr->end());
+		}
+	}
+}
+
+// Parse statistics
+size_t Json::Stats::total() const {
+	return std::accumulate(std::begin(nodes), std::end(nodes), (size_t)0);
+}
+void Json::Stats::clear() {
+	*this = Stats();
+}
+
+void Json::Stats::record(const Json *value, size_t depth) {
+	nodes[(size_t)value->dataType]++;
+	maxDepth = std::max(maxDepth, depth);
+
+	// The node, then what it points to
+	allocations++;
+	allocated += sizeof(Json);
+	switch (value->dataType) {
+	case Type::Object:
+		allocations++;
+		allocated += sizeof(Object);
+		break;
+	case Type::Array:
+		allocations++;
+		allocated += sizeof(Array);
+		break;
+	case Type::String:
+		allocations++;
+		allocated += sizeof(std::string);
+		break;
+	case Type::Integer:
+		allocations++;
+		allocated += sizeof(long long);
+		break;
+	case Type::Float:
+		allocations++;
+		allocated += sizeof(float);
+		break;
+	case Type::Bool:
+		allocations++;
+		allocated += sizeof(bool);
+		break;
+	default:
+		break;
+	}
+}
+void Json::Stats::merge(const Stats &other, size_t depth) {
+	for (size_t i = 0; i < std::size(nodes); i++) {
+		nodes[i] += other.nodes[i];
+	}
+	if (other.maxDepth > 0) {
+		maxDepth = std::max(maxDepth, other.maxDepth + depth);
+	}
+	allocations += other.allocations;
+	allocated += other.allocated;
+}
+
+// Schemas
+Json::Schema Json::Schema::fromJson(const Json *schema) {
+	Schema ret;
+	ret.rules.emplace_back();
+
+	// Schema objects waiting to be compiled, with the rule each one fills in
+	std::vector<std::pair<const Json *, size_t>> pending{ { schema, 0 } };
+	while (!pending.empty()) {
+		auto [val, idx] = pending.back();
+		pending.pop_back();
+
+		if (val->dataType != Type::Object) {
+			throw json_schema_error("Json: Schema must be an object");
+		}
+
+		auto count = [](const Json &limit, const char *name) {
+			if (limit.dataType != Type::Integer || *limit.i < 0) {
+				throw json_schema_error(std::string("Json: Schema \"") + name + "\" must be a non-negative integer");
+			}
+			return (size_t)*limit.i;
+		};
+		auto number = [](const Json &limit, const char *name) {
+			if (limit.dataType == Type::Integer) {
+				return (double)*limit.i;
+			}
+			if (limit.dataType == Type::Float) {
+				return (double)*limit.f;
+			}
+			throw json_schema_error(std::string("Json: Schema \"") + name + "\" must be a number");
+		};
+
+		for (auto &pair : *val->map) {
+			const std::string &keyword = pair.first;
+			const Json &arg = *pair.second;
+
+			if (keyword == "type") {
+				std::vector<const Json *> names;
+				if (arg.dataType == Type::Array) {
+					names.assign(arg.arr->begin(), arg.arr->end());
+				}
+				else {
+					names.push_back(&arg);
+				}
+
+				unsigned types = 0;
+				for (const Json *name : names) {
+					if (name->dataType != Type::String) {
+						throw json_schema_error("Json: Schema \"type\" must be a string or an array of strings");
+					}
+
+					const std::string &type = *name->str;
+					if (type == "object") {
+						types |= 1u << (unsigned)Type::Object;
+					}
+					else if (type == "array") {
+						types |= 1u << (unsigned)Type::Array;
+					}
+					else if (type == "string") {
+						types |= 1u << (unsigned)Type::String;
+					}
+					else if (type == "integer") {
+						types |= 1u << (unsigned)Type::Integer;
+					}
+					else if (type == "number") {
+						types |= 1u << (unsigned)Type::Integer | 1u << (unsigned)Type::Float;
+					}
+					else if (type == "boolean") {
+						types |= 1u << (unsigned)Type::Bool;
+					}
+					else if (type == "null") {
+						types |= 1u << (unsigned)Type::Null;
+					}
+					else {
+						throw json_schema_error("Json: Unrecognized schema type: " + type);
+					}
+				}
+				ret.rules[idx].types = types;
+			}
+			else if (keyword == "required") {
+				if (arg.dataType != Type::Array) {
+					throw json_schema_error("Json: Schema \"required\" must be an array of strings");
+				}
+				for (const Json *key : *arg.arr) {
+					if (key->dataType != Type::String) {
+						throw json_schema_error("Json: Schema \"required\" must be an array of strings");
+					}
+					ret.rules[idx].required.push_back(*key->str);
+				}
+			}
+			else if (keyword == "properties") {
+				if (arg.dataType != Type::Object) {
+					throw json_schema_error("Json: Schema \"properties\" must be an object");
+				}
+				for (auto &property : *arg.map) {
+					ret.rules[idx].properties[property.first] = ret.rules.size();
+					pending.push_back({ property.second, ret.rules.size() });
+					ret.rules.emplace_back();
+				}
+			}
+			else if (keyword == "items") {
+				ret.rules[idx].items = ret.rules.size();
+				pending.push_back({ &arg, ret.rules.size() });
+				ret.rules.emplace_back();
+			}
+			else if (keyword == "enum") {
+				if (arg.dataType != Type::Array) {
+					throw json_schema_error("Json: Schema \"enum\" must be an array");
+				}
+				for (const Json *choice : *arg.arr) {
+					ret.rules[idx].choices.push_back(copy(choice)->freeze());
+				}
+			}
+			else if (keyword == "minimum") {
+				ret.rules[idx].minimum = number(arg, "minimum");
+			}
+			else if (keyword == "maximum") {
+				ret.rules[idx].maximum = number(arg, "maximum");
+			}
+			else if (keyword == "minLength") {
+				ret.rules[idx].minLength = count(arg, "minLength");
+			}
+			else if (keyword == "maxLength") {
+				ret.rules[idx].maxLength = count(arg, "maxLength");
+			}
+			else if (keyword == "minItems") {
+				ret.rules[idx].minItems = count(arg, "minItems");
+			}
+			else if (keyword == "maxItems") {
+				ret.rules[idx].maxItems = count(arg, "maxItems");
+			}
+		}
+	}
+
+	return ret;
+}
+
+void Json::Schema::validate(const Json *json) const {
+	std::vector<std::pair<const Json *, size_t>> pending{ { json, 0 } };
+	while (!pending.empty()) {
+		auto [val, rule] = pending.back();
+		pending.pop_back();
+
+		std::string problem = checkOpen(rule, val);
+		if (problem.empty() && (val->dataType == Type::Object || val->dataType == Type::Array)) {
+			problem = checkClosed(rule, val);
+		}
+		if (!problem.empty()) {
+			throw json_schema_error("Json: " + problem);
+		}
+
+		if (val->dataType == Type::Object) {
+			for (auto &pair : *val->map) {
+				size_t child = member(rule, pair.first);
+				if (child != std::string::npos) {
+					pending.push_back({ pair.second, child });
+				}
+			}
+		}
+		else if (val->dataType == Type::Array && rules[rule].items != std::string::npos) {
+			for (const Json *child : *val->arr) {
+				pending.push_back({ child, rules[rule].items });
+			}
+		}
+	}
+}
+
+size_t Json::Schema::member(size_t rule, const std::string &key) const {
+	auto it = rules[rule].properties.find(key);
+	return it != rules[rule].properties.end() ? it->second : std::string::npos;
+}
+size_t Json::Schema::item(size_t rule) const {
+	return rules[rule].items;
+}
+
+std::string Json::Schema::checkOpen(size_t idx, const Json *value) const {
+	const Rule &rule = rules[idx];
+
+	if ((rule.types & (1u << (unsigned)value->dataType)) == 0) {
+		// Indexed by Type
+		static const char *names[] = { "object", "array", "string", "integer", "number", "boolean", "null" };
+
+		std::string expected;
+		for (unsigned type = 0; type <= (unsigned)Type::Null; type++) {
+			if ((rule.types & (1u << type)) != 0 && !(type == (unsigned)Type::Integer && (rule.types & (1u << (unsigned)Type::Float)) != 0)) {
+				expected += (expected.empty() ? "" : " or ") + std::string(names[type]);
+			}
+		}
+		return "Expected " + expected + " but found " + names[(unsigned)value->dataType];
+	}
+
+	switch (value->dataType) {
+	case Type::String: {
+		// Length counts code points, so UTF-8 continuation bytes are skipped
+		size_t length = 0;
+		for (char c : *value->str) {
+			length += ((unsigned char)c & 0xC0) != 0x80;
+		}
+		if (length < rule.minLength) {
+			return "String is shorter than " + std::to_string(rule.minLength) + " characters";
+		}
+		if (length > rule.maxLength) {
+			return "String is longer than " + std::to_string(rule.maxLength) + " characters";
+		}
+		break;
+	}
+	case Type::Integer:
+	case Type::Float: {
+		double number = value->dataType == Type::Integer ? (double)*value->i : (double)*value->f;
+		if (number < rule.minimum || number > rule.maximum) {
+			std::ostringstream message;
+			message << "Number is " << (number < rule.minimum ? "below the minimum of " : "above the maximum of ") << (number < rule.minimum ? rule.minimum : rule.maximum);
+			return message.str();
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	// Objects and arrays are compared to enum once their contents are known
+	if (value->dataType != Type::Object && value->dataType != Type::Array) {
+		return checkClosed(idx, value);
+	}
+	return "";
+}
+std::string Json::Schema::checkClosed(size_t idx, const Json *value) const {
+	const Rule &rule = rules[idx];
+
+	if (value->dataType == Type::Object) {
+		for (const std::string &key : rule.required) {
+			if (value->map->count(key) == 0) {
+				return "Missing required key \"" + key + "\"";
+			}
+		}
+	}
+	else if (value->dataType == Type::Array) {
+		if (value->arr->size() < rule.minItems) {
+			return "Array has fewer than " + std::to_string(rule.minItems) + " items";
+		}
+		if (value->arr->size() > rule.maxItems) {
+			return "Array has more than " + std::to_string(rule.maxItems) + " items";
+		}
+	}
+
+	if (!rule.choices.empty() && std::none_of(rule.choices.begin(), rule.choices.end(), [&](auto &choice) { return equals(choice.get(), value); })) {
+		return "Value is not one of the allowed values";
+	}
+	return "";
+}
+
+// Incremental parsing
+Json *Json::reparse(Json *root, SourceMap &locations, const Edit &edit) {
+	return reparse(root, locations, edit, ParseOptions());
+}
+Json *Json::reparse(Json *root, SourceMap &locations, const Edit &edit, const ParseOptions &options) {
+	std::string &text = locations.text;
+	if (edit.offset > text.size() || edit.removed > text.size() - edit.offset) {
+		throw json_parse_error("Json: Edit is outside of the document: " + std::to_string(edit.offset));
+	}
+
+	// Offsets after the edit move by delta. Unsigned wraparound handles edits that shrink the text.
+	size_t editEnd = edit.offset + edit.removed;
+	size_t delta = edit.inserted.size() - edit.removed;
+
+	// Find the smallest object or array whose brackets enclose the edit. Nodes are recorded in document order,
+	// so its ancestors and earlier siblings all start before the edit.
+	size_t container = std::string::npos;
+	size_t idx = std::lower_bound(locations.offsets.begin(), locations.offsets.end(), edit.offset) - locations.offsets.begin();
+	while (idx-- > 0) {
+		const Json *node = locations.nodes[idx];
+		if ((node->dataType == Type::Object || node->dataType == Type::Array) && locations.offsets[idx] < edit.offset && editEnd < locations.ends[idx]) {
+			container = idx;
+			break;
+		}
+	}
+
+	if (container != std::string::npos) {
+		size_t start = locations.offsets[container];
+		size_t oldEnd = locations.ends[container];
+		size_t end = oldEnd + delta;
+
+		std::string removedText = text.substr(edit.offset, edit.removed);
+		text.replace(edit.offset, edit.removed, edit.inserted);
+
+		// Parse only the container's new text, into the memory the container came from since its contents are moved
+		// over below
+		Json *target = const_cast<Json *>(locations.nodes[container]);
+		SourceMap fresh;
+		ParseOptions subOptions = options;
+		subOptions.locations = &fresh;
+		subOptions.resource = target->resource;
+
+		// The schema rule for the container is found by following the enclosing containers down from the root
+		size_t rule = 0;
+		if (options.schema != nullptr) {
+			const Json *parent = nullptr;
+			for (size_t i = 0; i <= container && rule != std::string::npos; i++) {
+				const Json *node = locations.nodes[i];
+				if (i < container && (locations.offsets[i] >= start || locations.ends[i] < oldEnd)) {
+					continue;
+				}
+
+				if (parent != nullptr && parent->dataType == Type::Object) {
+					auto it = std::find_if(parent->map->begin(), parent->map->end(), [&](auto &pair) { return pair.second == node; });
+					rule = options.schema->member(rule, it->first);
+				}
+				else if (parent != nullptr) {
+					rule = options.schema->item(rule);
+				}
+				parent = node;
+			}
+		}
+
+		Cursor in{ text.data(), text.data() + start, text.data() + end, subOptions.resource };
+		Json *value = nullptr;
+		try {
+			value = parseValue(in, subOptions, rule);
+		}
+		catch (std::runtime_error &) {
+			// Parse and schema errors fall back to the full parse below, which reports them
+			value = nullptr;
+		}
+
+		// The edit stayed inside the container if the new text is still exactly one value of the same kind
+		if (value != nullptr && in.curr == in.end && value->dataType == target->dataType) {
+			// Move the new contents into the existing node so its parent keeps pointing at it
+			if (target->dataType == Type::Object) {
+				for (auto &pair : *target->map) {
+					if (options.hashes != nullptr) {
+						options.hashes->forget(pair.second);
+					}
+					destroy(pair.second);
+				}
+			}
+			else {
+				for (Json *child : *target->arr) {
+					if (options.hashes != nullptr) {
+						options.hashes->forget(child);
+					}
+					destroy(child);
+				}
+			}
+			target->delData();
+			target->ptr = value->ptr;
+			target->dataType = value->dataType;
+			value->ptr = nullptr;
+			value->dataType = Type::Null;
+
+			// The new hash moves to the existing node. Enclosing containers are hashed again when next asked for.
+			if (options.hashes != nullptr) {
+				auto &hashes = options.hashes->hashes;
+				hashes[target] = hashes[value];
+				hashes.erase(value);
+			}
+			delete value;
+
+			// Swap the old descendants' entries for the new ones and shift everything after the container
+			size_t first = container + 1;
+			size_t last = first;
+			while (last < locations.nodes.size() && locations.offsets[last] < oldEnd) {
+				last++;
+			}
+
+			for (size_t i = 0; i < container; i++) {
+				if (locations.ends[i] >= oldEnd) {
+					locations.ends[i] += delta;
+					if (options.hashes != nullptr) {
+						options.hashes->hashes.erase(locations.nodes[i]);
+					}
+				}
+			}
+			for (size_t i = last; i < locations.nodes.size(); i++) {
+				locations.offsets[i] += delta;
+				locations.ends[i] += delta;
+			}
+
+			locations.nodes.erase(locations.nodes.begin() + first, locations.nodes.begin() + last);
+			locations.offsets.erase(locations.offsets.begin() + first, locations.offsets.begin() + last);
+			locations.ends.erase(locations.ends.begin() + first, locations.ends.begin() + last);
+
+			locations.nodes.insert(locations.nodes.begin() + first, fresh.nodes.begin() + 1, fresh.nodes.end());
+			locations.offsets.insert(locations.offsets.begin() + first, fresh.offsets.begin() + 1, fresh.offsets.end());
+			locations.ends.insert(locations.ends.begin() + first, fresh.ends.begin() + 1, fresh.ends.end());
+
+			locations.ends[container] = end;
+			locations.sorted.clear();
+
+			return root;
+		}
+
+		if (options.hashes != nullptr && value != nullptr) {
+			options.hashes->forget(value);
+		}
+		destroy(value);
+		text.replace(edit.offset, edit.inserted.size(), removedText);
+	}
+
+	// The edit changed structure outside of any container, so parse everything again
+	std::string updated = text;
+	updated.replace(edit.offset, edit.removed, edit.inserted);
+
+	SourceMap full;
+	ParseOptions fullOptions = options;
+	fullOptions.locations = &full;
+
+	Json *ret = fromString(updated, fullOptions);
+
+	if (options.hashes != nullptr) {
+		options.hashes->forget(root);
+	}
+	destroy(root);
+	locations = std::move(full);
+
+	return ret;
+}
+
+// Comparison
+std::uint64_t Json::mixHash(std::uint64_t seed, std::uint64_t value) {
+	return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+std::uint64_t Json::hashScalar(const Json *val) {
+	std::uint64_t hash = mixHash(0, (std::uint64_t)val->dataType);
+	switch (val->dataType) {
+	case Type::String:
+		return mixHash(hash, std::hash<std::string>()(*val->str));
+	case Type::Integer:
+		return mixHash(hash, (std::uint64_t)*val->i);
+	case Type::Float: {
+		// -0 and 0 compare equal, so they hash the same
+		float f = *val->f == 0.0f ? 0.0f : *val->f;
+		std::uint32_t bits = 0;
+		std::memcpy(&bits, &f, sizeof(bits));
+		return mixHash(hash, bits);
+	}
+	case Type::Bool:
+		return mixHash(hash, *val->b ? 1 : 0);
+	default:
+		return hash;
+	}
+}
+std::uint64_t Json::hashContainer(const Json *val, const std::unordered_map<const Json *, std::uint64_t> &hashes) {
+	// Every child container must already be in hashes
+	auto digest = [&](const Json *child) {
+		return child->dataType == Type::Object || child->dataType == Type::Array ? hashes.find(child)->second : hashScalar(child);
+	};
+
+	if (val->dataType == Type::Object) {
+		// Member order does not matter, so members are summed
+		std::uint64_t members = 0;
+		for (auto &pair : *val->map) {
+			members += mixHash(std::hash<std::string>()(pair.first), digest(pair.second));
+		}
+		return mixHash(mixHash(mixHash(0, (std::uint64_t)Type::Object), val->map->size()), members);
+	}
+
+	std::uint64_t hash = mixHash(0, (std::uint64_t)Type::Array);
+	for (Json *child : *val->arr) {
+		hash = mixHash(hash, digest(child));
+	}
+	return mixHash(hash, val->arr->size());
+}
+void Json::hashTree(const Json *root, std::unordered_map<const Json *, std::uint64_t> &hashes) {
+	// Only containers are memoized; scalars are cheap enough to hash again when needed.
+	// Children are hashed before their parents. Subtrees hashed earlier are not visited again.
+	if (root->dataType != Type::Object && root->dataType != Type::Array) {
+		return;
+	}
+
+	std::vector<std::pair<const Json *, bool>> pending{ { root, false } };
+	while (!pending.empty()) {
+		auto [val, ready] = pending.back();
+		pending.pop_back();
+
+		if (ready) {
+			hashes[val] = hashContainer(val, hashes);
+			continue;
+		}
+		if (hashes.count(val) != 0) {
+			continue;
+		}
+
+		pending.push_back({ val, true });
+		if (val->dataType == Type::Object) {
+			for (auto &pair : *val->map) {
+				if (pair.second->dataType == Type::Object || pair.second->dataType == Type::Array) {
+					pending.push_back({ pair.second, false });
+				}
+			}
+		}
+		else {
+			for (Json *child : *val->arr) {
+				if (child->dataType == Type::Object || child->dataType == Type::Array) {
+					pending.push_back({ child, false });
+				}
+			}
+		}
+	}
+}
+bool Json::sameChildren(const Json *a, const Json *b) {
+	// Shallow comparison: scalars by value and containers by the addresses of their children
+	if (a->dataType != b->dataType || a->size() != b->size()) {
+		return false;
+	}
+
+	if (a->dataType == Type::Object) {
+		for (auto &pair : *a->map) {
+			auto it = b->map->find(pair.first);
+			if (it == b->map->end() || it->second != pair.second) {
+				return false;
+			}
+		}
+		return true;
+	}
+	if (a->dataType == Type::Array) {
+		return *a->arr == *b->arr;
+	}
+	return equals(a, b);
+}
+
+std::uint64_t Json::hash(const Json *json) {
+	Digests hashes;
+	return hashes.hash(json);
+}
+bool Json::equals(const Json *a, const Json *b) {
+	std::vector<std::pair<const Json *, const Json *>> pending{ { a, b } };
+	while (!pending.empty()) {
+		auto [lhs, rhs] = pending.back();
+		pending.pop_back();
+
+		if (lhs == rhs) {
+			continue;
+		}
+		if (lhs->dataType != rhs->dataType || lhs->size() != rhs->size()) {
+			return false;
+		}
+
+		switch (lhs->dataType) {
+		case Type::Object:
+			for (auto &pair : *lhs->map) {
+				auto it = rhs->map->find(pair.first);
+				if (it == rhs->map->end()) {
+					return false;
+				}
+				pending.push_back({ pair.second, it->second });
+			}
+			break;
+		case Type::Array:
+			for (size_t idx = 0; idx < lhs->arr->size(); idx++) {
+				pending.push_back({ (*lhs->arr)[idx], (*rhs->arr)[idx] });
+			}
+			break;
+		case Type::String:
+			if (*lhs->str != *rhs->str) {
+				return false;
+			}
+			break;
+		case Type::Integer:
+			if (*lhs->i != *rhs->i) {
+				return false;
+			}
+			break;
+		case Type::Float:
+			if (*lhs->f != *rhs->f) {
+				return false;
+			}
+			break;
+		case Type::Bool:
+			if (*lhs->b != *rhs->b) {
+				return false;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	return true;
+}
+Json *Json::copy(const Json *json) {
+	// Copies scalars and creates empty containers that are filled below
+	auto shallow = [](const Json *val) {
+		Json *ret = fromType(val->dataType);
+		switch (val->dataType) {
+		case Type::String:
+			*ret->str = *val->str;
+			break;
+		case Type::Integer:
+			*ret->i = *val->i;
+			break;
+		case Type::Float:
+			*ret->f = *val->f;
+			break;
+		case Type::Bool:
+			*ret->b = *val->b;
+			break;
+		default:
+			break;
+		}
+		return ret;
+	};
+
+	Json *root = shallow(json);
+	std::vector<std::pair<const Json *, Json *>> pending{ { json, root } };
+	while (!pending.empty()) {
+		auto [src, dst] = pending.back();
+		pending.pop_back();
+
+		if (src->dataType == Type::Object) {
+			dst->map->reserve(src->map->size());
+			for (auto &pair : *src->map) {
+				Json *child = shallow(pair.second);
+				dst->map->emplace(pair.first, child);
+				pending.push_back({ pair.second, child });
+			}
+		}
+		else if (src->dataType == Type::Array) {
+			dst->arr->reserve(src->arr->size());
+			for (Json *val : *src->arr) {
+				Json *child = shallow(val);
+				dst->arr->push_back(child);
+				pending.push_back({ val, child });
+			}
+		}
+	}
+
+	return root;
+}
+
+// Diff and patch
+std::string Json::escapePointer(const std::string &key) {
+	std::string ret;
+	ret.reserve(key.size());
+	for (char c : key) {
+		if (c == '~') {
+			ret += "~0";
+		}
+		else if (c == '/') {
+			ret += "~1";
+		}
+		else {
+			ret += c;
+		}
+	}
+	return ret;
+}
+std::vector<std::string> Json::splitPointer(const std::string &path) {
+	// '' | ('/' token)*
+	if (!path.empty() && path[0] != '/') {
+		throw json_patch_error("Json: Pointer must start with '/': " + path);
+	}
+
+	std::vector<std::string> tokens;
+	for (size_t idx = 0; idx < path.size(); idx++) {
+		if (path[idx] == '/') {
+			tokens.emplace_back();
+		}
+		else if (path[idx] == '~' && idx + 1 < path.size() && (path[idx + 1] == '0' || path[idx + 1] == '1')) {
+			tokens.back() += path[++idx] == '0' ? '~' : '/';
+		}
+		else {
+			tokens.back() += path[idx];
+		}
+	}
+	return tokens;
+}
+size_t Json::pointerIndex(const std::string &token, size_t size) {
+	if (token.empty() || token.size() > 19 || token.find_first_not_of("0123456789") != std::string::npos || (token.size() > 1 && token[0] == '0')) {
+		throw json_patch_error("Json: Invalid array index: " + token);
+	}
+
+	size_t idx = (size_t)std::stoull(token);
+	if (idx > size) {
+		throw json_patch_error("Json: Array index out of range: " + token);
+	}
+	return idx;
+}
+Json *Json::resolvePointer(Json *root, const std::vector<std::string> &tokens, size_t count) {
+	Json *curr = root;
+	for (size_t idx = 0; idx < count; idx++) {
+		const std::string &token = tokens[idx];
+		if (curr->dataType == Type::Object) {
+			auto it = curr->map->find(token);
+			if (it == curr->map->end()) {
+				throw json_patch_error("Json: Key does not exist: " + token);
+			}
+			curr = it->second;
+		}
+		else if (curr->dataType == Type::Array) {
+			size_t pos = pointerIndex(token, curr->arr->size());
+			if (pos == curr->arr->size()) {
+				throw json_patch_error("Json: Array index out of range: " + token);
+			}
+			curr = (*curr->arr)[pos];
+		}
+		else {
+			throw json_patch_error("Json: Cannot index into a value that is not an object or array: " + token);
+		}
+	}
+	return curr;
+}
+
+void Json::addPatchOp(Json *ops, const char *op, const std::string &path, const Json *value) {
+	Json *entry = fromType(Type::Object);
+	Json *name = fromType(Type::String);
+	*name->str = op;
+	Json *pointer = fromType(Type::String);
+	*pointer->str = path;
+
+	entry->map->emplace("op", name);
+	entry->map->emplace("path", pointer);
+	if (value != nullptr) {
+		entry->map->emplace("value", copy(value));
+	}
+
+	ops->arr->push_back(entry);
+}
+Json *Json::diff(const Json *from, const Json *to) {
+	Digests hashes;
+	return diff(from, to, hashes);
+}
+Json *Json::diff(const Json *from, const Json *to, Digests &digests) {
+	// Containers with equal hashes are treated as equal and skipped without being walked.
+	// Arrays are compared index by index; extra elements are removed from the back or appended.
+	auto &hashes = digests.hashes;
+	hashTree(from, hashes);
+	hashTree(to, hashes);
+
+	Json *ops = fromType(Type::Array);
+
+	struct Item {
+		const Json *from;
+		const Json *to;
+		std::string path;
+	};
+	std::vector<Item> pending{ { from, to, "" } };
+	while (!pending.empty()) {
+		Item item = std::move(pending.back());
+		pending.pop_back();
+
+		bool scalar = item.from->dataType != Type::Object && item.from->dataType != Type::Array;
+		if (item.from->dataType != item.to->dataType || (scalar && !equals(item.from, item.to))) {
+			addPatchOp(ops, "replace", item.path, item.to);
+		}
+		else if (scalar || hashes[item.from] == hashes[item.to]) {
+			continue;
+		}
+		else if (item.from->dataType == Type::Object) {
+			for (auto &pair : *item.from->map) {
+				std::string path = item.path + "/" + escapePointer(pair.first);
+				auto it = item.to->map->find(pair.first);
+				if (it == item.to->map->end()) {
+					addPatchOp(ops, "remove", path, nullptr);
+				}
+				else {
+					pending.push_back({ pair.second, it->second, std::move(path) });
+				}
+			}
+			for (auto &pair : *item.to->map) {
+				if (item.from->map->count(pair.first) == 0) {
+					addPatchOp(ops, "add", item.path + "/" + escapePointer(pair.first), pair.second);
+				}
+			}
+		}
+		else {
+			Array &lhs = *item.from->arr;
+			Array &rhs = *item.to->arr;
+			size_t common = std::min(lhs.size(), rhs.size());
+
+			for (size_t idx = lhs.size(); idx-- > common;) {
+				addPatchOp(ops, "remove", item.path + "/" + std::to_string(idx), nullptr);
+			}
+			for (size_t idx = common; idx < rhs.size(); idx++) {
+				addPatchOp(ops, "add", item.path + "/" + std::to_string(idx), rhs[idx]);
+			}
+			for (size_t idx = common; idx-- > 0;) {
+				pending.push_back({ lhs[idx], rhs[idx], item.path + "/" + std::to_string(idx) });
+			}
+		}
+	}
+
+	return ops;
+}
+
+Json *Json::patchAdd(Json *root, const std::string &path, Json *value, PatchLog &log) {
+	std::vector<std::string> tokens = splitPointer(path);
+	if (tokens.empty()) {
+		log.steps.push_back({ nullptr, "", 0, root });
+		log.removed.push_back(root);
+		return value;
+	}
+
+	Json *parent = resolvePointer(root, tokens, tokens.size() - 1);
+	const std::string &token = tokens.back();
+	if (parent->dataType == Type::Object) {
+		// A value already under the key is taken out, and only freed once the whole patch has applied
+		auto it = parent->map->find(token);
+		if (it != parent->map->end()) {
+			log.steps.push_back({ parent, token, 0, it->second });
+			log.removed.push_back(it->second);
+			parent->map->erase(it);
+		}
+		parent->map->emplace(token, value);
+		log.steps.push_back({ parent, token, 0, nullptr });
+	}
+	else if (parent->dataType == Type::Array) {
+		size_t idx = token == "-" ? parent->arr->size() : pointerIndex(token, parent->arr->size());
+		parent->arr->insert(parent->arr->begin() + idx, value);
+		log.steps.push_back({ parent, "", idx, nullptr });
+	}
+	else {
+		throw json_patch_error("Json: Cannot add to a value that is not an object or array: " + path);
+	}
+
+	return root;
+}
+Json *Json::patchDetach(Json *&root, const std::string &path, PatchLog &log) {
+	std::vector<std::string> tokens = splitPointer(path);
+	if (tokens.empty()) {
+		Json *ret = root;
+		root = new Json();
+		log.created.push_back(root);
+		log.steps.push_back({ nullptr, "", 0, ret });
+		return ret;
+	}
+
+	Json *parent = resolvePointer(root, tokens, tokens.size() - 1);
+	const std::string &token = tokens.back();
+	if (parent->dataType == Type::Object) {
+		auto it = parent->map->find(token);
+		if (it == parent->map->end()) {
+			throw json_patch_error("Json: Key does not exist: " + token);
+		}
+		Json *ret = it->second;
+		parent->map->erase(it);
+		log.steps.push_back({ parent, token, 0, ret });
+		return ret;
+	}
+	else if (parent->dataType == Type::Array) {
+		size_t idx = pointerIndex(token, parent->arr->size());
+		if (idx == parent->arr->size()) {
+			throw json_patch_error("Json: Array index out of range: " + token);
+		}
+		Json *ret = (*parent->arr)[idx];
+		parent->arr->erase(parent->arr->begin() + idx);
+		log.steps.push_back({ parent, "", idx, ret });
+		return ret;
+	}
+
+	throw json_patch_error("Json: Cannot remove from a value that is not an object or array: " + path);
+}
+void Json::patchUndo(Json *&root, PatchLog &log) {
+	for (auto step = log.steps.rbegin(); step != log.steps.rend(); step++) {
+		if (step->parent == nullptr) {
+			root = step->value;
+		}
+		else if (step->parent->dataType == Type::Object) {
+			if (step->value != nullptr) {
+				step->parent->map->emplace(step->key, step->value);
+			}
+			else {
+				step->parent->map->erase(step->key);
+			}
+		}
+		else {
+			if (step->value != nullptr) {
+				step->parent->arr->insert(step->parent->arr->begin() + step->index, step->value);
+			}
+			else {
+				step->parent->arr->erase(step->parent->arr->begin() + step->index);
+			}
+		}
+	}
+
+	// Undoing took every copy back out of the tree
+	for (Json *value : log.created) {
+		destroy(value);
+	}
+}
+Json *Json::patch(Json *root, const Json *ops) {
+	return applyPatch(root, ops, nullptr);
+}
+Json *Json::patch(Json *root, const Json *ops, Digests &hashes) {
+	return applyPatch(root, ops, &hashes);
+}
+Json *Json::applyPatch(Json *root, const Json *ops, Digests *hashes) {
+	if (ops->dataType != Type::Array) {
+		throw json_patch_error("Json: Patch must be an array of operations");
+	}
+
+	auto member = [](const Json *op, const std::string &key) -> const Json & {
+		auto it = op->find(key);
+		if (it == op->map->end()) {
+			throw json_patch_error("Json: Patch operation is missing \"" + key + "\"");
+		}
+		return *it->second;
+	};
 
-	switch (type) {
-	case Type::Object:
-		json->initMap();
-		break;
-	case Type::Array:
-		json->initArray();
-		break;
-	case Type::String:
-		json->initString();
-		break;
-	case Type::Integer:
-		json->initInt();
-		break;
-	case Type::Float:
-		json->initFloat();
-		break;
-	case Type::Bool:
-		json->initBool();
-		break;
+	PatchLog log;
+	try {
+		for (const Json *op : *ops->arr) {
+			const std::string &name = member(op, "op").asString();
+			const std::string &path = member(op, "path").asString();
+
+			// Hashes are dropped before the tree changes, while the values they cover can still be found. Dropping
+			// more than a failed patch changed is harmless.
+			if (hashes != nullptr && name != "test") {
+				hashes->changed(root, path);
+				if (name == "move") {
+					hashes->changed(root, member(op, "from").asString());
+				}
+			}
+
+			if (name == "add") {
+				log.created.push_back(copy(&member(op, "value")));
+				root = patchAdd(root, path, log.created.back(), log);
+			}
+			else if (name == "remove") {
+				log.removed.push_back(patchDetach(root, path, log));
+			}
+			else if (name == "replace") {
+				log.removed.push_back(patchDetach(root, path, log));
+				log.created.push_back(copy(&member(op, "value")));
+				root = patchAdd(root, path, log.created.back(), log);
+			}
+			else if (name == "move") {
+				const std::string &from = member(op, "from").asString();
+				if (path.compare(0, from.size() + 1, from + "/") == 0) {
+					throw json_patch_error("Json: Cannot move a value into itself: " + from);
+				}
+				root = patchAdd(root, path, patchDetach(root, from, log), log);
+			}
+			else if (name == "copy") {
+				std::vector<std::string> tokens = splitPointer(member(op, "from").asString());
+				log.created.push_back(copy(resolvePointer(root, tokens, tokens.size())));
+				root = patchAdd(root, path, log.created.back(), log);
+			}
+			else if (name == "test") {
+				std::vector<std::string> tokens = splitPointer(path);
+				if (!equals(resolvePointer(root, tokens, tokens.size()), &member(op, "value"))) {
+					throw json_patch_error("Json: Test failed: " + path);
+				}
+			}
+			else {
+				throw json_patch_error("Json: Unrecognized patch operation: " + name);
+			}
+		}
+	}
+	catch (...) {
+		patchUndo(root, log);
+		throw;
 	}
 
-	return json;
+	for (Json *value : log.removed) {
+		destroy(value);
+	}
+	return root;
 }
 
 // Write JX
@@ -533,14 +2659,71 @@ void Json::writeTab(std::ostream &out, size_t indent) {
 		out << "\t";
 	}
 }
+const char *Json::findEscape(const char *curr, const char *end) {
+#ifdef _XELA_JSON_SSE2
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1F);
+	while (end - curr >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)curr);
+		// Control characters are the bytes an unsigned min with 0x1F leaves unchanged
+		__m128i found = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+		unsigned mask = (unsigned)_mm_movemask_epi8(found);
+		if (mask != 0) {
+			return curr + std::countr_zero(mask);
+		}
+		curr += 16;
+	}
+#endif
+	while (curr < end && (unsigned char)*curr >= 0x20 && *curr != '"' && *curr != '\\') {
+		curr++;
+	}
+	return curr;
+}
+const char *Json::escapeCharacter(unsigned char c, char *spare) {
+	switch (c) {
+	case '"':
+		return "\\\"";
+	case '\\':
+		return "\\\\";
+	case '\b':
+		return "\\b";
+	case '\f':
+		return "\\f";
+	case '\n':
+		return "\\n";
+	case '\r':
+		return "\\r";
+	case '\t':
+		return "\\t";
+	default:
+		std::snprintf(spare, 7, "\\u%04x", c);
+		return spare;
+	}
+}
+void Json::writeEscaped(std::ostream &out, std::string_view str) {
+	// Runs that need no escape are written at once
+	char spare[7];
+	const char *curr = str.data();
+	const char *end = curr + str.size();
+	while (true) {
+		const char *stop = findEscape(curr, end);
+		out.write(curr, stop - curr);
+		if (stop == end) {
+			return;
+		}
+		out << escapeCharacter((unsigned char)*stop, spare);
+		curr = stop + 1;
+	}
+}
 
 void Json::writeObject(Json *val, std::ostream &out, size_t indent, bool pretty) {
 	writeTab(out, indent);
 	out << "{";
 
-	Object map = val->asObject();
 	bool first = true;
-	for (auto &pair : map) {
+	for (const auto &pair : *val->map) {
 		if (!first) {
 			out << ",";
 		}
@@ -551,11 +2734,15 @@ void Json::writeObject(Json *val, std::ostream &out, size_t indent, bool pretty)
 		if (pretty) {
 			out << "\n";
 			writeTab(out, indent);
-			out << "\"" << pair.first << "\" : ";
+			out << "\"";
+			writeEscaped(out, pair.first);
+			out << "\" : ";
 			writeValue(pair.second, out, indent + 1, pretty);
 		}
 		else {
-			out << "\"" << pair.first << "\":";
+			out << "\"";
+			writeEscaped(out, pair.first);
+			out << "\":";
 			writeValue(pair.second, out, 0, pretty);
 		}
 	}
@@ -601,7 +2788,9 @@ void Json::writeArray(Json *val, std::ostream &out, size_t indent, bool pretty)
 }
 void Json::writeString(Json *val, std::ostream &out, size_t indent, bool pretty) {
 	writeTab(out, indent);
-	out << "\"" << val->asString() << "\"";
+	out << "\"";
+	writeEscaped(out, val->asString());
+	out << "\"";
 }
 void Json::writeInteger(Json *val, std::ostream &out, size_t indent, bool pretty) {
 	writeTab(out, indent);
@@ -654,13 +2843,308 @@ void Json::write(bool pretty, std::ostream &out) {
 	writeValue(this, out, 0, pretty);
 }
 
+// Streaming writes
+Json::Writer::Writer(bool pretty) : pretty(pretty), chunkSize(std::string::npos) {}
+Json::Writer::Writer(std::ostream &out, bool pretty, size_t chunkSize) : Writer([&out](const char *data, size_t size) { out.write(data, size); }, pretty, chunkSize) {}
+Json::Writer::Writer(Sink sink, bool pretty, size_t chunkSize) : sink(std::move(sink)), pretty(pretty), chunkSize(chunkSize) {
+	buffer.reserve(chunkSize);
+}
+Json::Writer::~Writer() {
+	try {
+		flush();
+	}
+	catch (...) {
+		// A destructor cannot report the sink failing; flush() first to see it
+	}
+}
+
+Json::Writer &Json::Writer::beginObject() {
+	beginValue();
+	buffer += '{';
+	levels.push_back({ true, true, false });
+	return *this;
+}
+Json::Writer &Json::Writer::endObject() {
+#ifndef NDEBUG
+	if (levels.empty() || !levels.back().object || levels.back().hasKey) {
+		fail("Json: endObject() does not close an object");
+	}
+#endif
+
+	levels.pop_back();
+	if (pretty) {
+		buffer += '\n';
+		writeTab(levels.size());
+	}
+	buffer += '}';
+	if (pretty) {
+		buffer += '\n';
+	}
+
+	endValue();
+	return *this;
+}
+Json::Writer &Json::Writer::beginArray() {
+	beginValue();
+	buffer += '[';
+	levels.push_back({ false, true, false });
+	return *this;
+}
+Json::Writer &Json::Writer::endArray() {
+#ifndef NDEBUG
+	if (levels.empty() || levels.back().object) {
+		fail("Json: endArray() does not close an array");
+	}
+#endif
+
+	levels.pop_back();
+	if (pretty) {
+		buffer += '\n';
+		writeTab(levels.size());
+	}
+	buffer += ']';
+
+	endValue();
+	return *this;
+}
+Json::Writer &Json::Writer::key(std::string_view name) {
+#ifndef NDEBUG
+	if (levels.empty() || !levels.back().object || levels.back().hasKey) {
+		fail("Json: key() must be followed by a value and may only be used inside an object");
+	}
+#endif
+
+	Level &top = levels.back();
+	if (!top.first) {
+		buffer += ',';
+	}
+	top.first = false;
+	top.hasKey = true;
+
+	if (pretty) {
+		buffer += '\n';
+		writeTab(levels.size() - 1);
+		buffer += '"';
+		writeEscaped(name);
+		buffer += "\" : ";
+	}
+	else {
+		buffer += '"';
+		writeEscaped(name);
+		buffer += "\":";
+	}
+	return *this;
+}
+
+Json::Writer &Json::Writer::value(std::string_view str) {
+	beginValue();
+	buffer += '"';
+	writeEscaped(str);
+	buffer += '"';
+	endValue();
+	return *this;
+}
+Json::Writer &Json::Writer::value(const char *str) {
+	return value(std::string_view(str));
+}
+Json::Writer &Json::Writer::value(int num) {
+	return value((long long)num);
+}
+Json::Writer &Json::Writer::value(long num) {
+	return value((long long)num);
+}
+Json::Writer &Json::Writer::value(long long num) {
+	beginValue();
+	char digits[24];
+	buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), num).ptr);
+	endValue();
+	return *this;
+}
+Json::Writer &Json::Writer::value(unsigned num) {
+	return value((unsigned long long)num);
+}
+Json::Writer &Json::Writer::value(unsigned long num) {
+	return value((unsigned long long)num);
+}
+Json::Writer &Json::Writer::value(unsigned long long num) {
+	beginValue();
+	char digits[24];
+	buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), num).ptr);
+	endValue();
+	return *this;
+}
+Json::Writer &Json::Writer::value(float num) {
+	// Same format as std::to_string, which write() uses
+	beginValue();
+	char digits[64];
+	int size = std::snprintf(digits, sizeof(digits), "%f", (double)num);
+	buffer.append(digits, size < (int)sizeof(digits) ? size : sizeof(digits) - 1);
+	endValue();
+	return *this;
+}
+Json::Writer &Json::Writer::value(double num) {
+	return value((float)num);
+}
+Json::Writer &Json::Writer::value(bool b) {
+	beginValue();
+	buffer += b ? "True" : "False";
+	endValue();
+	return *this;
+}
+Json::Writer &Json::Writer::null() {
+	beginValue();
+	buffer += "Null";
+	endValue();
+	return *this;
+}
+Json::Writer &Json::Writer::value(const Json &json) {
+	// Each item writes its key if it has one, then opens, closes or writes a value
+	struct Item {
+		const Json *json;
+		const std::string *key;
+		bool close;
+	};
+	std::vector<Item> pending{ { &json, nullptr, false } };
+	std::vector<Item> children;
+	while (!pending.empty()) {
+		Item item = pending.back();
+		pending.pop_back();
+
+		if (item.close) {
+			if (item.json->dataType == Type::Object) {
+				endObject();
+			}
+			else {
+				endArray();
+			}
+			continue;
+		}
+
+		if (item.key != nullptr) {
+			key(*item.key);
+		}
+
+		switch (item.json->dataType) {
+		case Type::Object:
+			beginObject();
+			pending.push_back({ item.json, nullptr, true });
+
+			// Members are pushed in reverse so they come off in the map's order, as in write()
+			children.clear();
+			for (auto &pair : *item.json->map) {
+				children.push_back({ pair.second, &pair.first, false });
+			}
+			pending.insert(pending.end(), children.rbegin(), children.rend());
+			break;
+		case Type::Array:
+			beginArray();
+			pending.push_back({ item.json, nullptr, true });
+			for (size_t idx = item.json->arr->size(); idx-- > 0;) {
+				pending.push_back({ (*item.json->arr)[idx], nullptr, false });
+			}
+			break;
+		case Type::String:
+			value(std::string_view(*item.json->str));
+			break;
+		case Type::Integer:
+			value(*item.json->i);
+			break;
+		case Type::Float:
+			value(*item.json->f);
+			break;
+		case Type::Bool:
+			value(*item.json->b);
+			break;
+		case Type::Null:
+			null();
+			break;
+		}
+	}
+
+	return *this;
+}
+
+void Json::Writer::flush() {
+	if (sink && !buffer.empty()) {
+		sink(buffer.data(), buffer.size());
+		buffer.clear();
+	}
+}
+const std::string &Json::Writer::str() const {
+	return buffer;
+}
+
+void Json::Writer::beginValue() {
+#ifndef NDEBUG
+	if (done) {
+		fail("Json: Only one root value may be written");
+	}
+#endif
+
+	if (!levels.empty()) {
+		Level &top = levels.back();
+		if (top.object) {
+#ifndef NDEBUG
+			if (!top.hasKey) {
+				fail("Json: Values inside an object need a key()");
+			}
+#endif
+			top.hasKey = false;
+		}
+		else {
+			if (!top.first) {
+				buffer += ',';
+			}
+			top.first = false;
+
+			if (pretty) {
+				buffer += '\n';
+			}
+		}
+	}
+
+	// Every value starts indented, matching write()
+	if (pretty) {
+		writeTab(levels.size());
+	}
+}
+void Json::Writer::endValue() {
+	if (levels.empty()) {
+		done = true;
+	}
+	if (buffer.size() >= chunkSize) {
+		flush();
+	}
+}
+void Json::Writer::writeTab(size_t indent) {
+	buffer.append(indent, '\t');
+}
+void Json::Writer::writeEscaped(std::string_view str) {
+	// Matches Json::writeEscaped
+	char spare[7];
+	const char *curr = str.data();
+	const char *end = curr + str.size();
+	while (true) {
+		const char *stop = findEscape(curr, end);
+		buffer.append(curr, stop - curr);
+		if (stop == end) {
+			return;
+		}
+		buffer += escapeCharacter((unsigned char)*stop, spare);
+		curr = stop + 1;
+	}
+}
+void Json::Writer::fail(const char *message) {
+	throw json_write_error(message);
+}
+
 // Initialize data
 void Json::initMap() {
 	if (valid()) {
 		delData();
 	}
 
-	map = new Object();
+	map = resource != nullptr ? std::pmr::polymorphic_allocator<Object>(resource).new_object<Object>() : new Object();
 	dataType = Type::Object;
 }
 void Json::initArray() {
@@ -668,7 +3152,7 @@ void Json::initArray() {
 		delData();
 	}
 
-	arr = new Array();
+	arr = resource != nullptr ? std::pmr::polymorphic_allocator<Array>(resource).new_object<Array>() : new Array();
 	dataType = Type::Array;
 }
 void Json::initString() {
@@ -676,7 +3160,7 @@ void Json::initString() {
 		delData();
 	}
 
-	str = new std::string();
+	str = resource != nullptr ? std::pmr::polymorphic_allocator<std::string>(resource).new_object<std::string>() : new std::string();
 	dataType = Type::String;
 }
 void Json::initInt() {
@@ -684,7 +3168,7 @@ void Json::initInt() {
 		delData();
 	}
 
-	i = new long long();
+	i = resource != nullptr ? std::pmr::polymorphic_allocator<long long>(resource).new_object<long long>() : new long long();
 	dataType = Type::Integer;
 }
 void Json::initFloat() {
@@ -692,7 +3176,7 @@ void Json::initFloat() {
 		delData();
 	}
 
-	f = new float();
+	f = resource != nullptr ? std::pmr::polymorphic_allocator<float>(resource).new_object<float>() : new float();
 	dataType = Type::Float;
 }
 void Json::initBool() {
@@ -700,12 +3184,38 @@ void Json::initBool() {
 		delData();
 	}
 
-	b = new bool();
+	b = resource != nullptr ? std::pmr::polymorphic_allocator<bool>(resource).new_object<bool>() : new bool();
 	dataType = Type::Bool;
 }
 
 // Delete data
 void Json::delData() {
+	if (resource != nullptr) {
+		std::pmr::polymorphic_allocator<> alloc(resource);
+		switch (dataType) {
+		case Type::Object:
+			alloc.delete_object(map);
+			break;
+		case Type::Array:
+			alloc.delete_object(arr);
+			break;
+		case Type::String:
+			alloc.delete_object(str);
+			break;
+		case Type::Integer:
+			alloc.delete_object(i);
+			break;
+		case Type::Float:
+			alloc.delete_object(f);
+			break;
+		case Type::Bool:
+			alloc.delete_object(b);
+			break;
+		}
+		dataType = Type::Null;
+		return;
+	}
+
 	switch (dataType) {
 	case Type::Object:
 		delete map;
@@ -734,6 +3244,27 @@ Json::~Json() {
 	delData();
 }
 
+Json *Json::create(std::pmr::memory_resource *resource) {
+	if (resource == nullptr) {
+		return new Json();
+	}
+
+	Json *ret = new (resource->allocate(sizeof(Json), alignof(Json))) Json();
+	ret->resource = resource;
+	return ret;
+}
+void Json::operator delete(Json *json, std::destroying_delete_t) {
+	std::pmr::memory_resource *resource = json->resource;
+	json->~Json();
+
+	if (resource == nullptr) {
+		::operator delete(json);
+	}
+	else {
+		resource->deallocate(json, sizeof(Json), alignof(Json));
+	}
+}
+
 // Conversion functions
 Json::Object &Json::asObject() {
 	if (dataType != Type::Object) {
@@ -778,6 +3309,49 @@ bool &Json::asBool() {
 	return *b;
 }
 
+const Json::Object &Json::asObject() const {
+	if (dataType != Type::Object) {
+		throw json_type_error("Json: type is not object");
+	}
+
+	return *map;
+}
+const Json::Array &Json::asArray() const {
+	if (dataType != Type::Array) {
+		throw json_type_error("Json: type is not array");
+	}
+
+	return *arr;
+}
+const std::string &Json::asString() const {
+	if (dataType != Type::String) {
+		throw json_type_error("Json: type is not string");
+	}
+
+	return *str;
+}
+const long long &Json::asInt() const {
+	if (dataType != Type::Integer) {
+		throw json_type_error("Json: type is not int");
+	}
+
+	return *i;
+}
+const float &Json::asFloat() const {
+	if (dataType != Type::Float) {
+		throw json_type_error("Json: type is not float");
+	}
+
+	return *f;
+}
+const bool &Json::asBool() const {
+	if (dataType != Type::Bool) {
+		throw json_type_error("Json: type is not bool");
+	}
+
+	return *b;
+}
+
 // Conversion operators
 Json::operator Json::Object &() {
 	if (!valid()) {
@@ -857,6 +3431,31 @@ const Json &Json::operator[](size_t idx) {
 
 	return *(arr[0][idx]);
 }
+const Json &Json::operator()(const std::string &key) const {
+	if (ptr == nullptr) {
+		throw json_null_error("Json: Data is null");
+	}
+	if (dataType != Type::Object) {
+		throw json_type_error("Json: type is not object");
+	}
+
+	auto it = map->find(key);
+	if (it == map->end()) {
+		throw json_key_error("Json: Key does not exist: " + key);
+	}
+
+	return *(it->second);
+}
+const Json &Json::operator[](size_t idx) const {
+	if (ptr == nullptr) {
+		throw json_null_error("Json: Data is null");
+	}
+	if (dataType != Type::Array) {
+		throw json_type_error("Json: type is not array");
+	}
+
+	return *(arr[0][idx]);
+}
 
 // Member access functions
 Json::Object::iterator Json::find(std::string &key) {
@@ -875,15 +3474,31 @@ const Json &Json::at(size_t idx) {
 
 	return *arr->at(idx);
 }
+Json::Object::const_iterator Json::find(const std::string &key) const {
+	if (dataType != Type::Object) {
+		throw json_type_error("Json: type is not object");
+	}
+	return map->find(key);
+}
+const Json &Json::at(size_t idx) const {
+	if (ptr == nullptr) {
+		throw json_null_error("Json: Data is null");
+	}
+	if (dataType != Type::Array) {
+		throw json_type_error("Json: type is not array");
+	}
+
+	return *arr->at(idx);
+}
 
 // Data
-bool Json::valid() {
+bool Json::valid() const {
 	return ptr != nullptr;
 }
-Json::Type Json::type() {
+Json::Type Json::type() const {
 	return dataType;
 }
-size_t Json::size() {
+size_t Json::size() const {
 	switch (dataType) {
 	case Type::Object:
 		return map->size();
@@ -909,5 +3524,90 @@ size_t Json::size() {
 	}
 }
 
+// Snapshots
+std::shared_ptr<const Json> Json::freeze() {
+	return std::shared_ptr<const Json>(this, [](const Json *json) {
+		destroy(const_cast<Json *>(json));
+	});
+}
+
+Json::Snapshot::Snapshot(std::shared_ptr<const Json> json) : current(std::move(json)) {}
+
+std::shared_ptr<const Json> Json::Snapshot::load() const {
+	return current.load(std::memory_order_acquire);
+}
+void Json::Snapshot::store(std::shared_ptr<const Json> json) {
+	current.store(std::move(json), std::memory_order_release);
+}
+std::shared_ptr<const Json> Json::Snapshot::exchange(std::shared_ptr<const Json> json) {
+	return current.exchange(std::move(json), std::memory_order_acq_rel);
+}
+
+// Shared subtrees
+Json::Store::~Store() {
+	// Every node is held once and children are separate entries, so each is deleted without its descendants
+	for (auto &pair : values) {
+		delete pair.second;
+	}
+}
+
+const Json *Json::Store::intern(Json *json) {
+	// Children are interned before their parents, so a parent matches a held value when its children are the same
+	// pointers. Each slot is where the node being interned is referenced from.
+	Json *root = json;
+	std::vector<std::pair<Json **, bool>> pending{ { &root, false } };
+	while (!pending.empty()) {
+		auto [slot, ready] = pending.back();
+		pending.pop_back();
+
+		Json *val = *slot;
+		bool container = val->dataType == Type::Object || val->dataType == Type::Array;
+		if (!ready && container) {
+			pending.push_back({ slot, true });
+			if (val->dataType == Type::Object) {
+				for (auto &pair : *val->map) {
+					pending.push_back({ &pair.second, false });
+				}
+			}
+			else {
+				for (Json *&child : *val->arr) {
+					pending.push_back({ &child, false });
+				}
+			}
+			continue;
+		}
+
+		total++;
+		std::uint64_t hash = container ? hashContainer(val, hashes) : hashScalar(val);
+
+		Json *match = nullptr;
+		for (auto [it, end] = values.equal_range(hash); it != end; it++) {
+			if (sameChildren(it->second, val)) {
+				match = it->second;
+				break;
+			}
+		}
+
+		if (match != nullptr) {
+			// The duplicate's children are already held by the store, so only the node itself is deleted
+			delete val;
+			*slot = match;
+		}
+		else {
+			values.emplace(hash, val);
+			hashes.emplace(val, hash);
+		}
+	}
+
+	return root;
+}
+
+size_t Json::Store::size() const {
+	return values.size();
+}
+size_t Json::Store::interned() const {
+	return total;
+}
+
 _XELA_JSON_END
 #endif
\ No newline at end of file
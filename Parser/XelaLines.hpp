@@ -0,0 +1,73 @@
+// Xela Lines
+//
+// Author: Alex Morse
+//
+// Line and column lookup shared by the source maps and error messages of the Xela parsers.
+// Everything is defined inline, so each parser can include it without another implementation define.
+//
+// This software is dual-licensed to the public domain and under the following
+// license: you are granted a perpetual, irrevocable license to copy, modify,
+// publish, and distribute this file as you see fit.
+
+#ifndef _XELA_LINES_HPP
+#define _XELA_LINES_HPP
+
+#include <string_view>
+#include <utility>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define _XELA_LINES_SSE2
+#endif
+
+#define _XELA_LINES_START namespace Xela {  extern "C" {
+#define _XELA_LINES_END } }
+
+_XELA_LINES_START // C style structs and functions
+
+// Positions within parsed text
+class Lines {
+public:
+	// Line and column of the byte at offset, both counting from 1. Offsets past the end are clamped to it.
+	static std::pair<size_t, size_t> locate(std::string_view source, size_t offset);
+};
+
+inline std::pair<size_t, size_t> Lines::locate(std::string_view source, size_t offset) {
+	if (offset > source.size()) {
+		offset = source.size();
+	}
+
+	const char *begin = source.data();
+	const char *end = begin + offset;
+	const char *curr = begin;
+	size_t newlines = 0;
+
+#ifdef _XELA_LINES_SSE2
+	// Count newlines 16 bytes at a time. Byte counters are folded into the total before they can overflow.
+	const __m128i newline = _mm_set1_epi8('\n');
+	while (end - curr >= 16) {
+		__m128i counts = _mm_setzero_si128();
+		for (size_t i = 0; i < 255 && end - curr >= 16; i++, curr += 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i *)curr);
+			counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(chunk, newline));
+		}
+		__m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+		newlines += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_extract_epi16(sums, 4);
+	}
+#endif
+	for (; curr < end; curr++) {
+		newlines += *curr == '\n';
+	}
+
+	// Column counts from the character after the last newline
+	const char *lineStart = end;
+	while (lineStart > begin && lineStart[-1] != '\n') {
+		lineStart--;
+	}
+
+	return { newlines + 1, (size_t)(end - lineStart) + 1 };
+}
+
+_XELA_LINES_END
+#endif
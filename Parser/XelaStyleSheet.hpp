@@ -4,6 +4,9 @@
 // 
 // TODO - add description here
 // 
+// Define XELA_PARSE_STATS before including to fill in ParseOptions::stats.
+// Without it the counters are compiled out and the option is ignored.
+// 
 // This software is dual-licensed to the public domain and under the following
 // license: you are granted a perpetual, irrevocable license to copy, modify,
 // publish, and distribute this file as you see fit.
@@ -14,10 +17,19 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <algorithm>
+#include <numeric>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <string_view>
+#include <chrono>
+#include <memory_resource>
+#include <new>
+
+#include "XelaAsync.hpp"
+#include "XelaLines.hpp"
 
 #define _XELA_XSS_START namespace Xela {  extern "C" {
 #define _XELA_XSS_END } }
@@ -56,7 +68,7 @@ public:
 
 			switch (other.type) {
 			case STRING:
-				str = other.str;
+				new (&str) std::string(other.str);
 				break;
 			case NUMBER:
 				num = other.num;
@@ -65,7 +77,7 @@ public:
 		}
 
 		Value(std::string s) {
-			str = s;
+			new (&str) std::string(std::move(s));
 			type = STRING;
 		}
 
@@ -75,8 +87,15 @@ public:
 		}
 
 		Value &operator=(std::string s) {
-			str = s;
-			type = STRING;
+			// The string only exists while it is the active member
+			if (type == STRING) {
+				str = std::move(s);
+			}
+			else {
+				new (&str) std::string(std::move(s));
+				type = STRING;
+			}
+			return *this;
 		}
 
 		~Value() {
@@ -86,36 +105,200 @@ public:
 		}
 	};
 
-	using ChildArr = std::vector<Xss *>;
-	using StyleMap = std::unordered_map<std::string, Value>;
+	using ChildArr = std::pmr::vector<Xss *>;
+	using StyleMap = std::pmr::unordered_map<std::string, Value>;
+
+	struct Location {
+		size_t line;
+		size_t col;
+	};
+
+	// What a parse did, filled in when passed through ParseOptions::stats and XELA_PARSE_STATS is defined.
+	// Each parse starts from zero.
+	class Stats {
+	public:
+		// Input bytes consumed
+		size_t bytes = 0;
+		// Nodes created, and the specs they hold
+		size_t styles = 0;
+		size_t specs = 0;
+		// Deepest style, with the root at 1
+		size_t maxDepth = 0;
+		// Allocations made for nodes, and their total size. Style maps, child lists and strings are not counted;
+		// parse into a counting memory resource to see them.
+		size_t allocations = 0;
+		size_t allocated = 0;
+		// Time spent reading the input, by fromFile and fromStream, and parsing it
+		std::chrono::nanoseconds read{};
+		std::chrono::nanoseconds parse{};
+
+		void clear();
+
+	private:
+		friend class Xss;
+
+		// Styles open above the one being parsed
+		size_t depth = 0;
+
+		void record();
+	};
+
+	// Byte offset of each node produced by a parse, kept beside the tree so nodes stay the same size.
+	// Recording is off unless one is passed through ParseOptions::locations.
+	class SourceMap {
+	public:
+		// Byte offset where node starts, or std::string::npos if it was not recorded
+		size_t offset(const Xss *node) const;
+		// Line and column where node starts, or { 0, 0 } if it was not recorded
+		Location locate(const Xss *node) const;
+
+		const std::string &source() const;
+		size_t size() const;
+		void clear();
+
+	private:
+		friend class Xss;
+
+		std::string text;
+
+		// Parallel arrays in the order nodes were parsed
+		std::vector<const Xss *> nodes;
+		std::vector<size_t> offsets;
+
+		// Positions in nodes sorted by address, built on the first lookup
+		mutable std::vector<size_t> sorted;
+
+		void record(const Xss *node, size_t offset);
+	};
+
+	struct ParseOptions {
+		// When set, receives the offset of every parsed style
+		SourceMap *locations = nullptr;
+		// When set, nodes and their style maps and child lists are allocated from it instead of the global heap.
+		// Strings longer than the small string buffer still use the heap.
+		std::pmr::memory_resource *resource = nullptr;
+		// When set, receives counts and timings for the parse
+		Stats *stats = nullptr;
+	};
 
 private:
+	// Read position within the buffer being parsed. Mirrors the parts of std::istream the parser uses.
+	// Only the byte offset is tracked; line and column are computed by locate() when an error is built.
+	struct Cursor {
+		const char *begin;
+		const char *curr;
+		const char *end;
+		// Where new nodes are allocated, or nullptr for new
+		std::pmr::memory_resource *resource = nullptr;
+
+		int peek() const {
+			return curr < end ? (unsigned char)*curr : EOF;
+		}
+		int get() {
+			const char *c = curr++;
+			return c < end ? (unsigned char)*c : EOF;
+		}
+		void ignore() {
+			curr++;
+		}
+		void unget() {
+			curr--;
+		}
+		bool eof() const {
+			return curr >= end;
+		}
+
+		size_t offset() const {
+			return (curr < end ? curr : end) - begin;
+		}
+		std::string where() const {
+			// Errors are reported at the last character read
+			size_t last = offset();
+			Location loc = locate(std::string_view(begin, end - begin), last > 0 ? last - 1 : 0);
+			return std::to_string(loc.line) + ", " + std::to_string(loc.col);
+		}
+	};
+
 	std::string name;
 	StyleMap style;
 
 	ChildArr children;
 
-	static void consumeWhitespace(std::istream &in, size_t &line, size_t &col);
-	static char getEscapeCharacter(std::istream &in, size_t &line, size_t &col);
+	// Holds this node and its containers, or nullptr if the node was made with new
+	std::pmr::memory_resource *resource = nullptr;
 
-	static std::string parseIdentifier(std::istream &in, size_t &line, size_t &col);
-	static std::string parseString(std::istream &in, size_t &line, size_t &col);
-	static std::uint32_t parseHex(std::istream &in, size_t &line, size_t &col);
+	Xss(std::pmr::memory_resource *resource);
+	static Xss *create(std::pmr::memory_resource *resource);
 
-	static Value parseValue(std::istream &in, size_t &line, size_t &col);
+	static void consumeWhitespace(Cursor &in);
+	static char getEscapeCharacter(Cursor &in);
 
-	static Xss *parseStyle(std::istream &in, std::string &key, size_t &line, size_t &col);
-	static Value parseSpec(std::istream &in, size_t &line, size_t &col);
+	static std::string parseIdentifier(Cursor &in);
+	static std::string parseString(Cursor &in);
+	static std::uint32_t parseHex(Cursor &in);
 
-	static Xss *parseXss(std::istream &in, size_t &line, size_t &col, Xss *xss);
+	static Value parseValue(Cursor &in);
+
+	static Xss *parseStyle(Cursor &in, std::string &key, const ParseOptions &options);
+	static Value parseSpec(Cursor &in);
+
+	static Xss *parseXss(Cursor &in, Xss *xss, const ParseOptions &options);
 
 public:
 	Xss();
 	~Xss();
 
+	// Nodes parsed into a memory resource are returned to it, so every node is deleted the same way
+	void operator delete(Xss *xss, std::destroying_delete_t);
+
 	static Xss *fromStream(std::istream &in);
+	static Xss *fromStream(std::istream &in, const ParseOptions &options);
 	static Xss *fromFile(std::filesystem::path file);
+	static Xss *fromFile(std::filesystem::path file, const ParseOptions &options);
 	static Xss *fromString(std::string &str);
+	static Xss *fromString(std::string &str, const ParseOptions &options);
+
+	using LoadCallback = std::function<void(Xss *xss, std::exception_ptr error)>;
+
+	// Result of fromFileAsync. The tree belongs to whoever takes it with get() or co_await.
+	class Loading : public Pending {
+	public:
+		Xss *get();
+		Xss *await_resume();
+
+	private:
+		friend class Xss;
+
+		Loading();
+	};
+
+	// Reads the file on an IoBackend and parses it on a ThreadPool, the shared ones unless others are given.
+	// Anything options points to must outlive the load. done is called on a pool thread.
+	static Loading fromFileAsync(std::filesystem::path file);
+	static Loading fromFileAsync(std::filesystem::path file, const ParseOptions &options);
+	static Loading fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool);
+	static void fromFileAsync(std::filesystem::path file, const ParseOptions &options, LoadCallback done);
+	static void fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool, LoadCallback done);
+
+	// One file of a batch: its tree, or why it failed
+	struct Loaded {
+		std::filesystem::path file;
+		Xss *xss = nullptr;
+		std::exception_ptr error;
+	};
+
+	// Reads and parses every file on a ThreadPool, the shared one unless another is given. Results are in the same
+	// order as files, and a failed file does not stop the rest. Each tree belongs to the caller. Source maps and stats
+	// are ignored, since they cannot be shared between files. The trees outlive the batch, so rather than a worker
+	// reusing one arena for its files, each file is parsed into an Arena of its own that its tree frees, in place of
+	// any memory resource given.
+	static std::vector<Loaded> fromFiles(const std::vector<std::filesystem::path> &files);
+	static std::vector<Loaded> fromFiles(const std::vector<std::filesystem::path> &files, const ParseOptions &options, ThreadPool &pool);
+	// Every file beneath directory whose name matches pattern, as found by Batch::find
+	static std::vector<Loaded> fromDirectory(const std::filesystem::path &directory, std::string_view pattern);
+
+	// Line and column of the character at a byte offset within source. Both start at 1.
+	static Location locate(std::string_view source, size_t offset);
 
 	//void write(bool pretty = false, std::ostream &out = std::cout);
 };
@@ -125,23 +308,23 @@ _XELA_XSS_END
 #define XELA_XSS_IMPLEMENTATION
 #ifdef XELA_XSS_IMPLEMENTATION
 
-#define XSS_ERR(line, col) std::string("Xss [" + std::to_string(line) + ", " + std::to_string(col) + "]: ") +
+#define XSS_ERR(in) std::string("Xss [" + in.where() + "]: ") +
+
+#ifdef XELA_PARSE_STATS
+#define XSS_STATS(stmt) if (options.stats != nullptr) { stmt; }
+#else
+#define XSS_STATS(stmt)
+#endif
 
 _XELA_XSS_START // C style structs and functions
 
-void Xss::consumeWhitespace(std::istream &in, size_t &line, size_t &col) {
+void Xss::consumeWhitespace(Cursor &in) {
 	while (std::isspace(in.peek())) {
-		char c = in.get();
-		col++;
-		if (c == '\n') {
-			line++;
-			col = 0;
-		}
+		in.ignore();
 	}
 }
-char Xss::getEscapeCharacter(std::istream &in, size_t &line, size_t &col) {
+char Xss::getEscapeCharacter(Cursor &in) {
 	char c = in.get();
-	col++;
 
 	switch (c) {
 	case '\'':
@@ -180,25 +363,23 @@ char Xss::getEscapeCharacter(std::istream &in, size_t &line, size_t &col) {
 	case '0':
 		return '\0';
 	default:
-		throw xss_parse_error(XSS_ERR(line, col) "Unrecognized escape sequence : \"\\" + c + "\"");
+		throw xss_parse_error(XSS_ERR(in) "Unrecognized escape sequence : \"\\" + c + "\"");
 		break;
 	}
 
 	return '\0';
 }
 
-std::string Xss::parseIdentifier(std::istream &in, size_t &line, size_t &col) {
+std::string Xss::parseIdentifier(Cursor &in) {
 	// ([a-z] | [A-Z] | [0-9] | '_')*
 
 	std::string ident = "";
 
 	while (true) {
 		char c = in.get();
-		col++;
 
 		if (std::isspace(c) || c == '<' || c == '>' || c == '/' || c == '=') {
 			in.unget();
-			col--;
 			return ident;
 		}
 
@@ -209,36 +390,35 @@ std::string Xss::parseIdentifier(std::istream &in, size_t &line, size_t &col) {
 			ident += c;
 		}
 		else {
-			throw xss_parse_error(XSS_ERR(line, col) "Unexpected token while parsing identifier: " + c);
+			throw xss_parse_error(XSS_ERR(in) "Unexpected token while parsing identifier: " + c);
 		}
 
 		// Error check
 		if (in.eof()) {
-			throw xss_parse_error(XSS_ERR(line, col) "Unexpected end of file while parsing identifier");
+			throw xss_parse_error(XSS_ERR(in) "Unexpected end of file while parsing identifier");
 		}
 	}
 }
-std::string Xss::parseString(std::istream &in, size_t &line, size_t &col) {
+std::string Xss::parseString(Cursor &in) {
 	// '"' CHAR* '""
 
 	std::string result = "";
 
 	char c = in.get();
-	col++;
 	if (c != '"') {
-		throw xss_parse_error(XSS_ERR(line, col) "Unexpected token while parsing string: " + c + ". Expected '\"'");
+		throw xss_parse_error(XSS_ERR(in) "Unexpected token while parsing string: " + c + ". Expected '\"'");
 	}
 
 	for (c = in.get(); c != '\"'; c = in.get()) {
 		result += c;
 		if (in.eof()) {
-			throw xss_parse_error(XSS_ERR(line, col) "Unexpected end of file while parsing string");
+			throw xss_parse_error(XSS_ERR(in) "Unexpected end of file while parsing string");
 		}
 	}
 
 	return result;
 }
-std::uint32_t Xss::parseHex(std::istream &in, size_t &line, size_t &col) {
+std::uint32_t Xss::parseHex(Cursor &in) {
 	// '#' ([0-9] | [a-f] | [A-F])+
 
 	std::uint32_t result = 0;
@@ -246,20 +426,18 @@ std::uint32_t Xss::parseHex(std::istream &in, size_t &line, size_t &col) {
 
 	// Ensure first character is '#'
 	char c = in.get();
-	col++;
 	if (c != '#') {
-		throw xss_parse_error(XSS_ERR(line, col) "Unexpected token while parsing hex: " + c + ". Expected '#'");
+		throw xss_parse_error(XSS_ERR(in) "Unexpected token while parsing hex: " + c + ". Expected '#'");
 	}
 
 	// Read hex string
 	size_t len = 0;
 	for (c = in.get(); (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); c = in.get()) {
 		str += c;
-		col++;
 
 		len++;
 		if (len > 8) {
-			throw xss_parse_error(XSS_ERR(line, col) "Hex string longer than 8 characters");
+			throw xss_parse_error(XSS_ERR(in) "Hex string longer than 8 characters");
 		}
 	}
 
@@ -286,112 +464,120 @@ std::uint32_t Xss::parseHex(std::istream &in, size_t &line, size_t &col) {
 	return result;
 }
 
-Xss::Value Xss::parseValue(std::istream &in, size_t &line, size_t &col) {
+Xss::Value Xss::parseValue(Cursor &in) {
 	Value result{};
 
 	// Leading whitespace
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	// Determine whether this is a string, hex, or ident
 	char c = in.peek();
 	switch (c) {
 	case '\"':
-		result = parseString(in, line, col);
+		result = parseString(in);
 		break;
 	case '#':
-		result.num = parseHex(in, line, col);
+		result.num = parseHex(in);
 		result.type = Value::NUMBER;
 		break;
 	default:
-		result.str = parseIdentifier(in, line, col);
-		result.type = Value::STRING;
+		result = parseIdentifier(in);
 		break;
 	}
 
 	// Trailing whitespace
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	return result;
 }
 
-Xss *Xss::parseStyle(std::istream &in, std::string &key, size_t &line, size_t &col) {
+Xss *Xss::parseStyle(Cursor &in, std::string &key, const ParseOptions &options) {
 	// WS key WS '{' xss* '}' WS
 
 	// Leading whitespace
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	// Next character should be '{'
 	char c = in.get();
-	col++;
 	if (c != '{') {
-		throw xss_parse_error(XSS_ERR(line, col) "Unexpected token while parsing style: " + c + ". Expected '{'");
+		throw xss_parse_error(XSS_ERR(in) "Unexpected token while parsing style: " + c + ". Expected '{'");
 	}
 
 	// Parse xss
-	Xss *result = new Xss();
+	Xss *result = create(in.resource);
 	result->name = key;
+	XSS_STATS(options.stats->depth++; options.stats->record());
 
-	while (in.peek() != '}') {
-		// Error check
-		if (in.eof()) {
-			throw xss_parse_error(XSS_ERR(line, col) "Reached unexpecred end of file while parsing style. Expected style to end with '}'");
-		}
+	try {
+		while (in.peek() != '}') {
+			// Error check
+			if (in.eof()) {
+				throw xss_parse_error(XSS_ERR(in) "Reached unexpecred end of file while parsing style. Expected style to end with '}'");
+			}
 
-		// Leading whitespace
-		consumeWhitespace(in, line, col);
+			// Leading whitespace
+			consumeWhitespace(in);
 
-		// Check for end of style
-		if (in.peek() == '}') {
-			continue;
-		}
+			// Check for end of style
+			if (in.peek() == '}') {
+				continue;
+			}
 
-		parseXss(in, line, col, result);
+			parseXss(in, result, options);
+		}
+	}
+	catch (...) {
+		delete result;
+		throw;
 	}
+	XSS_STATS(options.stats->depth--);
+
+	// Ignore '}'
+	in.ignore();
 
 	// Trailing whitespace
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	return result;
 }
-Xss::Value Xss::parseSpec(std::istream &in, size_t &line, size_t &col) {
+Xss::Value Xss::parseSpec(Cursor &in) {
 	// WS ident WS ':' value ';' WS
 
 	// Leading whitespace
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	// Next character should be ':'
 	char c = in.get();
-	col++;
 	if (c != ':') {
-		throw xss_parse_error(XSS_ERR(line, col) "Unexpected token while parsing spec: " + c + ". Expected ':'");
+		throw xss_parse_error(XSS_ERR(in) "Unexpected token while parsing spec: " + c + ". Expected ':'");
 	}
 
 	// Get value
-	Value result = parseValue(in, line, col);
+	Value result = parseValue(in);
 
 	// Next character should be ';'
 	c = in.get();
-	col++;
 	if (c != ';') {
-		throw xss_parse_error(XSS_ERR(line, col) "Unexpected token while parsing spec: " + c + ". Expected ';'");
+		throw xss_parse_error(XSS_ERR(in) "Unexpected token while parsing spec: " + c + ". Expected ';'");
 	}
 
 	return result;
 }
 
-Xss *Xss::parseXss(std::istream &in, size_t &line, size_t &col, Xss *xss) {
+Xss *Xss::parseXss(Cursor &in, Xss *xss, const ParseOptions &options) {
 	// (spec | style)*
 
 	if (xss == nullptr) {
-		xss = new Xss();
+		xss = create(in.resource);
+		XSS_STATS(options.stats->record());
 	}
 	
 	// Leading whitespace
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	// Error check
 	if (in.eof()) {
-		throw xss_parse_error(XSS_ERR(line, col) "Unexpected end of file while parsing xss");
+		throw xss_parse_error(XSS_ERR(in) "Unexpected end of file while parsing xss");
 	}
 
 	// Get first key/ident. This may be for either a spec or a style so we have to parse it here
@@ -399,62 +585,300 @@ Xss *Xss::parseXss(std::istream &in, size_t &line, size_t &col, Xss *xss) {
 	// Beginning of spec: WS ident WS ':' ...
 	std::string name = "";
 
+	size_t start = in.offset();
+
 	// Key accepts '#' or '.' as a first character, followed by an identifier, so make sure that character may be accepted.
 	char c = in.peek();
 	if (c == '#' || c == '.') {
 		in.ignore();
-		col++;
 
 		name += c;
 	}
 	// Parse rest of key/ident
-	name += parseIdentifier(in, line, col);
+	name += parseIdentifier(in);
 	
 	// Whitespace before next character
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	// Determine whether this is for a spec or a style
 	c = in.peek();
 	switch (c) {
 	case ':':
 		// This is a spec
-		xss->style.emplace(name, parseSpec(in, line, col));
+		xss->style.emplace(name, parseSpec(in));
+		XSS_STATS(options.stats->specs++);
 		break;
 	case '{':
 		// This is a style
-		xss->children.push_back(parseStyle(in, name, line, col));
+		xss->children.push_back(parseStyle(in, name, options));
+		if (options.locations != nullptr) {
+			options.locations->record(xss->children.back(), start);
+		}
 		break;
 	default:
-		throw xss_parse_error(XSS_ERR(line, col) "Unexpected token while parsing xss: " + c + ". Expected ':' or '{'");
+		throw xss_parse_error(XSS_ERR(in) "Unexpected token while parsing xss: " + c + ". Expected ':' or '{'");
 		break;
 	}
 
 	// Trailing whitespace
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	return xss;
 }
 
 Xss::Xss() {}
-Xss::~Xss() {}
+Xss::Xss(std::pmr::memory_resource *resource) : style(resource), children(resource), resource(resource) {}
+Xss::~Xss() {
+	// Descendants are queued and detached before deletion so deep trees cannot overflow the stack
+	std::vector<Xss *> pending(children.begin(), children.end());
+	children.clear();
+
+	while (!pending.empty()) {
+		Xss *xss = pending.back();
+		pending.pop_back();
+
+		pending.insert(pending.end(), xss->children.begin(), xss->children.end());
+		xss->children.clear();
+
+		delete xss;
+	}
+}
+
+void Xss::operator delete(Xss *xss, std::destroying_delete_t) {
+	std::pmr::memory_resource *resource = xss->resource;
+	xss->~Xss();
+
+	if (resource == nullptr) {
+		::operator delete(xss);
+	}
+	else {
+		resource->deallocate(xss, sizeof(Xss), alignof(Xss));
+	}
+}
+Xss *Xss::create(std::pmr::memory_resource *resource) {
+	if (resource == nullptr) {
+		return new Xss();
+	}
+
+	return new (resource->allocate(sizeof(Xss), alignof(Xss))) Xss(resource);
+}
 
 Xss *Xss::fromStream(std::istream &in) {
-	size_t line = 1, col = 0;
-	return parseXss(in, line, col, nullptr);
+	return fromStream(in, ParseOptions());
+}
+Xss *Xss::fromStream(std::istream &in, const ParseOptions &options) {
+	std::chrono::steady_clock::time_point started;
+	XSS_STATS(started = std::chrono::steady_clock::now());
+
+	std::ostringstream buffer;
+	buffer << in.rdbuf();
+	std::string str = buffer.str();
+
+	std::chrono::nanoseconds read{};
+	XSS_STATS(read = std::chrono::steady_clock::now() - started);
+
+	Xss *ret = fromString(str, options);
+	XSS_STATS(options.stats->read = read);
+	return ret;
 }
 Xss *Xss::fromFile(std::filesystem::path file) {
+	return fromFile(file, ParseOptions());
+}
+Xss *Xss::fromFile(std::filesystem::path file, const ParseOptions &options) {
+	std::chrono::steady_clock::time_point started;
+	XSS_STATS(started = std::chrono::steady_clock::now());
+
 	std::ifstream in;
-	in.open(file);
+	in.open(file, std::ios::binary);
 
 	if (!in.is_open()) {
 		throw xss_file_error("Xss: Failed to open file: " + file.string());
 	}
 
-	return fromStream(in);
+	std::string str;
+	str.resize((size_t)std::filesystem::file_size(file));
+	in.read(str.data(), str.size());
+	str.resize((size_t)in.gcount());
+
+	std::chrono::nanoseconds read{};
+	XSS_STATS(read = std::chrono::steady_clock::now() - started);
+
+	Xss *ret = fromString(str, options);
+	XSS_STATS(options.stats->read = read);
+	return ret;
 }
 Xss *Xss::fromString(std::string &str) {
-	std::istringstream in(str);
-	return fromStream(in);
+	return fromString(str, ParseOptions());
+}
+Xss *Xss::fromString(std::string &str, const ParseOptions &options) {
+	if (options.locations != nullptr) {
+		options.locations->clear();
+		options.locations->text = str;
+	}
+
+	std::chrono::steady_clock::time_point started;
+	XSS_STATS(options.stats->clear(); started = std::chrono::steady_clock::now());
+
+	Cursor in{ str.data(), str.data(), str.data() + str.size(), options.resource };
+
+	// The root holds every top level spec and style, and is empty for empty input
+	Xss *result = create(in.resource);
+	XSS_STATS(options.stats->record());
+	try {
+		for (consumeWhitespace(in); !in.eof(); consumeWhitespace(in)) {
+			parseXss(in, result, options);
+		}
+	}
+	catch (...) {
+		delete result;
+		throw;
+	}
+	XSS_STATS(options.stats->bytes = in.offset(); options.stats->parse = std::chrono::steady_clock::now() - started);
+
+	if (options.locations != nullptr) {
+		options.locations->record(result, 0);
+	}
+
+	return result;
+}
+
+// Read asynchronously
+Xss::Loading::Loading() : Pending([](void *value) { delete (Xss *)value; }) {}
+
+Xss *Xss::Loading::get() {
+	return (Xss *)take();
+}
+Xss *Xss::Loading::await_resume() {
+	return (Xss *)take();
+}
+
+Xss::Loading Xss::fromFileAsync(std::filesystem::path file) {
+	return fromFileAsync(file, ParseOptions());
+}
+Xss::Loading Xss::fromFileAsync(std::filesystem::path file, const ParseOptions &options) {
+	return fromFileAsync(file, options, IoBackend::shared(), ThreadPool::shared());
+}
+Xss::Loading Xss::fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool) {
+	Loading ret;
+	fromFileAsync(file, options, io, pool, [done = ret.completer()](Xss *xss, std::exception_ptr error) {
+		done(xss, error);
+	});
+	return ret;
+}
+void Xss::fromFileAsync(std::filesystem::path file, const ParseOptions &options, LoadCallback done) {
+	fromFileAsync(file, options, IoBackend::shared(), ThreadPool::shared(), std::move(done));
+}
+void Xss::fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool, LoadCallback done) {
+	auto parse = [options](std::string &contents, const std::string &error) -> void * {
+		if (!error.empty()) {
+			throw xss_file_error("Xss: " + error);
+		}
+		return fromString(contents, options);
+	};
+	Pending::load(file, io, pool, parse, [done = std::move(done)](void *value, std::exception_ptr error) {
+		done((Xss *)value, error);
+	});
+}
+
+// Read many files
+std::vector<Xss::Loaded> Xss::fromFiles(const std::vector<std::filesystem::path> &files) {
+	return fromFiles(files, ParseOptions(), ThreadPool::shared());
+}
+std::vector<Xss::Loaded> Xss::fromFiles(const std::vector<std::filesystem::path> &files, const ParseOptions &options, ThreadPool &pool) {
+	ParseOptions fileOptions = options;
+	fileOptions.locations = nullptr;
+	fileOptions.stats = nullptr;
+
+	std::vector<Loaded> ret(files.size());
+	Batch::load(files, pool, [&](size_t index, std::string &contents, const std::string &error) {
+		Loaded &result = ret[index];
+		result.file = files[index];
+
+		ParseOptions arenaOptions = fileOptions;
+		Arena *arena = new Arena(contents.size());
+		arenaOptions.resource = arena;
+
+		try {
+			if (!error.empty()) {
+				throw xss_file_error("Xss: " + error);
+			}
+			result.xss = fromString(contents, arenaOptions);
+		}
+		catch (...) {
+			result.error = std::current_exception();
+		}
+
+		arena->release();
+	});
+
+	return ret;
+}
+std::vector<Xss::Loaded> Xss::fromDirectory(const std::filesystem::path &directory, std::string_view pattern) {
+	return fromFiles(Batch::find(directory, pattern));
+}
+
+// Parse statistics
+void Xss::Stats::clear() {
+	*this = Stats();
+}
+
+void Xss::Stats::record() {
+	styles++;
+	maxDepth = std::max(maxDepth, depth + 1);
+
+	allocations++;
+	allocated += sizeof(Xss);
+}
+
+// Source map
+size_t Xss::SourceMap::offset(const Xss *node) const {
+	if (sorted.size() != nodes.size()) {
+		sorted.resize(nodes.size());
+		std::iota(sorted.begin(), sorted.end(), 0);
+		std::sort(sorted.begin(), sorted.end(), [this](size_t a, size_t b) {
+			return std::less<const Xss *>()(nodes[a], nodes[b]);
+		});
+	}
+
+	auto it = std::lower_bound(sorted.begin(), sorted.end(), node, [this](size_t idx, const Xss *val) {
+		return std::less<const Xss *>()(nodes[idx], val);
+	});
+	if (it == sorted.end() || nodes[*it] != node) {
+		return std::string::npos;
+	}
+
+	return offsets[*it];
+}
+Xss::Location Xss::SourceMap::locate(const Xss *node) const {
+	size_t off = offset(node);
+	if (off == std::string::npos) {
+		return { 0, 0 };
+	}
+
+	return Xss::locate(text, off);
+}
+
+const std::string &Xss::SourceMap::source() const {
+	return text;
+}
+size_t Xss::SourceMap::size() const {
+	return nodes.size();
+}
+void Xss::SourceMap::clear() {
+	text.clear();
+	nodes.clear();
+	offsets.clear();
+	sorted.clear();
+}
+
+void Xss::SourceMap::record(const Xss *node, size_t offset) {
+	nodes.push_back(node);
+	offsets.push_back(offset);
+}
+
+Xss::Location Xss::locate(std::string_view source, size_t offset) {
+	auto [line, column] = Lines::locate(source, offset);
+	return { line, column };
 }
 
 _XELA_XSS_END
@@ -4,6 +4,9 @@
 // 
 // TODO - add description here
 // 
+// Define XELA_PARSE_STATS before including to fill in ParseOptions::stats.
+// Without it the counters are compiled out and the option is ignored.
+// 
 // This software is dual-licensed to the public domain and under the following
 // license: you are granted a perpetual, irrevocable license to copy, modify,
 // publish, and distribute this file as you see fit.
@@ -13,11 +16,33 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <unordered_map>
+#include <algorithm>
+#include <numeric>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <string_view>
+#include <span>
+#include <cstring>
+#include <cstdint>
+#include <bit>
+#include <chrono>
+#include <memory_resource>
+#include <new>
+
+#include "XelaAsync.hpp"
+#include "XelaLines.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define _XELA_XML_SSE2
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
 
 #define _XELA_XML_START namespace Xela {  extern "C" {
 #define _XELA_XML_END } }
@@ -32,63 +57,735 @@ public:
 	xml_parse_error(const std::string &str) : runtime_error(str) {}
 	xml_parse_error(const char *str) : runtime_error(str) {}
 };
+class xml_write_error : public std::runtime_error {
+public:
+	xml_write_error(const std::string &str) : runtime_error(str) {}
+	xml_write_error(const char *str) : runtime_error(str) {}
+};
+class xml_query_error : public std::runtime_error {
+public:
+	xml_query_error(const std::string &str) : runtime_error(str) {}
+	xml_query_error(const char *str) : runtime_error(str) {}
+};
 
 _XELA_XML_START // C style structs and functions
 class Xml {
 public:
-	using AttrMap = std::unordered_map<std::string, std::string>;
-	using ChildMap = std::unordered_map<std::string, std::vector<Xml *>>;
+	struct Attribute {
+		std::string_view name;
+		std::string_view value;
+		// Id of name in the node's Names, or Names::npos when it has none
+		uint32_t id = UINT32_MAX;
+		// Set when name and value point into the buffer the element was parsed from
+		bool borrowed = false;
+	};
+
+	// Lets ChildMap be searched with any string type without copying it into a key first
+	struct NameHash {
+		using is_transparent = void;
+		size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+	};
+	struct NameEqual {
+		using is_transparent = void;
+		bool operator()(std::string_view a, std::string_view b) const { return a == b; }
+	};
+	// Children grouped by name, with comments and text under "", in document order within each name
+	using ChildMap = std::pmr::unordered_map<std::pmr::string, std::pmr::vector<Xml *>, NameHash, NameEqual>;
+
+	struct Location {
+		size_t line;
+		size_t col;
+	};
+
+	// What a parse did, filled in when passed through ParseOptions::stats and XELA_PARSE_STATS is defined.
+	// Each parse starts from zero.
+	class Stats {
+	public:
+		// Input bytes consumed
+		size_t bytes = 0;
+		// Nodes created, and the attributes they hold
+		size_t tags = 0;
+		size_t comments = 0;
+		size_t texts = 0;
+		size_t attributes = 0;
+		// Deepest node, with the root at 1
+		size_t maxDepth = 0;
+		// Allocations made for nodes, and their total size including the attributes and strings stored with them.
+		// Child indexes and interned names are not counted; parse into a counting memory resource to see them.
+		size_t allocations = 0;
+		size_t allocated = 0;
+		// Time spent reading the input, by fromFile and fromStream, and parsing it
+		std::chrono::nanoseconds read{};
+		std::chrono::nanoseconds parse{};
+
+		void clear();
+
+	private:
+		friend class Xml;
+
+		void record(const Xml *node, size_t depth);
+		void merge(const Stats &other);
+	};
+
+	// Byte offset of each node produced by a parse, kept beside the tree so nodes stay the same size.
+	// Recording is off unless one is passed through ParseOptions::locations.
+	class SourceMap {
+	public:
+		// Byte offset where node starts, or std::string::npos if it was not recorded
+		size_t offset(const Xml *node) const;
+		// Line and column where node starts, or { 0, 0 } if it was not recorded
+		Location locate(const Xml *node) const;
+
+		const std::string &source() const;
+		size_t size() const;
+		void clear();
+
+	private:
+		friend class Xml;
+
+		std::string text;
+
+		// Parallel arrays in the order nodes were parsed
+		std::vector<const Xml *> nodes;
+		std::vector<size_t> offsets;
+
+		// Positions in nodes sorted by address, built on the first lookup
+		mutable std::vector<size_t> sorted;
+
+		void record(const Xml *node, size_t offset);
+	};
+
+	// Tag and attribute names interned so each distinct name is stored once, with a dense id from 0. Nodes sharing
+	// a table compare names by id. It must outlive every node that uses it.
+	class Names {
+	public:
+		static constexpr uint32_t npos = UINT32_MAX;
+
+		Names();
+		// Names are stored in resource
+		Names(std::pmr::memory_resource *resource);
+		Names(const Names &) = delete;
+		Names &operator=(const Names &) = delete;
+		~Names();
+
+		// Id of name, adding it if it is new
+		uint32_t intern(std::string_view name);
+		// Id of name, or npos if it was never interned
+		uint32_t find(std::string_view name) const;
+		std::string_view name(uint32_t id) const;
+
+		size_t size() const;
+		void clear();
+
+	private:
+		std::pmr::memory_resource *resource;
+		std::pmr::unordered_map<std::string_view, uint32_t> ids;
+		std::pmr::vector<std::string_view> names;
+	};
+
+	// Elements found by the value of chosen attributes, such as id, without walking the tree. Elements join when a
+	// parse with ParseOptions::keys creates them or when they are added under an element already in the table, and
+	// leave when they are removed from it or deleted. Attribute edits are followed. It must outlive every node that
+	// uses it, and be cleared when a tree is dropped without being deleted, such as by Document::clear.
+	class Keys {
+	public:
+		// Names of the attributes to index
+		Keys(std::initializer_list<std::string_view> attributes);
+		// Entries are stored in resource
+		Keys(std::initializer_list<std::string_view> attributes, std::pmr::memory_resource *resource);
+		Keys(const Keys &) = delete;
+		Keys &operator=(const Keys &) = delete;
+
+		// An element whose attribute has value, or nullptr. Attributes that are not indexed find nothing.
+		Xml *find(std::string_view attribute, std::string_view value) const;
+		// Every element whose attribute has value, in no particular order
+		std::vector<Xml *> findAll(std::string_view attribute, std::string_view value) const;
+
+		// Entries, one for each indexed attribute an element holds
+		size_t size() const;
+		void clear();
+
+	private:
+		friend class Xml;
+
+		// One table per attribute, probed linearly so entries take no allocation of their own. Slots hold only the
+		// hash of the value, which is read back from the element on a match to keep the table small. Elements
+		// sharing a value sit in the same run of slots, so many of them make lookups and removals slower.
+		struct Slot {
+			// nullptr for an empty slot
+			Xml *node = nullptr;
+			size_t hash = 0;
+		};
+		struct Table {
+			std::string name;
+			std::pmr::vector<Slot> slots;
+			size_t used = 0;
+		};
+
+		std::pmr::memory_resource *resource;
+		std::vector<Table> tables;
+
+		// Entries for one attribute of node, or for every indexed one it holds
+		void insert(Xml *node, const Xml::Attribute &attr);
+		void erase(Xml *node, const Xml::Attribute &attr);
+		void insert(Xml *node);
+		void erase(Xml *node);
+		Table *table(std::string_view attribute);
+		const Table *table(std::string_view attribute) const;
+	};
+
+	struct ParseOptions {
+		// Tags nested deeper than this fail with an xml_parse_error
+		size_t maxDepth = 1024;
+		// When set, receives the offset of every parsed tag and comment
+		SourceMap *locations = nullptr;
+		// When set, nodes and their attribute arrays, strings and child indexes are allocated from it instead of the
+		// global heap
+		std::pmr::memory_resource *resource = nullptr;
+		// When set, tag and attribute names are interned into it instead of being copied into every node
+		Names *names = nullptr;
+		// When set, every element is entered in it as it is created, and the tree keeps it up to date
+		Keys *keys = nullptr;
+		// When set, receives counts and timings for the parse
+		Stats *stats = nullptr;
+		// Values above 1 split the root element's children into this many runs parsed on pool. resource must then be
+		// thread safe; without one, each run allocates from an Arena of its own, freed once the last of its nodes is.
+		// Names are interned into a table per run and moved into names once all of them are done.
+		size_t threads = 1;
+		// Runs the parallel parse, or ThreadPool::shared() when not set
+		ThreadPool *pool = nullptr;
+		// Text made only of whitespace, such as indentation, is dropped unless set. CDATA is always kept.
+		bool keepWhitespace = false;
+		// When set, names, attribute values, comments and text point into the buffer instead of being copied, so the
+		// buffer has to outlive the tree. Only fromBuffer, fromString, Document and a Reader over a string_view
+		// honour it; the rest parse from a buffer of their own.
+		bool borrow = false;
+	};
+
+	// A tree parsed into an arena the document owns, with its names interned in a table kept in the same arena.
+	// Everything is released at once when the document is cleared or destroyed, without visiting the nodes, so
+	// nodes added to the tree must come from create() or a parse into this document.
+	class Document {
+	public:
+		Document();
+		// Bytes to set aside for the arena's first block
+		Document(size_t initialSize);
+		Document(const Document &) = delete;
+		Document &operator=(const Document &) = delete;
+
+		// Replaces whatever the document held. Memory resources and name tables in options are ignored.
+		Xml *parse(std::string_view buffer);
+		Xml *parse(std::string_view buffer, const ParseOptions &options);
+		// Reads the file into the document and parses it there, so the tree borrows from the document's own copy
+		Xml *parseFile(const std::filesystem::path &file);
+		Xml *parseFile(const std::filesystem::path &file, const ParseOptions &options);
+		// A new empty node in the document, for building trees by hand
+		Xml *create();
+
+		Xml *getRoot();
+		Names &getNames();
+		std::pmr::memory_resource *getResource();
+		void clear();
+
+	private:
+		std::pmr::monotonic_buffer_resource arena;
+		Names names;
+		Xml *root = nullptr;
+		std::string source;
+		// One for each thread of a parallel parse, since the main arena cannot be shared
+		std::deque<std::pmr::monotonic_buffer_resource> runArenas;
+	};
 
 private:
-	bool comment = false;
-	std::string type = "";
-	AttrMap attributes{};
-	ChildMap children{};
-
-	static void consumeWhitespace(std::istream &in, size_t &line, size_t &col);
-	static char getEscapeCharacter(std::istream &in, size_t &line, size_t &col);
-
-	static std::string parseString(std::istream &in, size_t &line, size_t &col);
-	static std::string parseIdentifier(std::istream &in, size_t &line, size_t &col);
-
-	static void parseAttribute(std::istream &in, size_t &line, size_t &col, std::pair<std::string, std::string> &out_attr);
-	static std::string parseTagName(std::istream &in, size_t &line, size_t &col);
-
-	static std::string parseTagData(std::istream &in, size_t &line, size_t &col, AttrMap &attributes);
-
-	static Xml *parseTag(std::istream &in, size_t &line, size_t &col);
-	static Xml *parseComment(std::istream &in, size_t &line, size_t &col);
+	// Decoded copies of strings that held entities. Copies stay put as more are added, and their capacity is
+	// reused after a reset.
+	struct Scratch {
+		std::deque<std::string> strings;
+		size_t used = 0;
+
+		std::string &next() {
+			if (used == strings.size()) {
+				strings.emplace_back();
+			}
+			std::string &ret = strings[used++];
+			ret.clear();
+			return ret;
+		}
+		void reset() {
+			used = 0;
+		}
+	};
+
+	// Read position within the buffer being parsed. Mirrors the parts of std::istream the parser uses.
+	// Only the byte offset is tracked; line and column are computed by locate() when an error is built.
+	struct Cursor {
+		const char *begin;
+		const char *curr;
+		const char *end;
+		// Where new nodes are allocated, or nullptr for new
+		std::pmr::memory_resource *resource = nullptr;
+		// Where names are interned, or nullptr to copy them
+		Names *names = nullptr;
+		// What nodes may point into rather than copy from: the whole buffer, or nothing
+		std::string_view source;
+		// Set when end is a cut within the document rather than its end, so text may run up to it
+		bool partial = false;
+		// Strings decoded while reading the current tag or text
+		Scratch decoded;
+
+		int peek() const {
+			return curr < end ? (unsigned char)*curr : EOF;
+		}
+		int get() {
+			const char *c = curr++;
+			return c < end ? (unsigned char)*c : EOF;
+		}
+		void ignore() {
+			curr++;
+		}
+		void unget() {
+			curr--;
+		}
+		bool eof() const {
+			return curr >= end;
+		}
 
-	static Xml *parseXml(std::istream &in, size_t &line, size_t &col);
+		size_t offset() const {
+			return (curr < end ? curr : end) - begin;
+		}
+		std::string where() const {
+			// Errors are reported at the last character read
+			size_t last = offset();
+			Location loc = locate(std::string_view(begin, end - begin), last > 0 ? last - 1 : 0);
+			return std::to_string(loc.line) + ", " + std::to_string(loc.col);
+		}
+	};
 
-	static void writeXml(Xml *xml, std::ostream &out, size_t indent, bool prett);
+	bool comment = false;
+	bool text = false;
+	// Set when type points into the buffer the node was parsed from
+	bool borrowed = false;
+	uint32_t typeId = Names::npos;
+	// Tag name, comment or character data. An interned name belongs to names, a borrowed one to the buffer, and
+	// anything else to the node.
+	std::string_view type;
+
+	// Attribute names are interned like the type. Values belong to the node unless borrowed.
+	uint32_t attributeCount = 0;
+	uint32_t attributeCapacity = 0;
+	Attribute *attributes = nullptr;
+
+	// Bytes allocated just past the node for what it held when parsed, so a parsed node is one allocation.
+	// Anything stored there is not freed on its own.
+	uint32_t extra = 0;
+
+	// Children in document order, linked through their siblings so adding and removing one never allocates
+	Xml *parent = nullptr;
+	Xml *firstChild = nullptr;
+	Xml *lastChild = nullptr;
+	Xml *prevSibling = nullptr;
+	Xml *nextSibling = nullptr;
+	size_t childCount = 0;
+	// Built by getChildren(), then kept up to date by addChild and removeChild until a child is renamed
+	ChildMap *index = nullptr;
+
+	// Holds this node and everything it owns, or nullptr if the node was made with new
+	std::pmr::memory_resource *resource = nullptr;
+	// Where names are interned, or nullptr if they are copied
+	Names *names = nullptr;
+	// Where this node's attributes are indexed, or nullptr. Shared by the whole tree.
+	Keys *keys = nullptr;
+
+	Xml(std::pmr::memory_resource *resource);
+	static Xml *create(std::pmr::memory_resource *resource, Names *names, size_t extra);
+	// Strings lying inside source are borrowed rather than copied
+	static Xml *createTag(std::pmr::memory_resource *resource, Names *names, std::string_view source, std::string_view type, std::span<const Attribute> attributes);
+	static Xml *createText(std::pmr::memory_resource *resource, Names *names, std::string_view source, std::string_view text);
+	static Xml *createComment(std::pmr::memory_resource *resource, Names *names, std::string_view source, std::string_view text);
+	static bool within(std::string_view source, std::string_view str);
+
+	void dropIndex();
+	// Moves this node and everything beneath it from the table they are in to table, which may be nullptr
+	void setKeys(Keys *table);
+
+	// Strings owned by the node come from its resource, or the heap without one
+	std::pmr::memory_resource *memory() const;
+	bool isExtra(const void *ptr) const;
+	std::string_view copy(std::string_view str);
+	void release(std::string_view str);
+	void reserveAttributes(size_t count);
+
+	static bool isWhitespace(char c);
+	static bool isIdentifier(char c);
+	static const char *skipWhitespace(const char *curr, const char *end);
+	// Start of the next '-->', or nullptr if there is none
+	static const char *findComment(const char *curr, const char *end);
+	// Start of the next ']]>', or nullptr if there is none
+	static const char *findCData(const char *curr, const char *end);
+	// Start of the next '?>', or nullptr if there is none
+	static const char *findInstruction(const char *curr, const char *end);
+	// First a or b, or end if there is neither
+	static const char *findEither(const char *curr, const char *end, char a, char b);
+	static unsigned countTrailingZeros(unsigned mask);
+
+	// Appends the entity starting at the '&' at curr to out. Returns the position after its ';', or nullptr if it
+	// is not a predefined or character entity.
+	static const char *decodeEntity(const char *curr, const char *end, std::string &out);
+	// Appends raw to out with every entity decoded. Returns the '&' of the first one that is not valid, or nullptr.
+	static const char *decodeEntities(std::string_view raw, std::string &out);
+	static bool appendUtf8(uint32_t code, std::string &out);
+
+	static void consumeWhitespace(Cursor &in);
+	static char getEscapeCharacter(Cursor &in);
+
+	// Tokens are views into the buffer, copied only when they are stored in a node
+	static std::string_view parseString(Cursor &in);
+	static std::string_view scanIdentifier(Cursor &in);
+
+	static bool parseAttribute(Cursor &in, Attribute &out_attr);
+	static std::string_view parseTagName(Cursor &in);
+
+	static std::string_view parseTagData(Cursor &in, std::vector<Attribute> &attributes);
+
+	static Xml *parseTag(Cursor &in, bool &open, std::vector<Attribute> &attributes);
+	static Xml *parseComment(Cursor &in);
+	static Xml *parseCData(Cursor &in);
+	// Character data up to the next '<', or nullptr for a run of whitespace that is dropped
+	static Xml *parseText(Cursor &in, bool keepWhitespace);
+
+	static Xml *parseXml(Cursor &in, const ParseOptions &options);
+	// Reads nodes into parent, which stands in for every tag open above them, until the input runs out
+	static Xml *parseXml(Cursor &in, const ParseOptions &options, Xml *parent);
+
+	// Finds where the root element's children can be cut into about count runs of similar size, past the root's start
+	// tag at in, and the '<' of its closing tag. Comments, CDATA and quoted attribute values are skipped whole.
+	// Returns false if the element never closes, so the sequential parser can report the error.
+	static bool splitChildren(Cursor in, size_t count, std::vector<const char *> &cuts, const char *&close);
+	// Returns nullptr when the document is better parsed sequentially. Each run allocates from a new arena in
+	// arenas when it is given, from options.resource otherwise, and from an Arena of its own without either.
+	static Xml *parseParallel(Cursor &in, const ParseOptions &options, std::deque<std::pmr::monotonic_buffer_resource> *arenas);
+	static Xml *fromBuffer(std::string_view buffer, const ParseOptions &options, std::deque<std::pmr::monotonic_buffer_resource> *arenas);
+
+	// First character of a value that has to be escaped, or end. Attribute values also escape '"'.
+	static const char *findEscape(const char *curr, const char *end, bool attribute);
 
 public:
 	Xml();
+	Xml(const Xml &) = delete;
+	Xml &operator=(const Xml &) = delete;
+	// A node still attached to a parent removes itself first
 	~Xml();
 
+	// Nodes parsed into a memory resource are returned to it, so every node is deleted the same way
+	void operator delete(Xml *xml, std::destroying_delete_t);
+
 	static Xml *fromStream(std::istream &in);
+	static Xml *fromStream(std::istream &in, const ParseOptions &options);
 	static Xml *fromFile(std::filesystem::path file);
+	static Xml *fromFile(std::filesystem::path file, const ParseOptions &options);
 	static Xml *fromString(std::string &str);
+	static Xml *fromString(std::string &str, const ParseOptions &options);
+	// Parses straight from memory the caller owns, which only has to stay alive for the call.
+	// fromString, fromStream and fromFile all end up here.
+	static Xml *fromBuffer(std::string_view buffer);
+	static Xml *fromBuffer(std::string_view buffer, const ParseOptions &options);
+
+	using LoadCallback = std::function<void(Xml *xml, std::exception_ptr error)>;
+
+	// Result of fromFileAsync. The tree belongs to whoever takes it with get() or co_await.
+	class Loading : public Pending {
+	public:
+		Xml *get();
+		Xml *await_resume();
+
+	private:
+		friend class Xml;
+
+		Loading();
+	};
+
+	// Reads the file on an IoBackend and parses it on a ThreadPool, the shared ones unless others are given.
+	// Anything options points to must outlive the load. done is called on a pool thread.
+	static Loading fromFileAsync(std::filesystem::path file);
+	static Loading fromFileAsync(std::filesystem::path file, const ParseOptions &options);
+	static Loading fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool);
+	static void fromFileAsync(std::filesystem::path file, const ParseOptions &options, LoadCallback done);
+	static void fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool, LoadCallback done);
+
+	// One file of a batch: its tree, or why it failed
+	struct Loaded {
+		std::filesystem::path file;
+		Xml *xml = nullptr;
+		std::exception_ptr error;
+	};
+
+	// Reads and parses every file on a ThreadPool, the shared one unless another is given. Results are in the same
+	// order as files, and a failed file does not stop the rest. Each tree belongs to the caller. Source maps, name
+	// tables, key tables and stats are ignored, since they cannot be shared between files. The trees outlive the
+	// batch, so rather than a worker reusing one arena for its files, each file is parsed into an Arena of its own
+	// that its tree frees, in place of any memory resource given.
+	static std::vector<Loaded> fromFiles(const std::vector<std::filesystem::path> &files);
+	static std::vector<Loaded> fromFiles(const std::vector<std::filesystem::path> &files, const ParseOptions &options, ThreadPool &pool);
+	// Every file beneath directory whose name matches pattern, as found by Batch::find
+	static std::vector<Loaded> fromDirectory(const std::filesystem::path &directory, std::string_view pattern);
+
+	// Reads a document one event at a time from a buffer that is refilled as it empties, so memory is bounded by the
+	// largest single tag, comment or run of text rather than by the document. Views handed out stay valid until the
+	// next call to next(), skip() or subtree(). A self closing tag gives a StartElement and then an EndElement.
+	// Errors are xml_parse_errors located by byte offset, since lines are not counted.
+	class Reader {
+	public:
+		// Fills data with up to size bytes and returns how many were written, or 0 once the input is exhausted
+		using Source = std::function<size_t(char *data, size_t size)>;
+
+		enum class Event {
+			StartElement,
+			EndElement,
+			Comment,
+			// Character data between tags, or a CDATA section, with entities decoded. Runs of only whitespace are
+			// skipped unless options.keepWhitespace is set.
+			Text,
+			// Nothing is left to read
+			End
+		};
+
+		// Attribute ids are always Names::npos, since nothing is interned while reading
+		using Attribute = Xml::Attribute;
+
+		// Nesting deeper than options.maxDepth throws, and subtree() builds with options.resource and options.names.
+		// Source maps and stats are not filled in.
+		Reader(std::istream &in);
+		Reader(std::istream &in, const ParseOptions &options, size_t chunkSize);
+		Reader(Source source);
+		Reader(Source source, const ParseOptions &options, size_t chunkSize);
+		// Reads memory the caller keeps alive, without copying it
+		Reader(std::string_view buffer);
+		Reader(std::string_view buffer, const ParseOptions &options);
+		Reader(const Reader &) = delete;
+		Reader &operator=(const Reader &) = delete;
+
+		Event next();
+		// The last event next() returned, or End before the first call
+		Event event() const;
+
+		// Element name of a StartElement or EndElement
+		std::string_view name() const;
+		// Contents of a Comment or Text
+		std::string_view text() const;
+		// Attributes of a StartElement in document order
+		const std::vector<Attribute> &attributes() const;
+		// The named attribute of a StartElement, or nullptr
+		const Attribute *findAttribute(std::string_view name) const;
+
+		// Elements open at the current event, including the one a StartElement or EndElement belongs to
+		size_t depth() const;
+		// Byte offset in the input where the current event starts
+		size_t offset() const;
+
+		// Builds the element a StartElement opened, with everything beneath it, and reads through its end tag so
+		// the current event becomes that element's EndElement. The tree belongs to the caller.
+		Xml *subtree();
+		// Reads through the end tag of the element a StartElement opened without building anything
+		void skip();
+
+	private:
+		Source source;
+		ParseOptions options;
+
+		// Unread input is base[head, tail). base is storage unless reading memory the caller owns.
+		std::string storage;
+		const char *base = nullptr;
+		size_t head = 0;
+		size_t tail = 0;
+		// Bytes dropped from the front of storage so far
+		size_t dropped = 0;
+		bool exhausted = false;
+
+		Event current = Event::End;
+		size_t start = 0;
+		std::string_view currentName;
+		std::string_view currentText;
+		std::vector<Attribute> currentAttributes;
+		// Text and attribute values that held entities, decoded
+		Scratch decoded;
+
+		// Names of the open elements, outermost first. Only the first level are in use; the rest keep their
+		// capacity so deep documents do not allocate on every tag.
+		std::vector<std::string> open;
+		size_t level = 0;
+		// Set by a self closing tag so the next call gives its EndElement
+		bool closing = false;
+
+		// Moves the unread input to the front of storage, growing it only when full, and reads more.
+		// Returns false once the source is exhausted. Views into the buffer are invalidated.
+		bool fill();
+		bool ensure(size_t count);
+		// Position of the '>' ending the tag at curr, skipping quoted values, or nullptr if it is not buffered yet
+		static const char *findTagEnd(const char *curr, const char *end);
+
+		Event parseTag(const char *curr, const char *end);
+		[[noreturn]] void fail(const std::string &message) const;
+	};
+
+	// Produces Xml text directly from a sequence of calls, without building a tree. The text matches what write()
+	// gives for the same nodes. It is buffered and handed to the sink whenever about chunkSize bytes are waiting;
+	// without a sink it collects in str(). Pretty output puts each element and comment on its own line, indented
+	// with tabs, except inside an element holding text, where added whitespace would change the text. Calls that
+	// break nesting throw an xml_write_error in debug builds.
+	class Writer {
+	public:
+		using Sink = std::function<void(const char *data, size_t size)>;
+
+		Writer(bool pretty = false);
+		Writer(std::ostream &out, bool pretty = false, size_t chunkSize = 1 << 16);
+		Writer(Sink sink, bool pretty = false, size_t chunkSize = 1 << 16);
+		Writer(const Writer &) = delete;
+		Writer &operator=(const Writer &) = delete;
+		~Writer();
+
+		Writer &beginElement(std::string_view name);
+		// Only between beginElement and the element's first content
+		Writer &attribute(std::string_view name, std::string_view value);
+		// Elements with no content are closed with '/>'
+		Writer &endElement();
+		Writer &text(std::string_view str);
+		Writer &comment(std::string_view str);
+		// Writes an existing node and everything beneath it
+		Writer &value(const Xml &xml);
+
+		// Hands everything buffered to the sink. The destructor flushes too, but drops any error the sink throws.
+		void flush();
+		// Text that has not been handed to a sink
+		const std::string &str() const;
+
+	private:
+		struct Level {
+			// Where the element's name starts in names
+			size_t name;
+			// Set once the element holds text, and inherited by everything inside it
+			bool verbatim;
+		};
+
+		std::string buffer;
+		Sink sink;
+		bool pretty;
+		size_t chunkSize;
+		std::vector<Level> levels;
+		// Names of the open elements, end to end
+		std::string names;
+		// Set between beginElement and the '>' ending its start tag
+		bool inTag = false;
+		bool started = false;
+		bool done = false;
+
+		Writer &beginElement(std::string_view name, bool verbatim);
+		void beginNode(bool text);
+		void endNode();
+		void escape(std::string_view str, bool attribute);
+		void writeTab(size_t indent);
+		void fail(const char *message);
+	};
+
+	// A compiled subset of XPath: steps separated by '/' or '//', each an element name or '*' with any number of
+	// predicates on attributes ([@id], [@id="x"], [@id!='x']) or position among the parent's candidates ([2]).
+	// Malformed paths throw an xml_query_error. A path is compiled once and then run on trees or on a Reader.
+	class Query {
+	public:
+		static Query compile(std::string_view path);
+
+		// Matching elements in document order. A path starting with '/' runs from the root of context's tree, and
+		// any other from context itself.
+		std::vector<Xml *> select(Xml *context) const;
+		// The first match in document order, or nullptr. Nothing after it is visited.
+		Xml *first(Xml *context) const;
+		// Reads the rest of a document, building only the elements that match and handing each to match, which
+		// then owns it. Elements no step can reach are skipped without being built. The descendants of a match
+		// arrive inside its tree and are not matched again. Every path runs from the document, as if it started
+		// with '/'.
+		void select(Reader &reader, const std::function<void(Xml *match)> &match) const;
+
+	private:
+		struct Predicate {
+			enum class Kind {
+				Exists,
+				Equals,
+				NotEquals,
+				Position
+			};
+
+			Kind kind;
+			std::string name;
+			std::string value;
+			size_t position = 0;
+			// Counter used by a Position predicate
+			size_t slot = 0;
+		};
+		struct Step {
+			bool descendant = false;
+			// Empty for '*'
+			std::string name;
+			std::vector<Predicate> predicates;
+		};
+
+		std::vector<Step> steps;
+		bool absolute = false;
+		// Counters each parent needs, one per Position predicate
+		size_t positions = 0;
+
+		// Tests an element whose parent still has the steps in active to match, counting it in the parent's
+		// counters. Sets the steps its children carry on with in next and returns whether the whole path ends at it.
+		bool test(std::string_view name, std::span<const Attribute> attributes, uint64_t active, size_t *counters, uint64_t &next) const;
+		// Matches chain and its following siblings, and beneath them, against the path from its first step
+		void run(Xml *chain, std::vector<Xml *> &out, bool one) const;
+		[[noreturn]] static void fail(std::string_view path, size_t offset, const std::string &message);
+	};
+
+	// Line and column of the character at a byte offset within source. Both start at 1.
+	static Location locate(std::string_view source, size_t offset);
 
 	void write(bool pretty = false, std::ostream &out = std::cout);
+	void writeFile(const std::filesystem::path &file, bool pretty = false);
 
 	bool &isComment();
 	void setComment(bool val);
 
-	std::string &getType();
-	void setType(std::string str);
-
-	std::string &getComment();
-	void setComment(std::string str);
-
-	AttrMap &getAttributes();
-	void addAttribute(std::string key, std::string value);
-	void removeAttribute(std::string key);
-	AttrMap::iterator findAttribute(std::string key);
-
-	ChildMap &getChildren();
+	std::string_view getType();
+	// Id of the type in getNames(), or Names::npos
+	uint32_t getTypeId();
+	void setType(std::string_view str);
+
+	std::string_view getComment();
+	void setComment(std::string_view str);
+
+	// Character data, with entities decoded. A text node has no name, attributes or children.
+	bool isText();
+	std::string_view getText();
+	void setText(std::string_view str);
+
+	// Table names are interned into, or nullptr
+	Names *getNames();
+
+	// Attributes in the order they were added
+	std::span<const Attribute> getAttributes();
+	// Does nothing if key is already present
+	void addAttribute(std::string_view key, std::string_view value);
+	void removeAttribute(std::string_view key);
+	// The attribute named key, or nullptr
+	const Attribute *findAttribute(std::string_view key);
+
+	Xml *getParent();
+	Xml *getFirstChild();
+	Xml *getLastChild();
+	Xml *getNextSibling();
+	Xml *getPrevSibling();
+	size_t getChildCount();
+
+	// Looking up children by name builds an index on first use. Iterating the sibling links is cheaper when every
+	// child is visited anyway.
+	const ChildMap &getChildren();
+	// Appends child after the last child, taking it from its old parent if it has one. The tree then owns it.
 	void addChild(Xml *child);
+	// Detaches child, which then belongs to the caller
 	void removeChild(Xml *child);
 };
 _XELA_XML_END
@@ -98,23 +795,129 @@ _XELA_XML_END
 // #define XELA_XML_IMPLEMENTATION
 #ifdef XELA_XML_IMPLEMENTATION
 
-#define XML_ERR(line, col) std::string("Xml [" + std::to_string(line) + ", " + std::to_string(col) + "]: ") +
+#define XML_ERR(in) std::string("Xml [" + in.where() + "]: ") +
+
+#ifdef XELA_PARSE_STATS
+#define XML_STATS(stmt) if (options.stats != nullptr) { stmt; }
+#else
+#define XML_STATS(stmt)
+#endif
 
 _XELA_XML_START //C style structs and functions
 
-void Xml::consumeWhitespace(std::istream &in, size_t &line, size_t &col) {
-	while (std::isspace(in.peek())) {
-		char c = in.get();
-		col++;
-		if (c == '\n') {
-			line++;
-			col = 0;
+// Lexing
+// Scanners work on raw pointers and stop at the end of the buffer, so the bulk of the input is never read a byte at a time
+bool Xml::isWhitespace(char c) {
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+bool Xml::isIdentifier(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+const char *Xml::skipWhitespace(const char *curr, const char *end) {
+	// Most runs are a newline and a little indentation, so the first bytes are checked before going wide
+	for (size_t i = 0; i < 4; i++, curr++) {
+		if (curr >= end || !isWhitespace(*curr)) {
+			return curr;
+		}
+	}
+
+#ifdef _XELA_XML_SSE2
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i carriage = _mm_set1_epi8('\r');
+	while (end - curr >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)curr);
+		__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, carriage)));
+		unsigned mask = ~(unsigned)_mm_movemask_epi8(ws) & 0xFFFF;
+		if (mask != 0) {
+			// Vertical tab and form feed are not in the vector test, so the scalar loop finishes the run
+			curr += countTrailingZeros(mask);
+			break;
+		}
+		curr += 16;
+	}
+#endif
+	while (curr < end && isWhitespace(*curr)) {
+		curr++;
+	}
+	return curr;
+}
+const char *Xml::findComment(const char *curr, const char *end) {
+	// Each '-' is a candidate for the start of '-->'
+	while (end - curr >= 3) {
+		curr = (const char *)std::memchr(curr, '-', end - curr - 2);
+		if (curr == nullptr) {
+			return nullptr;
+		}
+		if (curr[1] == '-' && curr[2] == '>') {
+			return curr;
+		}
+		curr++;
+	}
+	return nullptr;
+}
+const char *Xml::findCData(const char *curr, const char *end) {
+	while (end - curr >= 3) {
+		curr = (const char *)std::memchr(curr, ']', end - curr - 2);
+		if (curr == nullptr) {
+			return nullptr;
+		}
+		if (curr[1] == ']' && curr[2] == '>') {
+			return curr;
+		}
+		curr++;
+	}
+	return nullptr;
+}
+const char *Xml::findInstruction(const char *curr, const char *end) {
+	while (end - curr >= 2) {
+		curr = (const char *)std::memchr(curr, '?', end - curr - 1);
+		if (curr == nullptr) {
+			return nullptr;
+		}
+		if (curr[1] == '>') {
+			return curr;
+		}
+		curr++;
+	}
+	return nullptr;
+}
+const char *Xml::findEither(const char *curr, const char *end, char a, char b) {
+#ifdef _XELA_XML_SSE2
+	const __m128i first = _mm_set1_epi8(a);
+	const __m128i second = _mm_set1_epi8(b);
+	while (end - curr >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)curr);
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, first), _mm_cmpeq_epi8(chunk, second)));
+		if (mask != 0) {
+			return curr + countTrailingZeros(mask);
 		}
+		curr += 16;
+	}
+#endif
+	while (curr < end && *curr != a && *curr != b) {
+		curr++;
 	}
+	return curr;
 }
-char Xml::getEscapeCharacter(std::istream &in, size_t &line, size_t &col) {
+unsigned Xml::countTrailingZeros(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return (unsigned)idx;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+void Xml::consumeWhitespace(Cursor &in) {
+	in.curr = skipWhitespace(in.curr, in.end);
+}
+char Xml::getEscapeCharacter(Cursor &in) {
 	char c = in.get();
-	col++;
 
 	switch (c) {
 	case '\'':
@@ -153,365 +956,2612 @@ char Xml::getEscapeCharacter(std::istream &in, size_t &line, size_t &col) {
 	case '0':
 		return '\0';
 	default:
-		throw xml_parse_error(XML_ERR(line, col) "Unrecognized escape sequence : \"\\" + c + "\"");
+		throw xml_parse_error(XML_ERR(in) "Unrecognized escape sequence : \"\\" + c + "\"");
 		break;
 	}
 
 	return '\0';
 }
 
-std::string Xml::parseString(std::istream &in, size_t &line, size_t &col) {
+// Entities
+const char *Xml::decodeEntity(const char *curr, const char *end, std::string &out) {
+	// '&' name ';' | '&#' digit+ ';' | '&#x' hexdigit+ ';'
+	// Nothing valid is longer than a character reference with a few leading zeros
+	const char *semi = (const char *)std::memchr(curr, ';', std::min<ptrdiff_t>(end - curr, 16));
+	if (semi == nullptr) {
+		return nullptr;
+	}
+
+	std::string_view name(curr + 1, semi - curr - 1);
+	if (name.size() > 1 && name[0] == '#') {
+		bool hex = name[1] == 'x';
+		std::string_view digits = name.substr(hex ? 2 : 1);
+		if (digits.empty()) {
+			return nullptr;
+		}
+
+		uint32_t code = 0;
+		for (char c : digits) {
+			uint32_t digit;
+			if (c >= '0' && c <= '9') {
+				digit = c - '0';
+			}
+			else if (hex && c >= 'a' && c <= 'f') {
+				digit = c - 'a' + 10;
+			}
+			else if (hex && c >= 'A' && c <= 'F') {
+				digit = c - 'A' + 10;
+			}
+			else {
+				return nullptr;
+			}
+
+			code = code * (hex ? 16 : 10) + digit;
+			if (code > 0x10FFFF) {
+				return nullptr;
+			}
+		}
+
+		return appendUtf8(code, out) ? semi + 1 : nullptr;
+	}
+
+	if (name == "lt") {
+		out += '<';
+	}
+	else if (name == "gt") {
+		out += '>';
+	}
+	else if (name == "amp") {
+		out += '&';
+	}
+	else if (name == "quot") {
+		out += '"';
+	}
+	else if (name == "apos") {
+		out += '\'';
+	}
+	else {
+		return nullptr;
+	}
+	return semi + 1;
+}
+const char *Xml::decodeEntities(std::string_view raw, std::string &out) {
+	// Runs between entities are appended whole
+	const char *curr = raw.data();
+	const char *end = curr + raw.size();
+	while (true) {
+		const char *amp = (const char *)std::memchr(curr, '&', end - curr);
+		if (amp == nullptr) {
+			out.append(curr, end - curr);
+			return nullptr;
+		}
+
+		out.append(curr, amp - curr);
+		curr = decodeEntity(amp, end, out);
+		if (curr == nullptr) {
+			return amp;
+		}
+	}
+}
+bool Xml::appendUtf8(uint32_t code, std::string &out) {
+	// Null and surrogates are not characters
+	if (code == 0 || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF) {
+		return false;
+	}
+
+	if (code < 0x80) {
+		out += (char)code;
+	}
+	else if (code < 0x800) {
+		out += (char)(0xC0 | (code >> 6));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000) {
+		out += (char)(0xE0 | (code >> 12));
+		out += (char)(0x80 | ((code >> 6) & 0x3F));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	else {
+		out += (char)(0xF0 | (code >> 18));
+		out += (char)(0x80 | ((code >> 12) & 0x3F));
+		out += (char)(0x80 | ((code >> 6) & 0x3F));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	return true;
+}
+
+std::string_view Xml::parseString(Cursor &in) {
 	// '"' CHAR* '""
-	
-	std::string result = "";
 
 	char c = in.get();
-	col++;
 	if (c != '"') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected token while parsing string: " + c + ". Expected '\"'");
+		throw xml_parse_error(XML_ERR(in) "Unexpected token while parsing string: " + c + ". Expected '\"'");
 	}
 
-	for (c = in.get(); c != '\"'; c = in.get()) {
-		result += c;
-		if (in.eof()) {
-			throw xml_parse_error(XML_ERR(line, col) "Unexpected end of file while parsing string");
-		}
+	// Values without entities, the usual case, are left in the buffer
+	const char *start = in.curr;
+	const char *stop = findEither(start, in.end, '"', '&');
+	const char *close = stop < in.end && *stop == '"' ? stop : (const char *)std::memchr(stop, '"', in.end - stop);
+	if (close == nullptr) {
+		in.curr = in.end;
+		throw xml_parse_error(XML_ERR(in) "Unexpected end of file while parsing string");
 	}
 
-	return result;
+	in.curr = close + 1;
+	if (stop == close) {
+		return std::string_view(start, close - start);
+	}
+
+	std::string &decoded = in.decoded.next();
+	decoded.assign(start, stop - start);
+	const char *invalid = decodeEntities(std::string_view(stop, close - stop), decoded);
+	if (invalid != nullptr) {
+		in.curr = invalid + 1;
+		throw xml_parse_error(XML_ERR(in) "Invalid entity while parsing string");
+	}
+	return decoded;
 }
-std::string Xml::parseIdentifier(std::istream &in, size_t &line, size_t &col) {
+std::string_view Xml::scanIdentifier(Cursor &in) {
 	// ([a-z] | [A-Z] | [0-9] | '_')*
 
-	std::string ident = "";
-	
-	while (true) {
-		char c = in.get();
-		col++;
+	const char *start = in.curr;
+	const char *curr = start;
+	while (curr < in.end && isIdentifier(*curr)) {
+		curr++;
+	}
+	in.curr = curr;
 
-		if (std::isspace(c) || c == '<' || c == '>' || c == '/' || c == '=') {
-			in.unget();
-			col--;
-			return ident;
-		}
-		
-		if ((c >= 'a' && c <= 'z')
-			|| (c >= 'A' && c <= 'Z')
-			|| (c >= '0' && c <= '9')
-			|| c == '_') {
-			ident += c;
-		}
-		else {
-			throw xml_parse_error(XML_ERR(line, col) "Unexpected token while parsing identifier: " + c);
-		}
+	// Error check
+	if (in.eof()) {
+		in.ignore();
+		throw xml_parse_error(XML_ERR(in) "Unexpected end of file while parsing identifier");
+	}
 
-		// Error check
-		if (in.eof()) {
-			throw xml_parse_error(XML_ERR(line, col) "Unexpected end of file while parsing identifier");
-		}
+	char c = *curr;
+	if (!isWhitespace(c) && c != '<' && c != '>' && c != '/' && c != '=') {
+		in.ignore();
+		throw xml_parse_error(XML_ERR(in) "Unexpected token while parsing identifier: " + c);
 	}
-}
 
-void Xml::parseAttribute(std::istream &in, size_t &line, size_t &col, std::pair<std::string, std::string> &out_attr) {
+	return std::string_view(start, curr - start);
+}
+bool Xml::parseAttribute(Cursor &in, Attribute &out_attr) {
 	// ident WS '=' WS string WS
+	// Returns false, leaving out_attr alone, when there is no attribute left in the tag
 
-	std::string key = parseIdentifier(in, line, col);
-	if (key == "") {
-		return;
+	std::string_view key = scanIdentifier(in);
+	if (key.empty()) {
+		return false;
 	}
 
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
 
 	char c = in.get();
-	col++;
 	if (c != '=') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected token while parsing attribute: " + c + ". Expected '='");
+		throw xml_parse_error(XML_ERR(in) "Unexpected token while parsing attribute: " + c + ". Expected '='");
 	}
 
-	std::string val = parseString(in, line, col);
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
+	out_attr.name = key;
+	out_attr.value = parseString(in);
+	consumeWhitespace(in);
 
-	out_attr.first = key;
-	out_attr.second = val;
+	return true;
 }
-std::string Xml::parseTagName(std::istream &in, size_t &line, size_t &col) {
+std::string_view Xml::parseTagName(Cursor &in) {
 	// WS ident WS
 
-	consumeWhitespace(in, line, col);
-	std::string name = parseIdentifier(in, line, col);
-	consumeWhitespace(in, line, col);
+	consumeWhitespace(in);
+	std::string_view name = scanIdentifier(in);
+	consumeWhitespace(in);
 
 	return name;
 }
 
-std::string Xml::parseTagData(std::istream &in, size_t &line, size_t &col, AttrMap &attributes) {
+std::string_view Xml::parseTagData(Cursor &in, std::vector<Attribute> &attributes) {
 	// tagname WS attribute*
 
-	auto name = parseTagName(in, line, col);
-	consumeWhitespace(in, line, col);
+	auto name = parseTagName(in);
+	consumeWhitespace(in);
 
-	std::pair<std::string, std::string> pair{"", ""};
-	for (parseAttribute(in, line, col, pair); pair.first != ""; parseAttribute(in, line, col, pair)) {
-		attributes.emplace(pair);
+	attributes.clear();
+	in.decoded.reset();
+	Attribute attr;
+	while (parseAttribute(in, attr)) {
+		attributes.push_back(attr);
 
 		// Error check
 		if (in.eof()) {
-			throw xml_parse_error(XML_ERR(line, col) "Unexpected end of file while parsing tag data");
+			throw xml_parse_error(XML_ERR(in) "Unexpected end of file while parsing tag data");
 		}
 	}
 
 	return name;
 }
 
-Xml *Xml::parseTag(std::istream &in, size_t &line, size_t &col) {
-	// WS '<' tagdata '>' xml* '</' tagname '>' WS
-	// | WS '<' tagdata '/>' WS
-
-	Xml *result = new Xml();
+Xml *Xml::parseTag(Cursor &in, bool &open, std::vector<Attribute> &attributes) {
+	// WS '<' tagdata '>' | WS '<' tagdata '/>'
+	// Children and the closing tag of an open tag are read by parseXml so nesting does not grow the call stack
+	// attributes is scratch space kept by the caller so tags do not allocate their own
 
 	// Tag must start with '<'
 	char c = in.get();
-	col++;
 	if (c != '<') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected start of tag character while parsing tag: " + c);
+		throw xml_parse_error(XML_ERR(in) "Unexpected start of tag character while parsing tag: " + c);
 	}
 
 	// Get tag data
-	result->setType(parseTagData(in, line, col, result->getAttributes()));
+	std::string_view type = parseTagData(in, attributes);
 
-	// Parse end of tag or children
-	c = in.get();
-	col++;
-	if (c == '>') {
-		// End of open tag - parse children
-		for (Xml *child = parseXml(in, line, col); child != nullptr; child = parseXml(in, line, col)) {
-			result->addChild(child);
-		}
+	Xml *result = createTag(in.resource, in.names, in.source, type, attributes);
 
-		// Parse closing tag
+	try {
+		// Parse end of tag
 		c = in.get();
-		col++;
-		if (c != '<') {
-			throw xml_parse_error(XML_ERR(line, col) "Unexpected end of tag character while parsing tag: " + c + ". Expected '<'");
+		if (c == '>') {
+			open = true;
+			return result;
 		}
-		c = in.get();
-		col++;
-		if (c != '/') {
-			throw xml_parse_error(XML_ERR(line, col) "Unexpected end of tag character while parsing tag: " + c + ". Expected '/'");
+		else if (c != '/') {
+			throw xml_parse_error(XML_ERR(in) "Unexpected end of tag character while parsing tag: " + c + ". Expected '/' or '>'");
 		}
 
-		std::string closingType = parseTagName(in, line, col);
-		if (result->getType() != closingType) {
-			throw xml_parse_error(XML_ERR(line, col) "Closing tag type does not match open tag: " + closingType + " != " + result->getType());
+		c = in.get();
+		if (c != '>') {
+			throw xml_parse_error(XML_ERR(in) "Unexpected end of tag character while parsing tag: " + c + ". Expected '>'");
 		}
 	}
-	else if (c != '/') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected end of tag character while parsing tag: " + c + ". Expected '/' or '>'");
-	}
-
-	// End of tag
-	c = in.get();
-	col++;
-	if (c != '>') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected end of tag character while parsing tag: " + c + ". Expected '>'");
+	catch (...) {
+		delete result;
+		throw;
 	}
 
+	open = false;
 	return result;
 }
-Xml *Xml::parseComment(std::istream &in, size_t &line, size_t &col) {
+Xml *Xml::parseComment(Cursor &in) {
 	// '!--' CHAR* '-->'
 
-	Xml *result = new Xml();
-	result->setComment(true);
-
 	// Verify '!'
 	char c = in.get();
-	col++;
 	if (c != '!') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected character while parsing comment: " + c + ". Expected '!'");
+		throw xml_parse_error(XML_ERR(in) "Unexpected character while parsing comment: " + c + ". Expected '!'");
 	}
 	// Verify '-'
 	c = in.get();
-	col++;
 	if (c != '-') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected character while parsing comment: " + c + ". Expected '-'");
+		throw xml_parse_error(XML_ERR(in) "Unexpected character while parsing comment: " + c + ". Expected '-'");
 	}
 	// Verify '-'
 	c = in.get();
-	col++;
 	if (c != '-') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected character while parsing comment: " + c + ". Expected '-'");
+		throw xml_parse_error(XML_ERR(in) "Unexpected character while parsing comment: " + c + ". Expected '-'");
 	}
 
-	std::string text = "";
-	while (true) {
-		c = in.get();
-		col++;
+	const char *close = findComment(in.curr, in.end);
+	if (close == nullptr) {
+		in.curr = in.end;
+		throw xml_parse_error(XML_ERR(in) "Unexpected end of file while parsing comment");
+	}
 
-		if (c == '-') {
-			if (in.peek() == '-') {
-				in.ignore();
-				col++;
+	Xml *result = createComment(in.resource, in.names, in.source, std::string_view(in.curr, close - in.curr));
+	in.curr = close + 3;
+	return result;
+}
+Xml *Xml::parseCData(Cursor &in) {
+	// '![CDATA[' CHAR* ']]>'
+	// Kept as written, with no entities decoded
+
+	std::string_view lead(in.curr, std::min<size_t>(in.end - in.curr, 8));
+	if (lead != "![CDATA[") {
+		in.curr += lead.size();
+		throw xml_parse_error(XML_ERR(in) "Unexpected characters while parsing CDATA: " + std::string(lead) + ". Expected '![CDATA['");
+	}
+	in.curr += 8;
 
-				if (in.peek() == '>') {
-					in.ignore();
-					col++;
-					result->setComment(text);
-					return result;
-				}
+	const char *close = findCData(in.curr, in.end);
+	if (close == nullptr) {
+		in.curr = in.end;
+		throw xml_parse_error(XML_ERR(in) "Unexpected end of file while parsing CDATA");
+	}
 
-				in.unget();
-				col--;
-			}
-		}
+	Xml *result = createText(in.resource, in.names, in.source, std::string_view(in.curr, close - in.curr));
+	in.curr = close + 3;
+	return result;
+}
+Xml *Xml::parseText(Cursor &in, bool keepWhitespace) {
+	// CHAR* up to '<'
+
+	// Indentation is by far the most common text, and ends at the first '<'
+	const char *start = in.curr;
+	const char *content = skipWhitespace(start, in.end);
+	if (!keepWhitespace && (content == in.end || *content == '<')) {
+		in.curr = content;
+		return nullptr;
+	}
 
-		text += c;
+	// Runs without entities are left in the buffer
+	const char *stop = findEither(content, in.end, '<', '&');
+	const char *lt = stop;
+	if (stop < in.end && *stop == '&') {
+		lt = (const char *)std::memchr(stop, '<', in.end - stop);
+		lt = lt != nullptr ? lt : in.end;
+	}
+	if (lt == in.end && !in.partial) {
+		in.curr = in.end;
+		throw xml_parse_error(XML_ERR(in) "Unexpected end of file while parsing text");
+	}
 
-		// Error check
-		if (in.eof()) {
-			throw xml_parse_error(XML_ERR(line, col) "Unexpected end of file while parsing comment");
+	std::string_view text(start, lt - start);
+	if (stop != lt) {
+		in.decoded.reset();
+		std::string &decoded = in.decoded.next();
+		decoded.assign(start, stop - start);
+		const char *invalid = decodeEntities(std::string_view(stop, lt - stop), decoded);
+		if (invalid != nullptr) {
+			in.curr = invalid + 1;
+			throw xml_parse_error(XML_ERR(in) "Invalid entity while parsing text");
 		}
+		text = decoded;
 	}
+
+	in.curr = lt;
+	return text.empty() ? nullptr : createText(in.resource, in.names, in.source, text);
 }
 
-Xml *Xml::parseXml(std::istream &in, size_t &line, size_t &col) {
-	// WS '<' tagdata '>' xml* '</' tagname '>' WS | WS '<' tagdata '/>' WS | WS comment WS
+Xml *Xml::parseXml(Cursor &in, const ParseOptions &options) {
+	return parseXml(in, options, nullptr);
+}
+Xml *Xml::parseXml(Cursor &in, const ParseOptions &options, Xml *parent) {
+	// (WS pi)* WS '<' tagdata '>' (xml | text | cdata | pi)* '</' tagname '>' WS | (WS pi)* WS '<' tagdata '/>' WS |
+	// (WS pi)* WS comment WS
+	// With a parent: (xml | text | cdata | comment | pi)*
+	// Declarations and processing instructions (pi) are skipped
+
+	// Open tags, innermost last
+	std::vector<Xml *> stack;
+	stack.reserve(options.maxDepth < 64 ? options.maxDepth : 64);
+	std::vector<Attribute> attributes;
+
+	// The parent belongs to the caller, and is never popped
+	Xml *root = parent;
+	if (parent != nullptr) {
+		stack.push_back(parent);
+	}
 
-	// Leading whitespace
-	consumeWhitespace(in, line, col);
+	try {
+		do {
+			// Leading whitespace, which inside a tag is part of its text
+			if (stack.empty()) {
+				consumeWhitespace(in);
+			}
+			else {
+				size_t start = in.offset();
+				Xml *text = parseText(in, options.keepWhitespace);
+				if (text != nullptr) {
+					stack.back()->addChild(text);
+					XML_STATS(options.stats->record(text, stack.size() + 1));
+
+					if (options.locations != nullptr) {
+						options.locations->record(text, start);
+					}
+				}
+			}
 
-	// Error check
-	if (in.eof()) {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected end of file while parsing xml");
-	}
+			// Error check
+			if (in.eof()) {
+				if (parent != nullptr && stack.size() == 1) {
+					return parent;
+				}
+				throw xml_parse_error(XML_ERR(in) "Unexpected end of file while parsing xml");
+			}
 
-	// Get first character
-	char c = in.get();
-	col++;
-	// first character must be '<'
-	if (c != '<') {
-		throw xml_parse_error(XML_ERR(line, col) "Unexpected character while parsing xml: " + c + ". Expected '<'");
-	}
+			// Get first character
+			size_t start = in.offset();
+			char c = in.get();
+			// first character must be '<'
+			if (c != '<') {
+				throw xml_parse_error(XML_ERR(in) "Unexpected character while parsing xml: " + c + ". Expected '<'");
+			}
 
-	// Determine whether this is a comment, tag, or closing tag
-	Xml *result = nullptr;
-	c = in.peek();
-	if (c == '!') {
-		// Comment
-		result = parseComment(in, line, col);
-	}
-	else if (c == '/') {
-		// This is a closing tag
-		in.unget();	// Go back to '<'
-		col--;
-		return nullptr;
+			// Determine whether this is a comment, tag, or closing tag
+			Xml *result = nullptr;
+			bool open = false;
+			c = in.peek();
+			if (c == '!' && in.end - in.curr > 1 && in.curr[1] == '[' && !stack.empty()) {
+				// CDATA, which only appears inside a tag
+				result = parseCData(in);
+			}
+			else if (c == '!') {
+				// Comment
+				result = parseComment(in);
+			}
+			else if (c == '?') {
+				// Declaration or processing instruction, which leaves no node
+				const char *close = findInstruction(in.curr + 1, in.end);
+				if (close == nullptr) {
+					in.curr = in.end;
+					throw xml_parse_error(XML_ERR(in) "Unexpected end of file while parsing declaration");
+				}
+				in.curr = close + 2;
+			}
+			else if (c == '/') {
+				// This is a closing tag
+				if (stack.empty()) {
+					in.unget();	// Go back to '<'
+					return nullptr;
+				}
+
+				in.ignore();
+
+				Xml *tag = stack.back();
+				if (tag == parent) {
+					throw xml_parse_error(XML_ERR(in) "Unexpected closing tag");
+				}
+				// The closing name is compared in place rather than copied out of the buffer
+				consumeWhitespace(in);
+				std::string_view closingType = scanIdentifier(in);
+				consumeWhitespace(in);
+				if (tag->getType() != closingType) {
+					throw xml_parse_error(XML_ERR(in) "Closing tag type does not match open tag: " + std::string(closingType) + " != " + std::string(tag->getType()));
+				}
+
+				// End of tag
+				c = in.get();
+				if (c != '>') {
+					throw xml_parse_error(XML_ERR(in) "Unexpected end of tag character while parsing tag: " + c + ". Expected '>'");
+				}
+
+				stack.pop_back();
+			}
+			else {
+				// Tag
+				in.unget(); // Go back to '<'
+				result = parseTag(in, open, attributes);
+			}
+
+			if (result != nullptr) {
+				XML_STATS(options.stats->record(result, stack.size() + 1));
+
+				if (options.locations != nullptr) {
+					options.locations->record(result, start);
+				}
+
+				// Store the node in its parent as soon as it exists so a failed parse can free everything. Children join
+				// the root's key table as they are added.
+				if (root == nullptr) {
+					root = result;
+					root->setKeys(options.keys);
+				}
+				else {
+					stack.back()->addChild(result);
+				}
+
+				if (open) {
+					if (stack.size() >= options.maxDepth) {
+						throw xml_parse_error(XML_ERR(in) "Maximum nesting depth exceeded: " + std::to_string(options.maxDepth));
+					}
+					stack.push_back(result);
+				}
+			}
+
+			// Trailing whitespace
+			if (stack.empty()) {
+				consumeWhitespace(in);
+			}
+		} while (!stack.empty() || root == nullptr);
 	}
-	else {
-		// Tag
-		in.unget(); // Go back to '<'
-		col--;
-		result = parseTag(in, line, col);
+	catch (...) {
+		if (root != parent) {
+			delete root;
+		}
+		throw;
 	}
 
-	// Trailing whitespace
-	consumeWhitespace(in, line, col);
-
-	return result;
+	return root;
 }
 
-void Xml::writeXml(Xml *xml, std::ostream &out, size_t indent, bool prett) {
-	// TODO
-}
+bool Xml::splitChildren(Cursor in, size_t count, std::vector<const char *> &cuts, const char *&close) {
+	// Cuts go before a child that starts at least a run's worth of bytes past the last cut
+	size_t target = (in.end - in.curr) / count + 1;
+	cuts.push_back(in.curr);
 
-Xml::Xml() {}
-Xml::~Xml() {
-	for (auto &child : children) {
-		for (auto &xml : child.second) {
-			delete xml;
+	size_t depth = 0;
+	const char *curr = in.curr;
+	while (true) {
+		curr = (const char *)std::memchr(curr, '<', in.end - curr);
+		if (curr == nullptr || in.end - curr < 2) {
+			return false;
+		}
+
+		if (curr[1] == '/') {
+			if (depth == 0) {
+				close = curr;
+				return true;
+			}
+			depth--;
+		}
+		else if (depth == 0 && (size_t)(curr - cuts.back()) >= target && cuts.size() < count) {
+			cuts.push_back(curr);
+		}
+
+		const char *end = nullptr;
+		std::string_view rest(curr, in.end - curr);
+		if (rest.starts_with("<!--")) {
+			end = findComment(curr + 4, in.end);
+			end = end != nullptr ? end + 3 : nullptr;
+		}
+		else if (rest.starts_with("<![CDATA[")) {
+			end = findCData(curr + 9, in.end);
+			end = end != nullptr ? end + 3 : nullptr;
+		}
+		else if (rest.starts_with("<?")) {
+			end = findInstruction(curr + 2, in.end);
+			end = end != nullptr ? end + 2 : nullptr;
 		}
+		else {
+			// Start, end and other tags run to the first '>' outside quotes
+			char quote = 0;
+			for (const char *c = curr + 1; c < in.end; c++) {
+				if (quote != 0) {
+					quote = *c == quote ? 0 : quote;
+				}
+				else if (*c == '"' || *c == '\'') {
+					quote = *c;
+				}
+				else if (*c == '>') {
+					end = c + 1;
+					break;
+				}
+			}
+			if (end != nullptr && curr[1] != '/' && curr[1] != '!' && end[-2] != '/') {
+				depth++;
+			}
+		}
+
+		if (end == nullptr) {
+			return false;
+		}
+		curr = end;
 	}
 }
+Xml *Xml::parseParallel(Cursor &in, const ParseOptions &options, std::deque<std::pmr::monotonic_buffer_resource> *arenas) {
+	// (WS pi)* WS '<' tagdata '>' run+ '</' tagname '>' WS, with the runs of children parsed on the pool
+
+	consumeWhitespace(in);
+	while (in.end - in.curr >= 2 && in.curr[0] == '<' && in.curr[1] == '?') {
+		const char *close = findInstruction(in.curr + 2, in.end);
+		if (close == nullptr) {
+			return nullptr;
+		}
+		in.curr = close + 2;
+		consumeWhitespace(in);
+	}
+	if (options.maxDepth == 0 || in.end - in.curr < 2 || in.curr[0] != '<' || !isIdentifier(in.curr[1])) {
+		return nullptr;
+	}
 
-Xml *Xml::fromStream(std::istream &in) {
-	size_t line = 1, col = 0;
-	return parseXml(in, line, col);
-}
-Xml *Xml::fromFile(std::filesystem::path file) {
-	std::ifstream in;
-	in.open(file);
+	size_t start = in.offset();
+	bool open = false;
+	std::vector<Attribute> attributes;
+	Xml *root = parseTag(in, open, attributes);
 
-	if (!in.is_open()) {
-		throw xml_file_error("Xml: Failed to open file: " + file.string());
+	std::vector<const char *> cuts;
+	const char *close = nullptr;
+	if (!open || !splitChildren(in, options.threads, cuts, close) || cuts.size() < 2) {
+		delete root;
+		return nullptr;
 	}
 
-	return fromStream(in);
-}
-Xml *Xml::fromString(std::string &str) {
-	std::istringstream in(str);
-	return fromStream(in);
-}
+	// Each run is parsed into a node standing in for the root, with its own arena, name table and source map, then
+	// its children are moved to the root in order
+	struct Run {
+		Xml *holder = nullptr;
+		std::pmr::memory_resource *resource = nullptr;
+		std::unique_ptr<Names> names;
+		// Ids in the shared name table, by id in names
+		std::vector<uint32_t> ids;
+		SourceMap locations;
+		Stats stats;
+		std::exception_ptr error;
+	};
+	std::vector<Run> runs(cuts.size());
+	for (Run &run : runs) {
+		run.resource = arenas != nullptr ? &arenas->emplace_back() : in.resource;
+		if (options.names != nullptr) {
+			run.names = std::make_unique<Names>();
+		}
+	}
 
-void Xml::write(bool pretty, std::ostream &out) {
-	writeXml(this, out, 0, pretty);
-}
+	ThreadPool &pool = options.pool != nullptr ? *options.pool : ThreadPool::shared();
+	auto inParallel = [&](const std::function<void(Run &run, size_t idx)> &task) {
+		pool.run(runs.size(), [&](size_t idx, size_t) {
+			task(runs[idx], idx);
+		});
+	};
 
-bool &Xml::isComment() {
-	return comment;
-}
-void Xml::setComment(bool val) {
-	comment = val;
-}
+	inParallel([&](Run &run, size_t idx) {
+		const char *end = idx + 1 < cuts.size() ? cuts[idx + 1] : close;
 
-std::string &Xml::getType() {
-	return type;
-}
-void Xml::setType(std::string str) {
-	type = str;
-	comment = false;
-}
+		// Without a resource to share, the run fills an arena that its nodes keep alive after the parse
+		Arena *arena = run.resource == nullptr ? new Arena(end - cuts[idx]) : nullptr;
+		if (arena != nullptr) {
+			run.resource = arena;
+		}
 
-std::string &Xml::getComment() {
-	return type;
-}
-void Xml::setComment(std::string str) {
-	type = str;
-	comment = true;
-}
+		ParseOptions runOptions = options;
+		runOptions.locations = options.locations != nullptr ? &run.locations : nullptr;
+		runOptions.stats = options.stats != nullptr ? &run.stats : nullptr;
+		runOptions.resource = run.resource;
+		runOptions.names = run.names.get();
+		runOptions.keys = nullptr;
+
+		try {
+			Cursor part{ in.begin, cuts[idx], end, run.resource, run.names.get(), in.source, true, {} };
+			run.holder = create(run.resource, run.names.get(), 0);
+			parseXml(part, runOptions, run.holder);
+		}
+		catch (...) {
+			run.error = std::current_exception();
+		}
 
-Xml::AttrMap &Xml::getAttributes() {
-	return attributes;
-}
-void Xml::addAttribute(std::string key, std::string value) {
-	attributes.emplace(key, value);
-}
-void Xml::removeAttribute(std::string key) {
-	attributes.erase(key);
-}
-Xml::AttrMap::iterator Xml::findAttribute(std::string key) {
-	return attributes.find(key);
-}
+		if (arena != nullptr) {
+			arena->release();
+		}
+	});
 
-Xml::ChildMap &Xml::getChildren() {
-	return children;
-}
-void Xml::addChild(Xml *child) {
-	std::string type = child->isComment() ? "" : child->getType();
-	auto it = children.find(type);
-	if (it == children.end()) {
-		children.emplace(type, std::vector<Xml *>{ child });
+	try {
+		for (Run &run : runs) {
+			if (run.error != nullptr) {
+				std::rethrow_exception(run.error);
+			}
+		}
+
+		// Names are moved into the shared table in document order, so ids come out as a sequential parse gives them
+		if (options.names != nullptr) {
+			for (Run &run : runs) {
+				run.ids.resize(run.names->size());
+				for (uint32_t id = 0; id < run.ids.size(); id++) {
+					run.ids[id] = options.names->intern(run.names->name(id));
+				}
+			}
+		}
+
+		// Every node is visited once more, to point at the shared table and at the root
+		inParallel([&](Run &run, size_t) {
+			for (Xml *child = run.holder->firstChild; child != nullptr; child = child->nextSibling) {
+				child->parent = root;
+			}
+			if (options.names == nullptr) {
+				return;
+			}
+
+			for (Xml *curr = run.holder->firstChild; curr != nullptr; ) {
+				curr->names = options.names;
+				if (curr->typeId != Names::npos) {
+					curr->typeId = run.ids[curr->typeId];
+					curr->type = options.names->name(curr->typeId);
+				}
+				for (uint32_t i = 0; i < curr->attributeCount; i++) {
+					Attribute &attr = curr->attributes[i];
+					if (attr.id != Names::npos) {
+						attr.id = run.ids[attr.id];
+						attr.name = options.names->name(attr.id);
+					}
+				}
+
+				if (curr->firstChild != nullptr) {
+					curr = curr->firstChild;
+					continue;
+				}
+				while (curr != nullptr && curr->nextSibling == nullptr) {
+					curr = curr->parent == root ? nullptr : curr->parent;
+				}
+				curr = curr != nullptr ? curr->nextSibling : nullptr;
+			}
+		});
+
+		XML_STATS(options.stats->record(root, 1));
+		if (options.locations != nullptr) {
+			options.locations->record(root, start);
+		}
+
+		for (Run &run : runs) {
+			Xml *holder = run.holder;
+			if (holder->firstChild != nullptr) {
+				holder->firstChild->prevSibling = root->lastChild;
+				(root->lastChild != nullptr ? root->lastChild->nextSibling : root->firstChild) = holder->firstChild;
+				root->lastChild = holder->lastChild;
+				root->childCount += holder->childCount;
+			}
+			holder->firstChild = nullptr;
+			holder->lastChild = nullptr;
+			holder->childCount = 0;
+
+			XML_STATS(options.stats->merge(run.stats));
+			if (options.locations != nullptr) {
+				options.locations->nodes.insert(options.locations->nodes.end(), run.locations.nodes.begin(), run.locations.nodes.end());
+				options.locations->offsets.insert(options.locations->offsets.end(), run.locations.offsets.begin(), run.locations.offsets.end());
+			}
+		}
+		if (options.keys != nullptr) {
+			root->setKeys(options.keys);
+		}
+
+		// '</' tagname '>' WS
+		in.curr = close + 2;
+		consumeWhitespace(in);
+		std::string_view closingType = scanIdentifier(in);
+		consumeWhitespace(in);
+		if (root->getType() != closingType) {
+			throw xml_parse_error(XML_ERR(in) "Closing tag type does not match open tag: " + std::string(closingType) + " != " + std::string(root->getType()));
+		}
+		char c = in.get();
+		if (c != '>') {
+			throw xml_parse_error(XML_ERR(in) "Unexpected end of tag character while parsing tag: " + c + ". Expected '>'");
+		}
+		consumeWhitespace(in);
+	}
+	catch (...) {
+		for (Run &run : runs) {
+			delete run.holder;
+		}
+		delete root;
+		throw;
+	}
+
+	for (Run &run : runs) {
+		delete run.holder;
+	}
+	return root;
+}
+
+
+Xml::Xml() {}
+Xml::Xml(std::pmr::memory_resource *resource) : resource(resource) {}
+Xml::~Xml() {
+	if (parent != nullptr) {
+		parent->removeChild(this);
+	}
+	dropIndex();
+	// Entries point into the attributes, so they go first. Descendants remove their own.
+	if (keys != nullptr) {
+		keys->erase(this);
+	}
+
+	if (typeId == Names::npos && !borrowed) {
+		release(type);
+	}
+	for (uint32_t i = 0; i < attributeCount; i++) {
+		if (attributes[i].borrowed) {
+			continue;
+		}
+		if (attributes[i].id == Names::npos) {
+			release(attributes[i].name);
+		}
+		release(attributes[i].value);
+	}
+	if (attributes != nullptr && !isExtra(attributes)) {
+		memory()->deallocate(attributes, attributeCapacity * sizeof(Attribute), alignof(Attribute));
+	}
+
+	// Descendants are chained into one list through their sibling links and detached before deletion, so deep trees
+	// neither overflow the stack nor allocate a queue
+	Xml *next = firstChild;
+	while (next != nullptr) {
+		Xml *xml = next;
+		next = xml->nextSibling;
+
+		if (xml->firstChild != nullptr) {
+			xml->lastChild->nextSibling = next;
+			next = xml->firstChild;
+		}
+		xml->parent = nullptr;
+		xml->firstChild = nullptr;
+		xml->lastChild = nullptr;
+
+		delete xml;
+	}
+}
+
+void Xml::operator delete(Xml *xml, std::destroying_delete_t) {
+	std::pmr::memory_resource *resource = xml->resource;
+	size_t size = sizeof(Xml) + xml->extra;
+	xml->~Xml();
+
+	if (resource == nullptr) {
+		::operator delete(xml);
+	}
+	else {
+		resource->deallocate(xml, size, alignof(Xml));
+	}
+}
+Xml *Xml::create(std::pmr::memory_resource *resource, Names *names, size_t extra) {
+	size_t size = sizeof(Xml) + extra;
+	void *memory = resource == nullptr ? ::operator new(size) : resource->allocate(size, alignof(Xml));
+
+	Xml *ret = new (memory) Xml(resource);
+	ret->names = names;
+	ret->extra = (uint32_t)extra;
+	return ret;
+}
+Xml *Xml::createTag(std::pmr::memory_resource *resource, Names *names, std::string_view source, std::string_view type, std::span<const Attribute> attributes) {
+	// An attribute is borrowed whole, or not at all when its value had to be decoded
+	auto borrows = [source, names](const Attribute &attr) {
+		return within(source, attr.value) && (names != nullptr || within(source, attr.name));
+	};
+	bool borrowType = names == nullptr && within(source, type);
+
+	// The attribute array comes first, then every string that is neither interned nor borrowed
+	size_t extra = attributes.size() * sizeof(Attribute);
+	if (names == nullptr && !borrowType) {
+		extra += type.size();
+	}
+	for (const Attribute &attr : attributes) {
+		if (!borrows(attr)) {
+			extra += attr.value.size() + (names == nullptr ? attr.name.size() : 0);
+		}
+	}
+
+	Xml *ret = create(resource, names, extra);
+	char *tail = (char *)(ret + 1);
+	auto place = [&tail](std::string_view str, bool borrow) {
+		if (borrow) {
+			return str;
+		}
+		std::memcpy(tail, str.data(), str.size());
+		tail += str.size();
+		return std::string_view(tail - str.size(), str.size());
+	};
+
+	if (!attributes.empty()) {
+		ret->attributes = (Attribute *)tail;
+		ret->attributeCapacity = (uint32_t)attributes.size();
+		tail += attributes.size() * sizeof(Attribute);
+	}
+
+	if (names != nullptr) {
+		ret->typeId = names->intern(type);
+		ret->type = names->name(ret->typeId);
+	}
+	else {
+		ret->type = place(type, borrowType);
+		ret->borrowed = borrowType;
+	}
+
+	// Later duplicates are dropped, as addAttribute would
+	for (const Attribute &attr : attributes) {
+		if (ret->findAttribute(attr.name) != nullptr) {
+			continue;
+		}
+
+		Attribute &added = *new (ret->attributes + ret->attributeCount++) Attribute();
+		added.borrowed = borrows(attr);
+		if (names != nullptr) {
+			added.id = names->intern(attr.name);
+			added.name = names->name(added.id);
+		}
+		else {
+			added.id = Names::npos;
+			added.name = place(attr.name, added.borrowed);
+		}
+		added.value = place(attr.value, added.borrowed);
+	}
+
+	return ret;
+}
+Xml *Xml::createText(std::pmr::memory_resource *resource, Names *names, std::string_view source, std::string_view text) {
+	bool borrow = within(source, text);
+	Xml *ret = create(resource, names, borrow ? 0 : text.size());
+	if (borrow) {
+		ret->type = text;
+		ret->borrowed = true;
+	}
+	else {
+		char *tail = (char *)(ret + 1);
+		std::memcpy(tail, text.data(), text.size());
+		ret->type = std::string_view(tail, text.size());
+	}
+	ret->text = true;
+	return ret;
+}
+Xml *Xml::createComment(std::pmr::memory_resource *resource, Names *names, std::string_view source, std::string_view text) {
+	Xml *ret = createText(resource, names, source, text);
+	ret->text = false;
+	ret->comment = true;
+	return ret;
+}
+bool Xml::within(std::string_view source, std::string_view str) {
+	uintptr_t begin = (uintptr_t)source.data();
+	return !source.empty() && (uintptr_t)str.data() >= begin && (uintptr_t)str.data() + str.size() <= begin + source.size();
+}
+
+std::pmr::memory_resource *Xml::memory() const {
+	return resource != nullptr ? resource : std::pmr::new_delete_resource();
+}
+bool Xml::isExtra(const void *ptr) const {
+	uintptr_t begin = (uintptr_t)(this + 1);
+	return (uintptr_t)ptr >= begin && (uintptr_t)ptr < begin + extra;
+}
+std::string_view Xml::copy(std::string_view str) {
+	if (str.empty()) {
+		return std::string_view();
+	}
+
+	char *data = (char *)memory()->allocate(str.size(), 1);
+	std::memcpy(data, str.data(), str.size());
+	return std::string_view(data, str.size());
+}
+void Xml::release(std::string_view str) {
+	if (!str.empty() && !isExtra(str.data())) {
+		memory()->deallocate((void *)str.data(), str.size(), 1);
+	}
+}
+void Xml::reserveAttributes(size_t count) {
+	if (count <= attributeCapacity) {
+		return;
+	}
+
+	Attribute *grown = (Attribute *)memory()->allocate(count * sizeof(Attribute), alignof(Attribute));
+	std::uninitialized_copy(attributes, attributes + attributeCount, grown);
+	if (attributes != nullptr && !isExtra(attributes)) {
+		memory()->deallocate(attributes, attributeCapacity * sizeof(Attribute), alignof(Attribute));
+	}
+
+	attributes = grown;
+	attributeCapacity = (uint32_t)count;
+}
+
+Xml *Xml::fromStream(std::istream &in) {
+	return fromStream(in, ParseOptions());
+}
+Xml *Xml::fromStream(std::istream &in, const ParseOptions &options) {
+	std::chrono::steady_clock::time_point started;
+	XML_STATS(started = std::chrono::steady_clock::now());
+
+	std::ostringstream buffer;
+	buffer << in.rdbuf();
+	std::string str = buffer.str();
+
+	std::chrono::nanoseconds read{};
+	XML_STATS(read = std::chrono::steady_clock::now() - started);
+
+	ParseOptions copied = options;
+	copied.borrow = false;
+	Xml *ret = fromBuffer(str, copied);
+	XML_STATS(options.stats->read = read);
+	return ret;
+}
+Xml *Xml::fromFile(std::filesystem::path file) {
+	return fromFile(file, ParseOptions());
+}
+Xml *Xml::fromFile(std::filesystem::path file, const ParseOptions &options) {
+	std::chrono::steady_clock::time_point started;
+	XML_STATS(started = std::chrono::steady_clock::now());
+
+	std::string str;
+	std::string error = Batch::read(file, str);
+	if (!error.empty()) {
+		throw xml_file_error("Xml: " + error);
+	}
+
+	std::chrono::nanoseconds read{};
+	XML_STATS(read = std::chrono::steady_clock::now() - started);
+
+	ParseOptions copied = options;
+	copied.borrow = false;
+	Xml *ret = fromBuffer(str, copied);
+	XML_STATS(options.stats->read = read);
+	return ret;
+}
+Xml *Xml::fromString(std::string &str) {
+	return fromString(str, ParseOptions());
+}
+Xml *Xml::fromString(std::string &str, const ParseOptions &options) {
+	return fromBuffer(str, options);
+}
+Xml *Xml::fromBuffer(std::string_view buffer) {
+	return fromBuffer(buffer, ParseOptions());
+}
+Xml *Xml::fromBuffer(std::string_view buffer, const ParseOptions &options) {
+	return fromBuffer(buffer, options, nullptr);
+}
+Xml *Xml::fromBuffer(std::string_view buffer, const ParseOptions &options, std::deque<std::pmr::monotonic_buffer_resource> *arenas) {
+	if (options.locations != nullptr) {
+		options.locations->clear();
+		options.locations->text = buffer;
+	}
+
+	std::chrono::steady_clock::time_point started;
+	XML_STATS(options.stats->clear(); started = std::chrono::steady_clock::now());
+
+	Cursor in{ buffer.data(), buffer.data(), buffer.data() + buffer.size(), options.resource, options.names, options.borrow ? buffer : std::string_view(), false, {} };
+
+	Xml *ret = nullptr;
+	if (options.threads > 1) {
+		// Falls through to the sequential parser when the root has too few children to split
+		ret = parseParallel(in, options, arenas);
+		if (ret == nullptr) {
+			in.curr = in.begin;
+		}
+	}
+	if (ret == nullptr) {
+		ret = parseXml(in, options);
+	}
+
+	XML_STATS(options.stats->bytes = in.offset(); options.stats->parse = std::chrono::steady_clock::now() - started);
+	return ret;
+}
+
+// Read asynchronously
+Xml::Loading::Loading() : Pending([](void *value) { delete (Xml *)value; }) {}
+
+Xml *Xml::Loading::get() {
+	return (Xml *)take();
+}
+Xml *Xml::Loading::await_resume() {
+	return (Xml *)take();
+}
+
+Xml::Loading Xml::fromFileAsync(std::filesystem::path file) {
+	return fromFileAsync(file, ParseOptions());
+}
+Xml::Loading Xml::fromFileAsync(std::filesystem::path file, const ParseOptions &options) {
+	return fromFileAsync(file, options, IoBackend::shared(), ThreadPool::shared());
+}
+Xml::Loading Xml::fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool) {
+	Loading ret;
+	fromFileAsync(file, options, io, pool, [done = ret.completer()](Xml *xml, std::exception_ptr error) {
+		done(xml, error);
+	});
+	return ret;
+}
+void Xml::fromFileAsync(std::filesystem::path file, const ParseOptions &options, LoadCallback done) {
+	fromFileAsync(file, options, IoBackend::shared(), ThreadPool::shared(), std::move(done));
+}
+void Xml::fromFileAsync(std::filesystem::path file, const ParseOptions &options, IoBackend &io, ThreadPool &pool, LoadCallback done) {
+	ParseOptions copied = options;
+	copied.borrow = false;
+	auto parse = [options = copied](std::string &contents, const std::string &error) -> void * {
+		if (!error.empty()) {
+			throw xml_file_error("Xml: " + error);
+		}
+		return fromBuffer(contents, options);
+	};
+	Pending::load(file, io, pool, parse, [done = std::move(done)](void *value, std::exception_ptr error) {
+		done((Xml *)value, error);
+	});
+}
+
+// Read many files
+std::vector<Xml::Loaded> Xml::fromFiles(const std::vector<std::filesystem::path> &files) {
+	return fromFiles(files, ParseOptions(), ThreadPool::shared());
+}
+std::vector<Xml::Loaded> Xml::fromFiles(const std::vector<std::filesystem::path> &files, const ParseOptions &options, ThreadPool &pool) {
+	ParseOptions fileOptions = options;
+	fileOptions.locations = nullptr;
+	fileOptions.names = nullptr;
+	fileOptions.stats = nullptr;
+	fileOptions.keys = nullptr;
+	fileOptions.borrow = false;
+	fileOptions.threads = 1;
+
+	std::vector<Loaded> ret(files.size());
+	Batch::load(files, pool, [&](size_t index, std::string &contents, const std::string &error) {
+		Loaded &result = ret[index];
+		result.file = files[index];
+
+		ParseOptions arenaOptions = fileOptions;
+		Arena *arena = new Arena(contents.size());
+		arenaOptions.resource = arena;
+
+		try {
+			if (!error.empty()) {
+				throw xml_file_error("Xml: " + error);
+			}
+			result.xml = fromBuffer(contents, arenaOptions);
+		}
+		catch (...) {
+			result.error = std::current_exception();
+		}
+
+		arena->release();
+	});
+
+	return ret;
+}
+std::vector<Xml::Loaded> Xml::fromDirectory(const std::filesystem::path &directory, std::string_view pattern) {
+	return fromFiles(Batch::find(directory, pattern));
+}
+
+// Pull parsing
+Xml::Reader::Reader(std::istream &in) : Reader(in, ParseOptions(), 1 << 16) {}
+Xml::Reader::Reader(std::istream &in, const ParseOptions &options, size_t chunkSize)
+	: Reader([&in](char *data, size_t size) { in.read(data, size); return (size_t)in.gcount(); }, options, chunkSize) {}
+Xml::Reader::Reader(Source source) : Reader(std::move(source), ParseOptions(), 1 << 16) {}
+Xml::Reader::Reader(Source source, const ParseOptions &options, size_t chunkSize) : source(std::move(source)), options(options) {
+	storage.resize(chunkSize > 0 ? chunkSize : 1);
+	base = storage.data();
+}
+Xml::Reader::Reader(std::string_view buffer) : Reader(buffer, ParseOptions()) {}
+Xml::Reader::Reader(std::string_view buffer, const ParseOptions &options) : options(options) {
+	base = buffer.data();
+	tail = buffer.size();
+	exhausted = true;
+}
+
+Xml::Reader::Event Xml::Reader::next() {
+	if (closing) {
+		closing = false;
+		current = Event::EndElement;
+		return current;
+	}
+
+	// An element is closed once its EndElement has been seen
+	if (current == Event::EndElement) {
+		level--;
+	}
+	currentAttributes.clear();
+	decoded.reset();
+
+	while (true) {
+		// Text runs up to the next '<'. Only the part not yet searched is searched again after a refill.
+		const char *lt = nullptr;
+		for (size_t scanned = 0; (lt = (const char *)std::memchr(base + head + scanned, '<', tail - head - scanned)) == nullptr; ) {
+			scanned = tail - head;
+			if (!fill()) {
+				break;
+			}
+		}
+
+		const char *text = base + head;
+		const char *textEnd = lt != nullptr ? lt : base + tail;
+		start = dropped + head;
+		bool blank = skipWhitespace(text, textEnd) == textEnd;
+		if (!blank && level == 0) {
+			fail("Unexpected text outside of an element");
+		}
+		if (text != textEnd && level > 0 && (!blank || options.keepWhitespace)) {
+			currentText = std::string_view(text, textEnd - text);
+			const char *amp = (const char *)std::memchr(text, '&', textEnd - text);
+			if (amp != nullptr) {
+				std::string &out = decoded.next();
+				out.assign(text, amp - text);
+				if (decodeEntities(std::string_view(amp, textEnd - amp), out) != nullptr) {
+					fail("Invalid entity while parsing text");
+				}
+				currentText = out;
+			}
+
+			head = textEnd - base;
+			current = Event::Text;
+			return current;
+		}
+		head = textEnd - base;
+
+		if (lt == nullptr) {
+			if (level != 0) {
+				fail("Unexpected end of file inside element: " + open[level - 1]);
+			}
+			current = Event::End;
+			return current;
+		}
+
+		// Enough to tell a comment or declaration from a tag
+		start = dropped + head;
+		ensure(4);
+		std::string_view lead(base + head, std::min<size_t>(tail - head, 4));
+
+		if (lead == "<!--") {
+			const char *close;
+			for (size_t scanned = 4; (close = findComment(base + head + scanned, base + tail)) == nullptr; ) {
+				scanned = std::max<size_t>(4, tail - head - 2);
+				if (!fill()) {
+					fail("Unexpected end of file while parsing comment");
+				}
+			}
+
+			currentText = std::string_view(base + head + 4, close - (base + head + 4));
+			head = close + 3 - base;
+			current = Event::Comment;
+			return current;
+		}
+
+		if (lead == "<![C" && level > 0) {
+			ensure(9);
+			if (std::string_view(base + head, std::min<size_t>(tail - head, 9)) != "<![CDATA[") {
+				fail("Unexpected characters while parsing CDATA. Expected '<![CDATA['");
+			}
+
+			const char *close;
+			for (size_t scanned = 9; (close = findCData(base + head + scanned, base + tail)) == nullptr; ) {
+				scanned = std::max<size_t>(9, tail - head - 2);
+				if (!fill()) {
+					fail("Unexpected end of file while parsing CDATA");
+				}
+			}
+
+			currentText = std::string_view(base + head + 9, close - (base + head + 9));
+			head = close + 3 - base;
+			current = Event::Text;
+			return current;
+		}
+
+		// Declarations and processing instructions are skipped
+		if (lead.substr(0, 2) == "<?") {
+			for (size_t scanned = 2; ; ) {
+				const char *close = (const char *)std::memchr(base + head + scanned, '>', tail - head - scanned);
+				if (close != nullptr && close[-1] == '?') {
+					head = close + 1 - base;
+					break;
+				}
+
+				if (close != nullptr) {
+					scanned = close + 1 - (base + head);
+					continue;
+				}
+
+				scanned = tail - head;
+				if (!fill()) {
+					fail("Unexpected end of file while parsing declaration");
+				}
+			}
+			continue;
+		}
+
+		const char *close;
+		while ((close = findTagEnd(base + head + 1, base + tail)) == nullptr) {
+			if (!fill()) {
+				fail("Unexpected end of file while parsing tag");
+			}
+		}
+
+		current = parseTag(base + head + 1, close);
+		head = close + 1 - base;
+		return current;
+	}
+}
+Xml::Reader::Event Xml::Reader::event() const {
+	return current;
+}
+
+std::string_view Xml::Reader::name() const {
+	return currentName;
+}
+std::string_view Xml::Reader::text() const {
+	return currentText;
+}
+const std::vector<Xml::Reader::Attribute> &Xml::Reader::attributes() const {
+	return currentAttributes;
+}
+const Xml::Reader::Attribute *Xml::Reader::findAttribute(std::string_view name) const {
+	for (const Attribute &attr : currentAttributes) {
+		if (attr.name == name) {
+			return &attr;
+		}
+	}
+	return nullptr;
+}
+
+size_t Xml::Reader::depth() const {
+	return level;
+}
+size_t Xml::Reader::offset() const {
+	return start;
+}
+
+Xml *Xml::Reader::subtree() {
+	if (current != Event::StartElement) {
+		throw xml_parse_error("Xml: subtree() must be called on a StartElement");
+	}
+
+	// Same shape as parseXml, fed by events instead of characters. Only memory the caller owns outlives a refill,
+	// so nodes borrow from nothing else.
+	std::string_view source = options.borrow && storage.empty() ? std::string_view(base, tail) : std::string_view();
+	std::vector<Xml *> stack;
+	Xml *root = nullptr;
+
+	try {
+		while (true) {
+			if (current == Event::StartElement) {
+				Xml *node = createTag(options.resource, options.names, source, currentName, currentAttributes);
+
+				if (root == nullptr) {
+					root = node;
+					root->setKeys(options.keys);
+				}
+				else {
+					stack.back()->addChild(node);
+				}
+				stack.push_back(node);
+			}
+			else if (current == Event::EndElement) {
+				stack.pop_back();
+				if (stack.empty()) {
+					return root;
+				}
+			}
+			else if (current == Event::Comment) {
+				Xml *node = createComment(options.resource, options.names, source, currentText);
+				stack.back()->addChild(node);
+			}
+			else if (current == Event::Text) {
+				Xml *node = createText(options.resource, options.names, source, currentText);
+				stack.back()->addChild(node);
+			}
+
+			next();
+		}
+	}
+	catch (...) {
+		delete root;
+		throw;
+	}
+}
+void Xml::Reader::skip() {
+	if (current != Event::StartElement) {
+		throw xml_parse_error("Xml: skip() must be called on a StartElement");
+	}
+
+	// Nested elements close at a greater depth than this one
+	size_t target = level;
+	do {
+		next();
+	} while (current != Event::EndElement || level != target);
+}
+
+bool Xml::Reader::fill() {
+	if (exhausted) {
+		return false;
+	}
+
+	if (head > 0) {
+		std::memmove(storage.data(), storage.data() + head, tail - head);
+		dropped += head;
+		tail -= head;
+		head = 0;
+	}
+	if (tail == storage.size()) {
+		storage.resize(storage.size() * 2);
+		base = storage.data();
+	}
+
+	size_t count = source(storage.data() + tail, storage.size() - tail);
+	if (count == 0) {
+		exhausted = true;
+		return false;
+	}
+
+	tail += count;
+	return true;
+}
+bool Xml::Reader::ensure(size_t count) {
+	while (tail - head < count) {
+		if (!fill()) {
+			return false;
+		}
+	}
+	return true;
+}
+const char *Xml::Reader::findTagEnd(const char *curr, const char *end) {
+	bool quoted = false;
+	for (; curr < end; curr++) {
+		if (*curr == '"') {
+			quoted = !quoted;
+		}
+		else if (*curr == '>' && !quoted) {
+			return curr;
+		}
+	}
+	return nullptr;
+}
+
+Xml::Reader::Event Xml::Reader::parseTag(const char *curr, const char *end) {
+	// '/'? WS ident WS (ident WS '=' WS string WS)* '/'?
+	// end is the closing '>', and quotes are balanced before it
+
+	bool closingTag = curr < end && *curr == '/';
+	if (closingTag) {
+		curr++;
+	}
+
+	curr = skipWhitespace(curr, end);
+	const char *name = curr;
+	while (curr < end && isIdentifier(*curr)) {
+		curr++;
+	}
+	if (curr == name) {
+		fail(std::string("Unexpected token while parsing tag name: ") + (curr < end ? *curr : '>'));
+	}
+	currentName = std::string_view(name, curr - name);
+	curr = skipWhitespace(curr, end);
+
+	if (closingTag) {
+		if (curr != end) {
+			fail(std::string("Unexpected end of tag character while parsing tag: ") + *curr + ". Expected '>'");
+		}
+		if (level == 0 || open[level - 1] != currentName) {
+			fail("Closing tag type does not match open tag: " + std::string(currentName) + " != " + (level > 0 ? open[level - 1] : ""));
+		}
+		return Event::EndElement;
+	}
+
+	while (curr < end && *curr != '/') {
+		const char *key = curr;
+		while (curr < end && isIdentifier(*curr)) {
+			curr++;
+		}
+		if (curr == key) {
+			fail(std::string("Unexpected token while parsing attribute: ") + *curr);
+		}
+		std::string_view attrName(key, curr - key);
+
+		curr = skipWhitespace(curr, end);
+		if (curr >= end || *curr != '=') {
+			fail("Unexpected token while parsing attribute: " + std::string(attrName) + ". Expected '='");
+		}
+		curr = skipWhitespace(curr + 1, end);
+		if (curr >= end || *curr != '"') {
+			fail("Unexpected token while parsing string: " + std::string(attrName) + ". Expected '\"'");
+		}
+
+		const char *value = curr + 1;
+		curr = (const char *)std::memchr(value, '"', end - value);
+		std::string_view raw(value, curr - value);
+		const char *amp = (const char *)std::memchr(raw.data(), '&', raw.size());
+		if (amp != nullptr) {
+			std::string &out = decoded.next();
+			out.assign(raw.data(), amp - raw.data());
+			if (decodeEntities(std::string_view(amp, curr - amp), out) != nullptr) {
+				fail("Invalid entity while parsing attribute: " + std::string(attrName));
+			}
+			raw = out;
+		}
+		currentAttributes.push_back({ attrName, raw });
+		curr = skipWhitespace(curr + 1, end);
+	}
+
+	if (curr < end) {
+		// Self closing
+		if (curr + 1 != end) {
+			fail(std::string("Unexpected end of tag character while parsing tag: ") + curr[1] + ". Expected '>'");
+		}
+		closing = true;
+	}
+
+	if (level >= options.maxDepth) {
+		fail("Maximum nesting depth exceeded: " + std::to_string(options.maxDepth));
+	}
+	if (open.size() <= level) {
+		open.emplace_back();
+	}
+	open[level++].assign(currentName);
+
+	return Event::StartElement;
+}
+void Xml::Reader::fail(const std::string &message) const {
+	throw xml_parse_error("Xml [byte " + std::to_string(start) + "]: " + message);
+}
+
+// Names
+Xml::Names::Names() : Names(std::pmr::get_default_resource()) {}
+Xml::Names::Names(std::pmr::memory_resource *resource) : resource(resource), ids(resource), names(resource) {}
+Xml::Names::~Names() {
+	for (std::string_view name : names) {
+		if (!name.empty()) {
+			resource->deallocate((void *)name.data(), name.size(), 1);
+		}
+	}
+}
+
+uint32_t Xml::Names::intern(std::string_view name) {
+	auto it = ids.find(name);
+	if (it != ids.end()) {
+		return it->second;
+	}
+
+	// The table keys view the stored copy, so they stay valid as it grows
+	char *data = name.empty() ? nullptr : (char *)resource->allocate(name.size(), 1);
+	std::memcpy(data, name.data(), name.size());
+	std::string_view stored(data, name.size());
+
+	uint32_t id = (uint32_t)names.size();
+	names.push_back(stored);
+	ids.emplace(stored, id);
+	return id;
+}
+uint32_t Xml::Names::find(std::string_view name) const {
+	auto it = ids.find(name);
+	return it != ids.end() ? it->second : npos;
+}
+std::string_view Xml::Names::name(uint32_t id) const {
+	return id < names.size() ? names[id] : std::string_view();
+}
+
+size_t Xml::Names::size() const {
+	return names.size();
+}
+void Xml::Names::clear() {
+	for (std::string_view name : names) {
+		if (!name.empty()) {
+			resource->deallocate((void *)name.data(), name.size(), 1);
+		}
+	}
+
+	// Fresh containers, so nothing points into memory the resource may be about to release
+	ids = std::pmr::unordered_map<std::string_view, uint32_t>(resource);
+	names = std::pmr::vector<std::string_view>(resource);
+}
+
+// Key tables
+Xml::Keys::Keys(std::initializer_list<std::string_view> attributes) : Keys(attributes, std::pmr::get_default_resource()) {}
+Xml::Keys::Keys(std::initializer_list<std::string_view> attributes, std::pmr::memory_resource *resource) : resource(resource) {
+	for (std::string_view name : attributes) {
+		tables.push_back({ std::string(name), std::pmr::vector<Slot>(resource), 0 });
+	}
+}
+
+Xml *Xml::Keys::find(std::string_view attribute, std::string_view value) const {
+	const Table *found = table(attribute);
+	if (found == nullptr || found->used == 0) {
+		return nullptr;
+	}
+
+	size_t hash = std::hash<std::string_view>()(value);
+	size_t mask = found->slots.size() - 1;
+	for (size_t i = hash & mask; found->slots[i].node != nullptr; i = (i + 1) & mask) {
+		if (found->slots[i].hash == hash && found->slots[i].node->findAttribute(found->name)->value == value) {
+			return found->slots[i].node;
+		}
+	}
+	return nullptr;
+}
+std::vector<Xml *> Xml::Keys::findAll(std::string_view attribute, std::string_view value) const {
+	std::vector<Xml *> ret;
+	const Table *found = table(attribute);
+	if (found == nullptr || found->used == 0) {
+		return ret;
+	}
+
+	size_t hash = std::hash<std::string_view>()(value);
+	size_t mask = found->slots.size() - 1;
+	for (size_t i = hash & mask; found->slots[i].node != nullptr; i = (i + 1) & mask) {
+		if (found->slots[i].hash == hash && found->slots[i].node->findAttribute(found->name)->value == value) {
+			ret.push_back(found->slots[i].node);
+		}
+	}
+	return ret;
+}
+
+size_t Xml::Keys::size() const {
+	size_t ret = 0;
+	for (const Table &table : tables) {
+		ret += table.used;
+	}
+	return ret;
+}
+void Xml::Keys::clear() {
+	for (Table &table : tables) {
+		table.slots = std::pmr::vector<Slot>(resource);
+		table.used = 0;
+	}
+}
+
+void Xml::Keys::insert(Xml *node, const Xml::Attribute &attr) {
+	Table *found = table(attr.name);
+	if (found == nullptr) {
+		return;
+	}
+
+	// Kept at most three quarters full
+	std::pmr::vector<Slot> &slots = found->slots;
+	if ((found->used + 1) * 4 > slots.size() * 3) {
+		std::pmr::vector<Slot> old(slots.empty() ? 16 : slots.size() * 2, resource);
+		old.swap(slots);
+
+		size_t mask = slots.size() - 1;
+		for (const Slot &slot : old) {
+			if (slot.node != nullptr) {
+				size_t i = slot.hash & mask;
+				while (slots[i].node != nullptr) {
+					i = (i + 1) & mask;
+				}
+				slots[i] = slot;
+			}
+		}
+	}
+
+	size_t hash = std::hash<std::string_view>()(attr.value);
+	size_t mask = slots.size() - 1;
+	size_t i = hash & mask;
+	while (slots[i].node != nullptr) {
+		i = (i + 1) & mask;
+	}
+	slots[i] = { node, hash };
+	found->used++;
+}
+void Xml::Keys::erase(Xml *node, const Xml::Attribute &attr) {
+	Table *found = table(attr.name);
+	if (found == nullptr || found->used == 0) {
+		return;
+	}
+
+	std::pmr::vector<Slot> &slots = found->slots;
+	size_t hash = std::hash<std::string_view>()(attr.value);
+	size_t mask = slots.size() - 1;
+	size_t i = hash & mask;
+	while (slots[i].node != node || slots[i].hash != hash) {
+		if (slots[i].node == nullptr) {
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	// Later slots in the run move back into the gap when that is still at or after their home slot, so no run is
+	// ever broken by an empty slot
+	for (size_t j = (i + 1) & mask; slots[j].node != nullptr; j = (j + 1) & mask) {
+		size_t home = slots[j].hash & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i] = Slot();
+	found->used--;
+}
+void Xml::Keys::insert(Xml *node) {
+	for (uint32_t i = 0; i < node->attributeCount; i++) {
+		insert(node, node->attributes[i]);
+	}
+}
+void Xml::Keys::erase(Xml *node) {
+	for (uint32_t i = 0; i < node->attributeCount; i++) {
+		erase(node, node->attributes[i]);
+	}
+}
+Xml::Keys::Table *Xml::Keys::table(std::string_view attribute) {
+	// Only a handful of attributes are indexed
+	for (Table &table : tables) {
+		if (table.name == attribute) {
+			return &table;
+		}
+	}
+	return nullptr;
+}
+const Xml::Keys::Table *Xml::Keys::table(std::string_view attribute) const {
+	for (const Table &table : tables) {
+		if (table.name == attribute) {
+			return &table;
+		}
+	}
+	return nullptr;
+}
+
+// Documents
+Xml::Document::Document() : names(&arena) {}
+Xml::Document::Document(size_t initialSize) : arena(initialSize), names(&arena) {}
+
+Xml *Xml::Document::parse(std::string_view buffer) {
+	return parse(buffer, ParseOptions());
+}
+Xml *Xml::Document::parse(std::string_view buffer, const ParseOptions &options) {
+	clear();
+
+	ParseOptions documentOptions = options;
+	documentOptions.resource = &arena;
+	documentOptions.names = &names;
+	root = fromBuffer(buffer, documentOptions, &runArenas);
+	return root;
+}
+Xml *Xml::Document::parseFile(const std::filesystem::path &file) {
+	return parseFile(file, ParseOptions());
+}
+Xml *Xml::Document::parseFile(const std::filesystem::path &file, const ParseOptions &options) {
+	clear();
+
+	std::string error = Batch::read(file, source);
+	if (!error.empty()) {
+		throw xml_file_error("Xml: " + error);
+	}
+
+	ParseOptions documentOptions = options;
+	documentOptions.resource = &arena;
+	documentOptions.names = &names;
+	documentOptions.borrow = true;
+	root = fromBuffer(source, documentOptions, &runArenas);
+	return root;
+}
+Xml *Xml::Document::create() {
+	return Xml::create(&arena, &names, 0);
+}
+
+Xml *Xml::Document::getRoot() {
+	return root;
+}
+Xml::Names &Xml::Document::getNames() {
+	return names;
+}
+std::pmr::memory_resource *Xml::Document::getResource() {
+	return &arena;
+}
+void Xml::Document::clear() {
+	// Nodes, their child indexes and the names those hold all live in the arena, so they are dropped without being
+	// destroyed
+	root = nullptr;
+	names.clear();
+	arena.release();
+	runArenas.clear();
+	source.clear();
+}
+
+// Parse statistics
+void Xml::Stats::clear() {
+	*this = Stats();
+}
+
+void Xml::Stats::record(const Xml *node, size_t depth) {
+	if (node->comment) {
+		comments++;
+	}
+	else if (node->text) {
+		texts++;
+	}
+	else {
+		tags++;
+	}
+	attributes += node->attributeCount;
+	maxDepth = std::max(maxDepth, depth);
+
+	allocations++;
+	allocated += sizeof(Xml) + node->extra;
+}
+void Xml::Stats::merge(const Stats &other) {
+	tags += other.tags;
+	comments += other.comments;
+	texts += other.texts;
+	attributes += other.attributes;
+	maxDepth = std::max(maxDepth, other.maxDepth);
+	allocations += other.allocations;
+	allocated += other.allocated;
+}
+
+// Source map
+size_t Xml::SourceMap::offset(const Xml *node) const {
+	if (sorted.size() != nodes.size()) {
+		sorted.resize(nodes.size());
+		std::iota(sorted.begin(), sorted.end(), 0);
+		std::sort(sorted.begin(), sorted.end(), [this](size_t a, size_t b) {
+			return std::less<const Xml *>()(nodes[a], nodes[b]);
+		});
+	}
+
+	auto it = std::lower_bound(sorted.begin(), sorted.end(), node, [this](size_t idx, const Xml *val) {
+		return std::less<const Xml *>()(nodes[idx], val);
+	});
+	if (it == sorted.end() || nodes[*it] != node) {
+		return std::string::npos;
+	}
+
+	return offsets[*it];
+}
+Xml::Location Xml::SourceMap::locate(const Xml *node) const {
+	size_t off = offset(node);
+	if (off == std::string::npos) {
+		return { 0, 0 };
+	}
+
+	return Xml::locate(text, off);
+}
+
+const std::string &Xml::SourceMap::source() const {
+	return text;
+}
+size_t Xml::SourceMap::size() const {
+	return nodes.size();
+}
+void Xml::SourceMap::clear() {
+	text.clear();
+	nodes.clear();
+	offsets.clear();
+	sorted.clear();
+}
+
+void Xml::SourceMap::record(const Xml *node, size_t offset) {
+	nodes.push_back(node);
+	offsets.push_back(offset);
+}
+
+Xml::Location Xml::locate(std::string_view source, size_t offset) {
+	auto [line, column] = Lines::locate(source, offset);
+	return { line, column };
+}
+
+void Xml::write(bool pretty, std::ostream &out) {
+	Writer writer(out, pretty);
+	writer.value(*this);
+}
+void Xml::writeFile(const std::filesystem::path &file, bool pretty) {
+	std::ofstream out(file, std::ios::binary);
+	if (!out) {
+		throw xml_file_error("Xml: Could not open " + file.string() + " for writing");
+	}
+
+	write(pretty, out);
+	out.flush();
+	if (!out) {
+		throw xml_file_error("Xml: Could not write " + file.string());
+	}
+}
+
+const char *Xml::findEscape(const char *curr, const char *end, bool attribute) {
+#ifdef _XELA_XML_SSE2
+	const __m128i amp = _mm_set1_epi8('&');
+	const __m128i lt = _mm_set1_epi8('<');
+	const __m128i gt = _mm_set1_epi8('>');
+	const __m128i quote = _mm_set1_epi8(attribute ? '"' : '&');
+	while (end - curr >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)curr);
+		__m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, amp), _mm_cmpeq_epi8(chunk, lt)),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, gt), _mm_cmpeq_epi8(chunk, quote)));
+		unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+		if (mask != 0) {
+			return curr + countTrailingZeros(mask);
+		}
+		curr += 16;
+	}
+#endif
+	while (curr < end && *curr != '&' && *curr != '<' && *curr != '>' && (!attribute || *curr != '"')) {
+		curr++;
+	}
+	return curr;
+}
+
+// Queries
+Xml::Query Xml::Query::compile(std::string_view path) {
+	// ('/' | '//')? step (('/' | '//') step)*
+	// step: (ident | '*') ('[' WS ('@' ident WS (('=' | '!=') WS literal WS)? | digit+ WS) ']')*
+
+	while (!path.empty() && isWhitespace(path.front())) {
+		path.remove_prefix(1);
+	}
+	while (!path.empty() && isWhitespace(path.back())) {
+		path.remove_suffix(1);
+	}
+
+	Query ret;
+	size_t pos = 0;
+	auto at = [&](char c) {
+		return pos < path.size() && path[pos] == c;
+	};
+	auto skipSpace = [&]() {
+		while (pos < path.size() && isWhitespace(path[pos])) {
+			pos++;
+		}
+	};
+	auto identifier = [&]() {
+		size_t start = pos;
+		while (pos < path.size() && (isIdentifier(path[pos]) || path[pos] == '-' || path[pos] == '.' || path[pos] == ':')) {
+			pos++;
+		}
+		return std::string(path.substr(start, pos - start));
+	};
+
+	ret.absolute = at('/');
+	bool first = true;
+	while (pos < path.size() || first) {
+		Step step;
+		if (at('/')) {
+			pos++;
+			if (at('/')) {
+				pos++;
+				step.descendant = true;
+			}
+		}
+		else if (!first) {
+			fail(path, pos, "Expected '/' between steps");
+		}
+		first = false;
+
+		if (at('*')) {
+			pos++;
+		}
+		else {
+			step.name = identifier();
+			if (step.name.empty()) {
+				fail(path, pos, "Expected an element name or '*'");
+			}
+		}
+
+		while (at('[')) {
+			pos++;
+			skipSpace();
+
+			Predicate predicate{};
+			if (at('@')) {
+				pos++;
+				predicate.name = identifier();
+				if (predicate.name.empty()) {
+					fail(path, pos, "Expected an attribute name after '@'");
+				}
+				skipSpace();
+
+				predicate.kind = Predicate::Kind::Exists;
+				if (at('=') || (at('!') && pos + 1 < path.size() && path[pos + 1] == '=')) {
+					predicate.kind = at('=') ? Predicate::Kind::Equals : Predicate::Kind::NotEquals;
+					pos += predicate.kind == Predicate::Kind::Equals ? 1 : 2;
+					skipSpace();
+
+					if (!at('"') && !at('\'')) {
+						fail(path, pos, "Expected a quoted value");
+					}
+					char quote = path[pos++];
+					size_t close = path.find(quote, pos);
+					if (close == std::string_view::npos) {
+						fail(path, pos, "Unterminated value");
+					}
+					predicate.value = std::string(path.substr(pos, close - pos));
+					pos = close + 1;
+					skipSpace();
+				}
+			}
+			else if (pos < path.size() && path[pos] >= '0' && path[pos] <= '9') {
+				predicate.kind = Predicate::Kind::Position;
+				while (pos < path.size() && path[pos] >= '0' && path[pos] <= '9') {
+					predicate.position = predicate.position * 10 + (path[pos++] - '0');
+				}
+				if (predicate.position == 0) {
+					fail(path, pos, "Positions start at 1");
+				}
+				predicate.slot = ret.positions++;
+				skipSpace();
+			}
+			else {
+				fail(path, pos, "Expected '@' or a position in predicate");
+			}
+
+			if (!at(']')) {
+				fail(path, pos, "Expected ']'");
+			}
+			pos++;
+			step.predicates.push_back(std::move(predicate));
+		}
+
+		ret.steps.push_back(std::move(step));
+	}
+
+	// Steps still to match are kept as bits
+	if (ret.steps.size() > 64) {
+		fail(path, path.size(), "Paths are limited to 64 steps");
+	}
+	return ret;
+}
+
+std::vector<Xml *> Xml::Query::select(Xml *context) const {
+	std::vector<Xml *> ret;
+	if (absolute) {
+		while (context->parent != nullptr) {
+			context = context->parent;
+		}
+		run(context, ret, false);
+	}
+	else {
+		run(context->firstChild, ret, false);
+	}
+	return ret;
+}
+Xml *Xml::Query::first(Xml *context) const {
+	std::vector<Xml *> ret;
+	if (absolute) {
+		while (context->parent != nullptr) {
+			context = context->parent;
+		}
+		run(context, ret, true);
+	}
+	else {
+		run(context->firstChild, ret, true);
+	}
+	return ret.empty() ? nullptr : ret.front();
+}
+void Xml::Query::select(Reader &reader, const std::function<void(Xml *match)> &match) const {
+	// One entry per open element that may still lead to a match, with the document at the bottom
+	std::vector<uint64_t> active{ 1 };
+	std::vector<size_t> counters(positions, 0);
+
+	for (Reader::Event event = reader.next(); event != Reader::Event::End; event = reader.next()) {
+		if (event == Reader::Event::EndElement) {
+			active.pop_back();
+			counters.resize(counters.size() - positions);
+			continue;
+		}
+		if (event != Reader::Event::StartElement) {
+			continue;
+		}
+
+		uint64_t next = 0;
+		size_t *parentCounters = counters.data() + counters.size() - positions;
+		if (test(reader.name(), reader.attributes(), active.back(), parentCounters, next)) {
+			match(reader.subtree());
+		}
+		else if (next == 0) {
+			reader.skip();
+		}
+		else {
+			active.push_back(next);
+			counters.resize(counters.size() + positions, 0);
+		}
+	}
+}
+
+bool Xml::Query::test(std::string_view name, std::span<const Attribute> attributes, uint64_t active, size_t *counters, uint64_t &next) const {
+	auto find = [attributes](std::string_view key) -> const Attribute * {
+		for (const Attribute &attr : attributes) {
+			if (attr.name == key) {
+				return &attr;
+			}
+		}
+		return nullptr;
+	};
+
+	bool matched = false;
+	for (; active != 0; active &= active - 1) {
+		size_t index = std::countr_zero(active);
+		const Step &step = steps[index];
+
+		// A '//' step is tried again at every depth below where it became active
+		if (step.descendant) {
+			next |= (uint64_t)1 << index;
+		}
+		if (!step.name.empty() && step.name != name) {
+			continue;
+		}
+
+		bool passed = true;
+		for (const Predicate &predicate : step.predicates) {
+			const Attribute *attr = predicate.kind == Predicate::Kind::Position ? nullptr : find(predicate.name);
+			switch (predicate.kind) {
+			case Predicate::Kind::Exists:
+				passed = attr != nullptr;
+				break;
+			case Predicate::Kind::Equals:
+				passed = attr != nullptr && attr->value == predicate.value;
+				break;
+			case Predicate::Kind::NotEquals:
+				passed = attr != nullptr && attr->value != predicate.value;
+				break;
+			case Predicate::Kind::Position:
+				passed = ++counters[predicate.slot] == predicate.position;
+				break;
+			}
+			if (!passed) {
+				break;
+			}
+		}
+		if (!passed) {
+			continue;
+		}
+
+		if (index + 1 == steps.size()) {
+			matched = true;
+		}
+		else {
+			next |= (uint64_t)1 << (index + 1);
+		}
+	}
+	return matched;
+}
+void Xml::Query::run(Xml *chain, std::vector<Xml *> &out, bool one) const {
+	// Siblings still to visit under each open parent, with the steps they are tested against. Subtrees no step can
+	// reach are never entered.
+	struct Frame {
+		Xml *next;
+		uint64_t active;
+	};
+	std::vector<Frame> stack{ { chain, 1 } };
+	std::vector<size_t> counters(positions, 0);
+
+	while (!stack.empty()) {
+		Frame &frame = stack.back();
+		Xml *node = frame.next;
+		if (node == nullptr) {
+			stack.pop_back();
+			counters.resize(counters.size() - positions);
+			continue;
+		}
+		frame.next = node->nextSibling;
+		if (node->comment || node->text) {
+			continue;
+		}
+
+		uint64_t next = 0;
+		size_t *parentCounters = counters.data() + counters.size() - positions;
+		if (test(node->type, std::span<const Attribute>(node->attributes, node->attributeCount), frame.active, parentCounters, next)) {
+			out.push_back(node);
+			if (one) {
+				return;
+			}
+		}
+
+		if (next != 0 && node->firstChild != nullptr) {
+			stack.push_back({ node->firstChild, next });
+			counters.resize(counters.size() + positions, 0);
+		}
+	}
+}
+void Xml::Query::fail(std::string_view path, size_t offset, const std::string &message) {
+	throw xml_query_error("Xml query [" + std::to_string(offset) + "]: " + message + " in " + std::string(path));
+}
+
+// Streaming writes
+Xml::Writer::Writer(bool pretty) : pretty(pretty), chunkSize(std::string::npos) {}
+Xml::Writer::Writer(std::ostream &out, bool pretty, size_t chunkSize) : Writer([&out](const char *data, size_t size) { out.write(data, size); }, pretty, chunkSize) {}
+Xml::Writer::Writer(Sink sink, bool pretty, size_t chunkSize) : sink(std::move(sink)), pretty(pretty), chunkSize(chunkSize) {
+	buffer.reserve(chunkSize);
+}
+Xml::Writer::~Writer() {
+	try {
+		flush();
+	}
+	catch (...) {
+		// A destructor cannot report the sink failing; flush() first to see it
+	}
+}
+
+Xml::Writer &Xml::Writer::beginElement(std::string_view name) {
+	return beginElement(name, false);
+}
+Xml::Writer &Xml::Writer::beginElement(std::string_view name, bool verbatim) {
+	beginNode(false);
+	buffer += '<';
+	buffer += name;
+	inTag = true;
+
+	levels.push_back({ names.size(), verbatim || (!levels.empty() && levels.back().verbatim) });
+	names += name;
+	return *this;
+}
+Xml::Writer &Xml::Writer::attribute(std::string_view name, std::string_view value) {
+#ifndef NDEBUG
+	if (!inTag) {
+		fail("Xml: Attributes must come straight after beginElement()");
+	}
+#endif
+
+	buffer += ' ';
+	buffer += name;
+	buffer += "=\"";
+	escape(value, true);
+	buffer += '"';
+	return *this;
+}
+Xml::Writer &Xml::Writer::endElement() {
+#ifndef NDEBUG
+	if (levels.empty()) {
+		fail("Xml: endElement() without an open element");
+	}
+#endif
+
+	Level level = levels.back();
+	levels.pop_back();
+
+	if (inTag) {
+		buffer += "/>";
+		inTag = false;
+	}
+	else {
+		if (pretty && !level.verbatim) {
+			buffer += '\n';
+			writeTab(levels.size());
+		}
+		buffer += "</";
+		buffer.append(names, level.name);
+		buffer += '>';
+	}
+	names.resize(level.name);
+
+	if (levels.empty()) {
+		done = true;
+	}
+	endNode();
+	return *this;
+}
+Xml::Writer &Xml::Writer::text(std::string_view str) {
+	beginNode(true);
+	escape(str, false);
+	endNode();
+	return *this;
+}
+Xml::Writer &Xml::Writer::comment(std::string_view str) {
+	beginNode(false);
+	buffer += "<!--";
+	buffer += str;
+	buffer += "-->";
+	endNode();
+	return *this;
+}
+Xml::Writer &Xml::Writer::value(const Xml &xml) {
+	// Each item opens a node, or closes an element whose children have been written
+	struct Item {
+		const Xml *xml;
+		bool close;
+	};
+	std::vector<Item> pending{ { &xml, false } };
+	while (!pending.empty()) {
+		Item item = pending.back();
+		pending.pop_back();
+
+		const Xml *node = item.xml;
+		if (item.close) {
+			endElement();
+		}
+		else if (node->comment) {
+			comment(node->type);
+		}
+		else if (node->text) {
+			text(node->type);
+		}
+		else {
+			// Known up front, so no indentation is written before the text turns up
+			bool verbatim = false;
+			for (const Xml *child = node->firstChild; child != nullptr && !verbatim; child = child->nextSibling) {
+				verbatim = child->text;
+			}
+
+			beginElement(node->type, verbatim);
+			for (uint32_t i = 0; i < node->attributeCount; i++) {
+				attribute(node->attributes[i].name, node->attributes[i].value);
+			}
+
+			// Children are pushed in reverse so they come off in document order
+			pending.push_back({ node, true });
+			for (const Xml *child = node->lastChild; child != nullptr; child = child->prevSibling) {
+				pending.push_back({ child, false });
+			}
+		}
+	}
+
+	return *this;
+}
+
+void Xml::Writer::flush() {
+	if (sink && !buffer.empty()) {
+		sink(buffer.data(), buffer.size());
+		buffer.clear();
+	}
+}
+const std::string &Xml::Writer::str() const {
+	return buffer;
+}
+
+void Xml::Writer::beginNode(bool text) {
+#ifndef NDEBUG
+	if (done) {
+		fail("Xml: Only one root element may be written");
+	}
+	if (text && levels.empty()) {
+		fail("Xml: Text must be inside an element");
+	}
+#endif
+
+	if (inTag) {
+		buffer += '>';
+		inTag = false;
+	}
+	if (text && !levels.empty()) {
+		levels.back().verbatim = true;
+	}
+
+	// Everything but text starts on its own line, outside of elements holding text
+	if (pretty && !text && (levels.empty() || !levels.back().verbatim)) {
+		if (started) {
+			buffer += '\n';
+		}
+		writeTab(levels.size());
+	}
+	started = true;
+}
+void Xml::Writer::endNode() {
+	if (buffer.size() >= chunkSize) {
+		flush();
+	}
+}
+void Xml::Writer::escape(std::string_view str, bool attribute) {
+	// Runs with nothing to escape are appended whole
+	const char *curr = str.data();
+	const char *end = curr + str.size();
+	while (true) {
+		const char *stop = findEscape(curr, end, attribute);
+		buffer.append(curr, stop - curr);
+		if (stop == end) {
+			return;
+		}
+
+		switch (*stop) {
+		case '&':
+			buffer += "&amp;";
+			break;
+		case '<':
+			buffer += "&lt;";
+			break;
+		case '>':
+			buffer += "&gt;";
+			break;
+		default:
+			buffer += "&quot;";
+			break;
+		}
+		curr = stop + 1;
+	}
+}
+void Xml::Writer::writeTab(size_t indent) {
+	buffer.append(indent, '\t');
+}
+void Xml::Writer::fail(const char *message) {
+	throw xml_write_error(message);
+}
+
+bool &Xml::isComment() {
+	return comment;
+}
+void Xml::setComment(bool val) {
+	comment = val;
+	text = text && !val;
+	if (parent != nullptr) {
+		parent->dropIndex();
+	}
+}
+
+std::string_view Xml::getType() {
+	return type;
+}
+uint32_t Xml::getTypeId() {
+	return typeId;
+}
+void Xml::setType(std::string_view str) {
+	// str may be the current type, so it is stored before the old one is released
+	std::string_view old = typeId == Names::npos && !borrowed ? type : std::string_view();
+	if (names != nullptr) {
+		typeId = names->intern(str);
+		type = names->name(typeId);
+	}
+	else {
+		typeId = Names::npos;
+		type = copy(str);
+	}
+	release(old);
+	borrowed = false;
+
+	comment = false;
+	text = false;
+	if (parent != nullptr) {
+		parent->dropIndex();
+	}
+}
+
+std::string_view Xml::getComment() {
+	return type;
+}
+void Xml::setComment(std::string_view str) {
+	// Comment text is never interned
+	std::string_view old = typeId == Names::npos && !borrowed ? type : std::string_view();
+	typeId = Names::npos;
+	type = copy(str);
+	release(old);
+	borrowed = false;
+
+	comment = true;
+	text = false;
+	if (parent != nullptr) {
+		parent->dropIndex();
+	}
+}
+
+bool Xml::isText() {
+	return text;
+}
+std::string_view Xml::getText() {
+	return text ? type : std::string_view();
+}
+void Xml::setText(std::string_view str) {
+	// Text is never interned
+	std::string_view old = typeId == Names::npos && !borrowed ? type : std::string_view();
+	typeId = Names::npos;
+	type = copy(str);
+	release(old);
+	borrowed = false;
+
+	comment = false;
+	text = true;
+	if (parent != nullptr) {
+		parent->dropIndex();
+	}
+}
+
+Xml::Names *Xml::getNames() {
+	return names;
+}
+
+std::span<const Xml::Attribute> Xml::getAttributes() {
+	return std::span<const Attribute>(attributes, attributeCount);
+}
+void Xml::addAttribute(std::string_view key, std::string_view value) {
+	if (findAttribute(key) != nullptr) {
+		return;
+	}
+	if (attributeCount == attributeCapacity) {
+		reserveAttributes(attributeCapacity == 0 ? 2 : attributeCapacity * 2);
+	}
+
+	Attribute &attr = *new (attributes + attributeCount++) Attribute();
+	if (names != nullptr) {
+		attr.id = names->intern(key);
+		attr.name = names->name(attr.id);
+	}
+	else {
+		attr.id = Names::npos;
+		attr.name = copy(key);
+	}
+	attr.value = copy(value);
+
+	if (keys != nullptr) {
+		keys->insert(this, attr);
+	}
+}
+void Xml::removeAttribute(std::string_view key) {
+	const Attribute *found = findAttribute(key);
+	if (found == nullptr) {
+		return;
+	}
+
+	Attribute *attr = attributes + (found - attributes);
+	if (keys != nullptr) {
+		keys->erase(this, *attr);
+	}
+	if (!attr->borrowed) {
+		if (attr->id == Names::npos) {
+			release(attr->name);
+		}
+		release(attr->value);
+	}
+
+	std::copy(attr + 1, attributes + attributeCount, attr);
+	attributeCount--;
+}
+const Xml::Attribute *Xml::findAttribute(std::string_view key) {
+	// With a name table, a key that was never interned cannot be present, and the rest compare by id
+	if (names != nullptr) {
+		uint32_t id = names->find(key);
+		for (uint32_t i = 0; id != Names::npos && i < attributeCount; i++) {
+			if (attributes[i].id == id) {
+				return &attributes[i];
+			}
+		}
+		return nullptr;
+	}
+
+	for (uint32_t i = 0; i < attributeCount; i++) {
+		if (attributes[i].name == key) {
+			return &attributes[i];
+		}
+	}
+	return nullptr;
+}
+
+Xml *Xml::getParent() {
+	return parent;
+}
+Xml *Xml::getFirstChild() {
+	return firstChild;
+}
+Xml *Xml::getLastChild() {
+	return lastChild;
+}
+Xml *Xml::getNextSibling() {
+	return nextSibling;
+}
+Xml *Xml::getPrevSibling() {
+	return prevSibling;
+}
+size_t Xml::getChildCount() {
+	return childCount;
+}
+
+const Xml::ChildMap &Xml::getChildren() {
+	if (index == nullptr) {
+		// The names and lists are made inside the map so they share the node's memory resource
+		index = resource == nullptr ? new ChildMap() : std::pmr::polymorphic_allocator<ChildMap>(resource).new_object<ChildMap>();
+		for (Xml *child = firstChild; child != nullptr; child = child->nextSibling) {
+			(*index)[child->comment || child->text ? std::pmr::string() : std::pmr::string(child->type)].push_back(child);
+		}
+	}
+	return *index;
+}
+void Xml::addChild(Xml *child) {
+	if (child->parent != nullptr) {
+		child->parent->removeChild(child);
+	}
+
+	child->parent = this;
+	child->prevSibling = lastChild;
+	child->nextSibling = nullptr;
+	if (lastChild != nullptr) {
+		lastChild->nextSibling = child;
 	}
 	else {
-		it->second.push_back(child);
+		firstChild = child;
+	}
+	lastChild = child;
+	childCount++;
+
+	if (index != nullptr) {
+		(*index)[child->comment || child->text ? std::pmr::string() : std::pmr::string(child->type)].push_back(child);
+	}
+	if (child->keys != keys) {
+		child->setKeys(keys);
 	}
 }
 void Xml::removeChild(Xml *child) {
-	auto it = children.find(child->getType());
-	if (it != children.end()) {
-		for (size_t i = 0; i < it->second.size(); i++) {
-			if (it->second[i] == child) {
-				it->second.erase(it->second.begin() + i);
+	if (child->parent != this) {
+		return;
+	}
+
+	(child->prevSibling != nullptr ? child->prevSibling->nextSibling : firstChild) = child->nextSibling;
+	(child->nextSibling != nullptr ? child->nextSibling->prevSibling : lastChild) = child->prevSibling;
+	child->parent = nullptr;
+	child->prevSibling = nullptr;
+	child->nextSibling = nullptr;
+	childCount--;
+
+	if (child->keys != nullptr) {
+		child->setKeys(nullptr);
+	}
+
+	if (index != nullptr) {
+		// Only siblings with the same name are searched
+		auto it = index->find(child->comment || child->text ? std::string_view() : child->type);
+		if (it != index->end()) {
+			auto pos = std::find(it->second.begin(), it->second.end(), child);
+			if (pos != it->second.end()) {
+				it->second.erase(pos);
 			}
+			if (it->second.empty()) {
+				index->erase(it);
+			}
+		}
+	}
+}
+
+void Xml::dropIndex() {
+	if (index == nullptr) {
+		return;
+	}
+
+	if (resource == nullptr) {
+		delete index;
+	}
+	else {
+		std::pmr::polymorphic_allocator<ChildMap>(resource).delete_object(index);
+	}
+	index = nullptr;
+}
+void Xml::setKeys(Keys *table) {
+	// A whole tree shares one table, so the walk is iterative for deep ones
+	for (Xml *curr = this; curr != nullptr; ) {
+		if (curr->keys != nullptr) {
+			curr->keys->erase(curr);
+		}
+		curr->keys = table;
+		if (table != nullptr) {
+			table->insert(curr);
+		}
+
+		if (curr->firstChild != nullptr) {
+			curr = curr->firstChild;
+			continue;
+		}
+		while (curr != this && curr->nextSibling == nullptr) {
+			curr = curr->parent;
 		}
+		curr = curr != this ? curr->nextSibling : nullptr;
 	}
 }
 
@@ -1,6 +1,13 @@
 #include "pch.h"
 
 #include <filesystem>
+#include <future>
+#include <coroutine>
+#include <memory_resource>
+
+#define XELA_PARSE_STATS
+
+#include "XelaAsync.hpp"
 
 #define XELA_JSON_IMPLEMENTATION
 #include "XelaJson.hpp"
@@ -354,7 +361,13 @@ TEST(Json, Write) {
 	std::stringstream stream = std::stringstream();
 	val->write(false, stream);
 
-	ASSERT_EQ(stream.str(), std::string("{\"one\":[1,2,3,4],\"two\":\" 2 \"}"));
+	// Members come out in the map's order, so the text is checked by reading it back
+	std::string written = stream.str();
+	EXPECT_EQ(written.size(), std::string("{\"one\":[1,2,3,4],\"two\":\" 2 \"}").size());
+	Xela::Json *read = Xela::Json::fromString(written);
+	ASSERT_TRUE(Xela::Json::equals(val, read));
+
+	Xela::Json::destroy(read);
 }
 TEST(Json, Empty) {
 	Xela::Json *obj = Xela::Json::fromType(Xela::Json::Type::Object);
@@ -396,6 +409,753 @@ TEST(Json, Empty) {
 	ASSERT_EQ(dec->asFloat(), 0.0f);
 	ASSERT_EQ(bin->asBool(), false);
 }
+TEST(Json, Depth) {
+	const size_t depth = 10000;
+	std::string str = std::string(depth, '[') + std::string(depth, ']');
+
+	EXPECT_THROW(Xela::Json::fromString(str), Xela::json_parse_error);
+
+	Xela::Json::ParseOptions options;
+	options.maxDepth = depth;
+	Xela::Json *val = Xela::Json::fromString(str, options);
+
+	ASSERT_NE(val, nullptr);
+	ASSERT_EQ(val->type(), Xela::Json::Type::Array);
+	ASSERT_EQ(val->size(), 1);
+
+	size_t count = 1;
+	for (Xela::Json *curr = val; curr->size() != 0; curr = curr->asArray()[0]) {
+		count++;
+	}
+	EXPECT_EQ(count, depth);
+
+	Xela::Json::destroy(val);
+
+	std::string deep = "{\"a\":" + std::string(depth, '[');
+	EXPECT_THROW(Xela::Json::fromString(deep, options), Xela::json_parse_error);
+}
+TEST(Json, Location) {
+	std::string str =
+		"{\n"
+			"\t\"One\": 1,\n"
+			"\t\"Two\": tru\n"
+		"}";
+
+	try {
+		Xela::Json::fromString(str);
+		FAIL();
+	}
+	catch (Xela::json_parse_error &err) {
+		EXPECT_EQ(std::string(err.what()).rfind("Json [3, 11]: ", 0), 0);
+	}
+
+	std::string lines = std::string(100, 'a') + "\n" + std::string(40, '\n') + "abc";
+	Xela::Json::Location loc = Xela::Json::locate(lines, lines.size() - 1);
+	EXPECT_EQ(loc.line, 42);
+	EXPECT_EQ(loc.col, 3);
+
+	loc = Xela::Json::locate(lines, 50);
+	EXPECT_EQ(loc.line, 1);
+	EXPECT_EQ(loc.col, 51);
+}
+TEST(Json, SourceMap) {
+	std::string str =
+		"{\n"
+			"\t\"One\": [1, 2],\n"
+			"\t\"Two\": \"Hello\"\n"
+		"}";
+
+	Xela::Json::SourceMap locations;
+	Xela::Json::ParseOptions options;
+	options.locations = &locations;
+
+	Xela::Json *val = Xela::Json::fromString(str, options);
+
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(locations.size(), 5);
+	EXPECT_EQ(locations.offset(val), 0);
+
+	Xela::Json *one = val->asObject().find("One")->second;
+	Xela::Json *two = val->asObject().find("Two")->second;
+
+	Xela::Json::Location loc = locations.locate(one);
+	EXPECT_EQ(loc.line, 2);
+	EXPECT_EQ(loc.col, 9);
+
+	loc = locations.locate(one->asArray()[1]);
+	EXPECT_EQ(loc.line, 2);
+	EXPECT_EQ(loc.col, 13);
+
+	loc = locations.locate(two);
+	EXPECT_EQ(loc.line, 3);
+	EXPECT_EQ(loc.col, 9);
+
+	Xela::Json *other = Xela::Json::fromType(Xela::Json::Type::Null);
+	EXPECT_EQ(locations.offset(other), std::string::npos);
+	EXPECT_EQ(locations.locate(other).line, 0);
+
+	Xela::Json::destroy(val);
+	delete other;
+}
+TEST(Json, Parallel) {
+	std::string str = "[\n";
+	for (size_t i = 0; i < 1000; i++) {
+		str += "\t{ \"id\": " + std::to_string(i) + ", \"name\": \"a,]\\\"b\", \"tags\": [1, [2], {}] }, // item, ]\n";
+	}
+	str += "\t5 6\n]";
+
+	Xela::Json::ParseOptions options;
+	options.threads = 4;
+
+	Xela::Json *val = Xela::Json::fromString(str, options);
+
+	ASSERT_NE(val, nullptr);
+	ASSERT_EQ(val->type(), Xela::Json::Type::Array);
+	ASSERT_EQ(val->size(), 1002);
+
+	for (size_t i = 0; i < 1000; i++) {
+		Xela::Json *item = val->asArray()[i];
+		ASSERT_EQ(item->type(), Xela::Json::Type::Object);
+		EXPECT_EQ(item->asObject().find("id")->second->asInt(), i);
+		EXPECT_EQ(item->asObject().find("name")->second->asString(), "a,]\"b");
+	}
+	EXPECT_EQ(val->asArray()[1000]->asInt(), 5);
+	EXPECT_EQ(val->asArray()[1001]->asInt(), 6);
+
+	Xela::Json::destroy(val);
+
+	// Runs can go on a pool of the caller's, and their trees can still grow once the parse is done
+	Xela::ThreadPool pool(2);
+	options.pool = &pool;
+	val = Xela::Json::fromString(str, options);
+	ASSERT_EQ(val->size(), 1002);
+	Xela::Json::Array &tags = val->asArray()[999]->asObject().find("tags")->second->asArray();
+	for (size_t i = 0; i < 100; i++) {
+		tags.push_back(Xela::Json::fromType(Xela::Json::Type::Null));
+	}
+	EXPECT_EQ(tags.size(), 103);
+	Xela::Json::destroy(val);
+
+	// Errors match the sequential parser
+	std::string bad = "[1, 2, {\"a\": }, 4]";
+	std::string sequential, parallel;
+	try {
+		Xela::Json::fromString(bad);
+	}
+	catch (Xela::json_parse_error &err) {
+		sequential = err.what();
+	}
+	try {
+		Xela::Json::fromString(bad, options);
+	}
+	catch (Xela::json_parse_error &err) {
+		parallel = err.what();
+	}
+	EXPECT_NE(sequential, "");
+	EXPECT_EQ(sequential, parallel);
+
+	// Documents that are not arrays use the sequential parser
+	std::string obj = "{\"a\": [1, 2]}";
+	val = Xela::Json::fromString(obj, options);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(val->type(), Xela::Json::Type::Object);
+	Xela::Json::destroy(val);
+}
+TEST(Json, Freeze) {
+	std::string str = "{\"One\": [1, 2], \"Two\": \"Hello\"}";
+
+	std::shared_ptr<const Xela::Json> doc = Xela::Json::fromString(str)->freeze();
+
+	ASSERT_EQ(doc->type(), Xela::Json::Type::Object);
+	EXPECT_EQ((*doc)("One")[1].asInt(), 2);
+	EXPECT_EQ((*doc)("Two").asString(), "Hello");
+	EXPECT_EQ(doc->find("Three"), doc->asObject().end());
+	EXPECT_THROW((*doc)("Three"), Xela::json_key_error);
+
+	// Reads of a missing key must not turn the value into something else
+	std::string nul = "null";
+	std::shared_ptr<const Xela::Json> empty = Xela::Json::fromString(nul)->freeze();
+	EXPECT_THROW(empty->find("One"), Xela::json_type_error);
+	EXPECT_EQ(empty->type(), Xela::Json::Type::Null);
+}
+TEST(Json, Snapshot) {
+	std::string first = "{\"Version\": 1}";
+	std::string second = "{\"Version\": 2}";
+
+	Xela::Json::Snapshot config(Xela::Json::fromString(first)->freeze());
+
+	std::shared_ptr<const Xela::Json> held = config.load();
+	std::atomic<bool> stop = false;
+	std::vector<std::thread> readers;
+	for (size_t i = 0; i < 4; i++) {
+		readers.emplace_back([&]() {
+			while (!stop) {
+				long long version = config.load()->operator()("Version").asInt();
+				EXPECT_TRUE(version == 1 || version == 2);
+			}
+		});
+	}
+
+	config.store(Xela::Json::fromString(second)->freeze());
+	stop = true;
+	for (std::thread &reader : readers) {
+		reader.join();
+	}
+
+	EXPECT_EQ((*held)("Version").asInt(), 1);
+	EXPECT_EQ((*config.load())("Version").asInt(), 2);
+}
+TEST(Json, Reparse) {
+	std::string str =
+		"{\n"
+			"\t\"One\": [1, 2, {\"A\": 10}],\n"
+			"\t\"Two\": [3, 4]\n"
+		"}";
+
+	Xela::Json::SourceMap locations;
+	Xela::Json::ParseOptions options;
+	options.locations = &locations;
+
+	Xela::Json *val = Xela::Json::fromString(str, options);
+	ASSERT_NE(val, nullptr);
+
+	Xela::Json *one = val->asObject().find("One")->second;
+	Xela::Json *two = val->asObject().find("Two")->second;
+	Xela::Json *three = two->asArray()[0];
+
+	// "10" -> "105" only reparses {"A": 10}
+	size_t offset = str.find("10") + 2;
+	val = Xela::Json::reparse(val, locations, { offset, 0, "5" });
+	str.insert(offset, "5");
+
+	ASSERT_EQ(val->asObject().find("One")->second, one);
+	ASSERT_EQ(val->asObject().find("Two")->second, two);
+	EXPECT_EQ(two->asArray()[0], three);
+	EXPECT_EQ(one->asArray()[2]->asObject().find("A")->second->asInt(), 105);
+	EXPECT_EQ(locations.source(), str);
+	EXPECT_EQ(locations.offset(three), str.find("3"));
+	EXPECT_EQ(locations.offset(one->asArray()[2]->asObject().find("A")->second), str.find("105"));
+
+	// "[3, 4]" -> "[3, 4, 5]" reparses the array
+	offset = str.find("4") + 1;
+	val = Xela::Json::reparse(val, locations, { offset, 0, ", 5" });
+	str.insert(offset, ", 5");
+
+	ASSERT_EQ(val->asObject().find("Two")->second, two);
+	ASSERT_EQ(two->size(), 3);
+	EXPECT_EQ(two->asArray()[2]->asInt(), 5);
+	EXPECT_EQ(locations.offset(two->asArray()[2]), str.find("5]"));
+
+	// Removing a closing bracket changes structure outside of the array
+	offset = str.find("5]") + 1;
+	EXPECT_THROW(Xela::Json::reparse(val, locations, { offset, 1, "" }), Xela::json_parse_error);
+	EXPECT_EQ(locations.source(), str);
+
+	// Replacing the root falls back to a full parse
+	val = Xela::Json::reparse(val, locations, { 0, str.size(), "[1, 2]" });
+	ASSERT_EQ(val->type(), Xela::Json::Type::Array);
+	EXPECT_EQ(locations.offset(val->asArray()[1]), 4);
+
+	Xela::Json::destroy(val);
+}
+
+TEST(Json, Diff) {
+	std::string lhs = R"({"Name": "a/b", "Keep": {"x": [1, 2]}, "List": [1, 2, 3], "Gone": true})";
+	std::string rhs = R"({"Name": "c", "Keep": {"x": [1, 2]}, "List": [1, 5], "New": null})";
+	Xela::Json *from = Xela::Json::fromString(lhs);
+	Xela::Json *to = Xela::Json::fromString(rhs);
+
+	EXPECT_EQ(Xela::Json::hash(from->asObject().find("Keep")->second), Xela::Json::hash(to->asObject().find("Keep")->second));
+	EXPECT_NE(Xela::Json::hash(from), Xela::Json::hash(to));
+
+	// Identical subtrees produce no operations
+	Xela::Json *ops = Xela::Json::diff(from, to);
+	EXPECT_EQ(ops->size(), 5);
+	for (const Xela::Json *op : ops->asArray()) {
+		EXPECT_NE((*op)("path").asString().rfind("/Keep", 0), 0);
+	}
+
+	from = Xela::Json::patch(from, ops);
+	EXPECT_TRUE(Xela::Json::equals(from, to));
+	Xela::Json::destroy(ops);
+
+	// Pointer escaping, move, copy and test
+	std::string str = R"([
+		{"op": "add", "path": "/a~1b", "value": {"c~d": 1}},
+		{"op": "copy", "from": "/a~1b/c~0d", "path": "/List/-"},
+		{"op": "move", "from": "/List/0", "path": "/First"},
+		{"op": "test", "path": "/List", "value": [5, 1]}
+	])";
+	ops = Xela::Json::fromString(str);
+	from = Xela::Json::patch(from, ops);
+	EXPECT_EQ((*from)("a/b")("c~d").asInt(), 1);
+	EXPECT_EQ((*from)("First").asInt(), 1);
+	Xela::Json::destroy(ops);
+
+	str = R"([{"op": "test", "path": "/First", "value": 2}])";
+	ops = Xela::Json::fromString(str);
+	EXPECT_THROW(Xela::Json::patch(from, ops), Xela::json_patch_error);
+	Xela::Json::destroy(ops);
+
+	str = R"([{"op": "remove", "path": "/List/2"}])";
+	ops = Xela::Json::fromString(str);
+	EXPECT_THROW(Xela::Json::patch(from, ops), Xela::json_patch_error);
+	Xela::Json::destroy(ops);
+
+	// A failing operation undoes the ones before it, so the document is left as it was
+	Xela::Json *before = Xela::Json::copy(from);
+	str = R"([{"op": "move", "from": "/First", "path": "/Missing/x"}])";
+	ops = Xela::Json::fromString(str);
+	EXPECT_THROW(Xela::Json::patch(from, ops), Xela::json_patch_error);
+	EXPECT_TRUE(Xela::Json::equals(from, before));
+	Xela::Json::destroy(ops);
+
+	str = R"([
+		{"op": "replace", "path": "/Name", "value": "d"},
+		{"op": "remove", "path": "/List/0"},
+		{"op": "move", "from": "/a~1b", "path": "/Moved"},
+		{"op": "add", "path": "/List/0", "value": [7]},
+		{"op": "copy", "from": "/Moved", "path": "/Copied"},
+		{"op": "add", "path": "", "value": {"Root": true}},
+		{"op": "add", "path": "/Missing/x", "value": 1}
+	])";
+	ops = Xela::Json::fromString(str);
+	EXPECT_THROW(Xela::Json::patch(from, ops), Xela::json_patch_error);
+	EXPECT_TRUE(Xela::Json::equals(from, before));
+	Xela::Json::destroy(ops);
+	Xela::Json::destroy(before);
+
+	Xela::Json::destroy(from);
+	Xela::Json::destroy(to);
+
+	// A tree changed by hand has its hashes dropped with changed(), and patch drops the ones it makes stale
+	lhs = R"({"x": [1, 2]})";
+	from = Xela::Json::fromString(lhs);
+	to = Xela::Json::fromString(lhs);
+	Xela::Json::Digests digests;
+	EXPECT_EQ(digests.hash(from), digests.hash(to));
+	rhs = "3";
+	to->asObject().find("x")->second->asArray().push_back(Xela::Json::fromString(rhs));
+	digests.changed(to, "/x");
+
+	ops = Xela::Json::diff(from, to, digests);
+	EXPECT_EQ(ops->size(), 1);
+	from = Xela::Json::patch(from, ops, digests);
+	EXPECT_TRUE(Xela::Json::equals(from, to));
+	EXPECT_EQ(digests.hash(from), Xela::Json::hash(from));
+	EXPECT_EQ(digests.hash(from), digests.hash(to));
+
+	Xela::Json::destroy(ops);
+	Xela::Json::destroy(from);
+	Xela::Json::destroy(to);
+}
+
+TEST(Json, Digests) {
+	std::string str = R"({"A": {"x": [1, 2], "y": "z"}, "B": [{"y": "z", "x": [1, 2]}, 3.5, null]})";
+
+	Xela::Json::Digests hashes;
+	Xela::Json::ParseOptions options;
+	options.hashes = &hashes;
+	Xela::Json *val = Xela::Json::fromString(str, options);
+
+	// Containers are hashed while parsing and match hashes computed afterwards
+	EXPECT_EQ(hashes.size(), 6);
+	EXPECT_EQ(hashes.hash(val), Xela::Json::hash(val));
+
+	const Xela::Json *a = val->asObject().find("A")->second;
+	const Xela::Json *b = val->asObject().find("B")->second;
+	EXPECT_TRUE(hashes.same(a, b->asArray()[0]));
+	EXPECT_FALSE(hashes.same(a, b));
+
+	// Hashes are trusted, so a tree changed by hand has its stale ones dropped first
+	std::string extra = "3";
+	b->asArray()[0]->asObject().find("x")->second->asArray().push_back(Xela::Json::fromString(extra));
+	hashes.changed(val, "/B/0/x");
+	EXPECT_FALSE(hashes.same(a, b->asArray()[0]));
+	EXPECT_EQ(hashes.hash(val), Xela::Json::hash(val));
+
+	// Zero hashes the same whatever its sign
+	std::string zeros = "[0.0, -0.0]";
+	Xela::Json *signs = Xela::Json::fromString(zeros);
+	EXPECT_EQ(Xela::Json::hash(signs->asArray()[0]), Xela::Json::hash(signs->asArray()[1]));
+	Xela::Json::destroy(signs);
+
+	// A repeated key keeps its first value, and the repeat is left out of the parse time hashes
+	Xela::Json::Digests repeats;
+	Xela::Json::SourceMap repeatLocations;
+	Xela::Json::ParseOptions repeatOptions;
+	repeatOptions.hashes = &repeats;
+	repeatOptions.locations = &repeatLocations;
+	std::string repeated = R"({"a": 1, "a": {"b": [2, {"a": 3, "a": 4}]}, "c": 5, "c": 6})";
+	Xela::Json *dup = Xela::Json::fromString(repeated, repeatOptions);
+	EXPECT_EQ((*dup)("a").asInt(), 1);
+	EXPECT_EQ((*dup)("c").asInt(), 5);
+	EXPECT_EQ(repeats.size(), 1);
+	EXPECT_EQ(repeatLocations.size(), 3);
+	EXPECT_EQ(repeats.hash(dup), Xela::Json::hash(dup));
+	Xela::Json::destroy(dup);
+
+	// Repeats are freed when a parse fails inside them
+	repeated = R"({"a": 1, "a": {"b": [2, {"a": 3, "a": [4 }]}})";
+	EXPECT_THROW(Xela::Json::fromString(repeated, repeatOptions), Xela::json_parse_error);
+
+	// Reparsing drops the hashes of every container that changed
+	Xela::Json::SourceMap locations;
+	options.locations = &locations;
+	Xela::Json::destroy(val);
+	hashes.clear();
+	val = Xela::Json::fromString(str, options);
+
+	size_t offset = str.find("\"z\"") + 1;
+	val = Xela::Json::reparse(val, locations, { offset, 1, "w" }, options);
+	a = val->asObject().find("A")->second;
+	b = val->asObject().find("B")->second;
+	EXPECT_FALSE(hashes.same(a, b->asArray()[0]));
+	EXPECT_EQ(hashes.hash(val), Xela::Json::hash(val));
+
+	Xela::Json::destroy(val);
+}
+
+TEST(Json, Store) {
+	Xela::Json::Store store;
+
+	std::string one = R"({"Name": "one", "Shared": {"List": [1, 2, 3], "Flag": true}})";
+	std::string two = R"({"Name": "two", "Shared": {"Flag": true, "List": [1, 2, 3]}})";
+	const Xela::Json *first = store.intern(Xela::Json::fromString(one));
+	const Xela::Json *second = store.intern(Xela::Json::fromString(two));
+
+	// Equal subtrees are the same pointer
+	EXPECT_EQ(&(*first)("Shared"), &(*second)("Shared"));
+	EXPECT_NE(&(*first)("Name"), &(*second)("Name"));
+	EXPECT_EQ(&(*first)("Shared")("List")[0], &(*first)("Shared")("List")[0]);
+	EXPECT_EQ((*second)("Name").asString(), "two");
+
+	// Two roots, two names, then the shared object, list, flag and three numbers
+	EXPECT_EQ(store.interned(), 16);
+	EXPECT_EQ(store.size(), 10);
+
+	const Xela::Json *third = store.intern(Xela::Json::fromString(one));
+	EXPECT_EQ(third, first);
+	EXPECT_EQ(store.size(), 10);
+}
+
+TEST(Json, Schema) {
+	std::string schemaStr = R"({
+		"type": "object",
+		"required": ["Name", "Ports"],
+		"properties": {
+			"Name": {"type": "string", "minLength": 1, "maxLength": 8},
+			"Mode": {"enum": ["fast", "safe"]},
+			"Ports": {"type": "array", "maxItems": 3, "items": {"type": "integer", "minimum": 1, "maximum": 65535}}
+		}
+	})";
+	Xela::Json *schemaJson = Xela::Json::fromString(schemaStr);
+	Xela::Json::Schema schema = Xela::Json::Schema::fromJson(schemaJson);
+	Xela::Json::destroy(schemaJson);
+
+	Xela::Json::ParseOptions options;
+	options.schema = &schema;
+
+	std::string str = R"({"Name": "web", "Mode": "fast", "Ports": [80, 443], "Extra": [true]})";
+	Xela::Json *val = Xela::Json::fromString(str, options);
+	EXPECT_NO_THROW(schema.validate(val));
+	Xela::Json::destroy(val);
+
+	// Each document breaks one rule
+	std::vector<std::string> invalid = {
+		R"([])",
+		R"({"Name": "web"})",
+		R"({"Name": "", "Ports": []})",
+		R"({"Name": "web", "Mode": "slow", "Ports": []})",
+		R"({"Name": "web", "Ports": [80, 0]})",
+		R"({"Name": "web", "Ports": [80, 1.5]})",
+		R"({"Name": "web", "Ports": [1, 2, 3, 4]})",
+	};
+	for (std::string &doc : invalid) {
+		std::string copy = doc;
+		EXPECT_THROW(Xela::Json::fromString(doc, options), Xela::json_schema_error) << copy;
+
+		val = Xela::Json::fromString(copy);
+		EXPECT_THROW(schema.validate(val), Xela::json_schema_error) << copy;
+		Xela::Json::destroy(val);
+	}
+
+	// The first mismatch stops the parse where it is found
+	str = "{\"Name\": 5,\n\"Ports\": [}";
+	try {
+		Xela::Json::fromString(str, options);
+		FAIL();
+	}
+	catch (Xela::json_schema_error &e) {
+		EXPECT_EQ(std::string(e.what()), "Json [1, 10]: Expected string but found integer");
+	}
+
+	// Parallel parsing checks every element
+	str = R"([{"Name": "a", "Ports": [1]}, {"Name": "b", "Ports": [2]}, {"Name": "c"}])";
+	std::string arraySchemaStr = "{\"type\": \"array\", \"items\": " + schemaStr + "}";
+	schemaJson = Xela::Json::fromString(arraySchemaStr);
+	Xela::Json::Schema arraySchema = Xela::Json::Schema::fromJson(schemaJson);
+	Xela::Json::destroy(schemaJson);
+
+	options.schema = &arraySchema;
+	options.threads = 2;
+	EXPECT_THROW(Xela::Json::fromString(str, options), Xela::json_schema_error);
+}
+
+TEST(Json, Writer) {
+	std::string str = R"({"List": [1, -2.5, "three", [], {"Empty": {}}, true, null]})";
+	Xela::Json *val = Xela::Json::fromString(str);
+
+	// Output matches write() in both modes
+	for (bool pretty : { false, true }) {
+		std::stringstream expected;
+		val->write(pretty, expected);
+
+		Xela::Json::Writer writer(pretty);
+		writer.beginObject().key("List").beginArray();
+		writer.value(1).value(-2.5f).value("three");
+		writer.beginArray().endArray();
+		writer.beginObject().key("Empty").beginObject().endObject().endObject();
+		writer.value(true).null();
+		writer.endArray().endObject();
+		EXPECT_EQ(writer.str(), expected.str());
+
+		Xela::Json::Writer copy(pretty);
+		copy.value(*val);
+		EXPECT_EQ(copy.str(), expected.str());
+	}
+	Xela::Json::destroy(val);
+
+	// Text reaches the sink in chunks as it is written
+	std::vector<std::string> chunks;
+	{
+		Xela::Json::Writer writer([&](const char *data, size_t size) { chunks.emplace_back(data, size); }, false, 16);
+		writer.beginArray();
+		for (int i = 0; i < 10; i++) {
+			writer.value("value");
+		}
+		EXPECT_GE(chunks.size(), 3);
+		writer.endArray();
+	}
+	std::string joined;
+	for (std::string &chunk : chunks) {
+		EXPECT_LT(chunk.size(), 16 + 9);
+		joined += chunk;
+	}
+	EXPECT_EQ(joined, "[\"value\",\"value\",\"value\",\"value\",\"value\",\"value\",\"value\",\"value\",\"value\",\"value\"]");
+
+	// Quotes, backslashes and control characters are escaped the same way by write() and the writer, and read back
+	std::string awkward = "say \"hi\"\\\n\t\x01";
+	Xela::Json *text = Xela::Json::fromType(Xela::Json::Type::Object);
+	Xela::Json *member = Xela::Json::fromType(Xela::Json::Type::String);
+	member->asString() = awkward;
+	text->asObject().emplace(awkward, member);
+	for (bool pretty : { false, true }) {
+		std::stringstream expected;
+		text->write(pretty, expected);
+
+		Xela::Json::Writer writer(pretty);
+		writer.beginObject().key(awkward).value(awkward).endObject();
+		EXPECT_EQ(writer.str(), expected.str());
+
+		std::string written = writer.str();
+		Xela::Json *back = Xela::Json::fromString(written);
+		EXPECT_TRUE(Xela::Json::equals(back, text));
+		Xela::Json::destroy(back);
+	}
+	Xela::Json::destroy(text);
+
+	std::string escapes = R"(["\u00e9\u20ac\ud83d\ude00\u0041"])";
+	Xela::Json *unicode = Xela::Json::fromString(escapes);
+	EXPECT_EQ(unicode->asArray()[0]->asString(), "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80" "A");
+	Xela::Json::destroy(unicode);
+
+	// The destructor drops errors from the sink, which an explicit flush() reports
+	{
+		Xela::Json::Writer failing([](const char *, size_t) { throw std::runtime_error("full"); }, false);
+		failing.value("lost");
+		EXPECT_THROW(failing.flush(), std::runtime_error);
+	}
+
+#ifndef NDEBUG
+	Xela::Json::Writer invalid;
+	invalid.beginObject();
+	EXPECT_THROW(invalid.value(1), Xela::json_write_error);
+	EXPECT_THROW(invalid.endArray(), Xela::json_write_error);
+	invalid.key("One");
+	EXPECT_THROW(invalid.key("Two"), Xela::json_write_error);
+	invalid.value(1).endObject();
+	EXPECT_THROW(invalid.value(2), Xela::json_write_error);
+#endif
+}
+
+// Coroutine that starts immediately and is never awaited
+struct Detached {
+	struct promise_type {
+		Detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+Detached loadTwo(std::filesystem::path file, std::promise<long long> &result) {
+	Xela::Json *first = co_await Xela::Json::fromFileAsync(file);
+	Xela::Json *second = co_await Xela::Json::fromFileAsync(file);
+	result.set_value((*first)("Two").asInt() + (*second)("Two").asInt());
+	Xela::Json::destroy(first);
+	Xela::Json::destroy(second);
+}
+
+TEST(Json, Async) {
+	std::filesystem::path file = std::filesystem::current_path() / "in.jx";
+
+	// Blocking wait
+	Xela::Json *val = Xela::Json::fromFileAsync(file).get();
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ((*val)("One").asString(), "hi");
+	Xela::Json::destroy(val);
+
+	// Coroutine
+	std::promise<long long> sum;
+	std::future<long long> result = sum.get_future();
+	loadTwo(file, sum);
+	EXPECT_EQ(result.get(), 4);
+
+	// Callback, with errors passed along instead of thrown
+	std::promise<std::exception_ptr> failed;
+	Xela::Json::fromFileAsync(std::filesystem::current_path() / "missing.jx", {}, [&](Xela::Json *json, std::exception_ptr error) {
+		EXPECT_EQ(json, nullptr);
+		failed.set_value(error);
+	});
+	EXPECT_THROW(std::rethrow_exception(failed.get_future().get()), Xela::json_file_error);
+
+	// Many loads in flight at once on a private pool
+	Xela::ThreadPool pool(2);
+	std::vector<Xela::Json::Loading> loads;
+	for (int i = 0; i < 32; i++) {
+		loads.push_back(Xela::Json::fromFileAsync(file, {}, Xela::IoBackend::shared(), pool));
+	}
+	for (Xela::Json::Loading &load : loads) {
+		val = load.get();
+		EXPECT_EQ((*val)("Two").asInt(), 2);
+		Xela::Json::destroy(val);
+	}
+}
+TEST(Json, Resource) {
+	std::string str = "{ \"One\": [ 1, 2.5, \"hi\", true ], \"Two\": { \"Three\": null } }";
+
+	// Everything must fit in the buffer, since the upstream resource refuses to allocate
+	alignas(std::max_align_t) static char buffer[1 << 14];
+	std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+	Xela::Json::ParseOptions options;
+	options.resource = &arena;
+
+	Xela::Json *val = Xela::Json::fromString(str, options);
+	ASSERT_NE(val, nullptr);
+	EXPECT_TRUE((char *)val >= buffer && (char *)val < buffer + sizeof(buffer));
+	EXPECT_EQ((*val)("One")[1].asFloat(), 2.5f);
+	EXPECT_EQ((*val)("One")[2].asString(), "hi");
+
+	// Nodes from the heap and from a resource may be mixed and are each freed where they came from
+	val->asObject()["Four"] = Xela::Json::fromType(Xela::Json::Type::Integer);
+	Xela::Json::destroy(val);
+
+	// Threads share the resource, so it has to be a synchronized one
+	std::pmr::synchronized_pool_resource pool;
+	options.resource = &pool;
+	options.threads = 2;
+	std::string arr = "[ { \"a\": 1 }, [ 2 ], 3, \"four\" ]";
+	val = Xela::Json::fromString(arr, options);
+	ASSERT_EQ(val->size(), 4);
+	EXPECT_EQ(val->at(0)("a").asInt(), 1);
+	delete val->asArray()[3];
+	val->asArray().pop_back();
+	Xela::Json::destroy(val);
+}
+TEST(Json, Stats) {
+	std::string str = "{ \"One\": [ 1, 2.5, \"hi\", [ true ] ], \"Two\": null }";
+
+	Xela::Json::Stats stats;
+	Xela::Json::ParseOptions options;
+	options.stats = &stats;
+
+	Xela::Json *val = Xela::Json::fromString(str, options);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(stats.bytes, str.size());
+	EXPECT_EQ(stats.nodes[(size_t)Xela::Json::Type::Object], 1);
+	EXPECT_EQ(stats.nodes[(size_t)Xela::Json::Type::Array], 2);
+	EXPECT_EQ(stats.nodes[(size_t)Xela::Json::Type::Null], 1);
+	EXPECT_EQ(stats.total(), 8);
+	EXPECT_EQ(stats.maxDepth, 4);
+	EXPECT_EQ(stats.allocations, 15);
+	Xela::Json::destroy(val);
+
+	// Split across threads, counted as if parsed in one piece
+	std::string arr = "[ [ [ 1 ] ], 2, { \"a\": 3 }, 4 ]";
+	options.threads = 3;
+	val = Xela::Json::fromString(arr, options);
+	EXPECT_EQ(stats.total(), 8);
+	EXPECT_EQ(stats.maxDepth, 4);
+	Xela::Json::destroy(val);
+}
+TEST(Json, Batch) {
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / "xela_batch";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir / "nested");
+
+	for (int i = 0; i < 20; i++) {
+		std::ofstream(dir / ("file" + std::to_string(i) + ".jx")) << "{ \"Index\": " << i << " }";
+	}
+	std::ofstream(dir / "nested" / "broken.jx") << "{ \"Index\": ";
+	std::ofstream(dir / "skipped.txt") << "{}";
+
+	// Glob matching, recursive and sorted
+	std::vector<std::filesystem::path> files = Xela::Batch::find(dir, "*.jx");
+	ASSERT_EQ(files.size(), 21);
+	EXPECT_TRUE(std::is_sorted(files.begin(), files.end()));
+	EXPECT_EQ(Xela::Batch::find(dir, "file?.jx").size(), 10);
+
+	// Results in order, with failures kept per file
+	files.push_back(dir / "missing.jx");
+	Xela::ThreadPool pool(3);
+	std::vector<Xela::Json::Loaded> loaded = Xela::Json::fromFiles(files, {}, pool);
+	ASSERT_EQ(loaded.size(), files.size());
+
+	size_t parsed = 0;
+	for (size_t i = 0; i < loaded.size(); i++) {
+		EXPECT_EQ(loaded[i].file, files[i]);
+
+		if (loaded[i].file.filename() == "broken.jx") {
+			EXPECT_THROW(std::rethrow_exception(loaded[i].error), Xela::json_parse_error);
+		}
+		else if (loaded[i].file.filename() == "missing.jx") {
+			EXPECT_THROW(std::rethrow_exception(loaded[i].error), Xela::json_file_error);
+		}
+		else {
+			ASSERT_NE(loaded[i].json, nullptr);
+			EXPECT_EQ(loaded[i].file.stem(), "file" + std::to_string((*loaded[i].json)("Index").asInt()));
+			parsed++;
+
+			// Each tree has an arena of its own, which stays usable after the batch
+			loaded[i].json->asObject().emplace(std::string(64, 'k'), Xela::Json::copy(loaded[i].json));
+		}
+		Xela::Json::destroy(loaded[i].json);
+	}
+	EXPECT_EQ(parsed, 20);
+
+	// Nested batches from a pool thread
+	std::atomic<size_t> count = 0;
+	pool.run(4, [&](size_t, size_t) {
+		pool.run(8, [&](size_t, size_t worker) {
+			EXPECT_LE(worker, pool.size());
+			count++;
+		});
+	});
+	EXPECT_EQ(count, 32);
+
+	std::filesystem::remove_all(dir);
+}
 
 // TODO - Test XML read/write
 TEST(Xml, Root) {
@@ -496,12 +1256,756 @@ TEST(Xml, Comment) {
 	ASSERT_EQ(comment->getAttributes().size(), 0);
 	ASSERT_EQ(comment->getChildren().size(), 0);
 }
+TEST(Xml, Depth) {
+	const size_t depth = 10000;
+	std::string str = "";
+	for (size_t i = 0; i < depth; i++) {
+		str += "<a>";
+	}
+	for (size_t i = 0; i < depth; i++) {
+		str += "</a>";
+	}
+
+	EXPECT_THROW(Xela::Xml::fromString(str), xml_parse_error);
+
+	Xela::Xml::ParseOptions options;
+	options.maxDepth = depth;
+	Xela::Xml *val = Xela::Xml::fromString(str, options);
+
+	ASSERT_NE(val, nullptr);
+
+	size_t count = 1;
+	for (Xela::Xml *curr = val; curr->getChildren().size() != 0; curr = curr->getChildren().find("a")->second[0]) {
+		count++;
+	}
+	EXPECT_EQ(count, depth);
+
+	delete val;
+
+	std::string mismatch = "<a><b></a>";
+	EXPECT_THROW(Xela::Xml::fromString(mismatch), xml_parse_error);
+}
+TEST(Xml, Order) {
+	std::string str = "<xml><a/><b/><!-- c --><a/><d/></xml>";
+
+	Xela::Xml *val = Xela::Xml::fromString(str);
+	ASSERT_NE(val, nullptr);
+
+	// Mixed siblings keep document order
+	std::vector<std::string> order;
+	for (Xela::Xml *child = val->getFirstChild(); child != nullptr; child = child->getNextSibling()) {
+		EXPECT_EQ(child->getParent(), val);
+		order.push_back(child->isComment() ? "!" : std::string(child->getType()));
+	}
+	EXPECT_EQ(order, std::vector<std::string>({ "a", "b", "!", "a", "d" }));
+	EXPECT_EQ(val->getChildCount(), 5);
+	EXPECT_EQ(val->getLastChild()->getPrevSibling()->getPrevSibling()->getComment(), " c ");
+
+	// The index follows adds and removes once built
+	EXPECT_EQ(val->getChildren().at("a").size(), 2);
+	Xela::Xml *b = val->getChildren().at("b")[0];
+	val->removeChild(b);
+	EXPECT_EQ(b->getParent(), nullptr);
+	EXPECT_EQ(val->getChildren().count("b"), 0);
+	EXPECT_EQ(val->getChildCount(), 4);
+
+	Xela::Xml *first = val->getFirstChild();
+	b->addChild(first);
+	EXPECT_EQ(first->getParent(), b);
+	EXPECT_EQ(val->getChildren().at("a").size(), 1);
+	EXPECT_EQ(val->getFirstChild()->getComment(), " c ");
+
+	val->addChild(b);
+	EXPECT_EQ(val->getLastChild(), b);
+	EXPECT_EQ(val->getChildren().at("b")[0], b);
+
+	// Renaming rebuilds the index, and deleting a child detaches it
+	b->setType("e");
+	EXPECT_EQ(val->getChildren().count("b"), 0);
+	EXPECT_EQ(val->getChildren().at("e")[0], b);
+
+	delete b;
+	EXPECT_EQ(val->getChildCount(), 3);
+	EXPECT_EQ(val->getChildren().count("e"), 0);
+	EXPECT_EQ(val->getLastChild()->getType(), "d");
+
+	delete val;
+}
+TEST(Xml, Buffer) {
+	// Only the first document in the buffer is read
+	const char text[] = "<xml id = \"root\" kind=\"a - b\">\n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t<a/>\r\n<!-- - -- --->  </xml > <tail>";
+	std::string_view buffer(text, sizeof(text) - 1 - 6);
+
+	Xela::Xml *val = Xela::Xml::fromBuffer(buffer);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(val->getType(), "xml");
+	EXPECT_EQ(val->getAttributes().size(), 2);
+	EXPECT_EQ(val->findAttribute("id")->value, "root");
+	EXPECT_EQ(val->findAttribute("kind")->value, "a - b");
+	EXPECT_EQ(val->getChildren().at("a").size(), 1);
+	EXPECT_EQ(val->getChildren().at("")[0]->getComment(), " - -- -");
+	delete val;
+
+	// Strings, comments and identifiers cut off by the end of the buffer
+	EXPECT_THROW(Xela::Xml::fromBuffer("<xml id=\"root></xml>"), xml_parse_error);
+	EXPECT_THROW(Xela::Xml::fromBuffer("<xml><!-- c --</xml>"), xml_parse_error);
+	EXPECT_THROW(Xela::Xml::fromBuffer("<xml"), xml_parse_error);
+	EXPECT_THROW(Xela::Xml::fromBuffer("<xml i-d=\"1\"></xml>"), xml_parse_error);
+	EXPECT_THROW(Xela::Xml::fromBuffer(std::string_view("<xml></xml>", 8)), xml_parse_error);
+}
+TEST(Xml, Reader) {
+	std::string str = "<?xml version=\"1.0\"?>\n<feed>\n\t<record id=\"1\" kind=\"a > b\"><name/>first</record>\n\t<!-- skip -->\n"
+		"\t<record id=\"2\"><name></name><value><unit/></value><!-- c --></record>\n</feed>\n";
+
+	// Refilled a few bytes at a time so tokens straddle the buffer
+	size_t read = 0;
+	Xela::Xml::Reader reader([&](char *data, size_t size) {
+		size_t count = std::min<size_t>({ size, 3, str.size() - read });
+		std::memcpy(data, str.data() + read, count);
+		read += count;
+		return count;
+	}, Xela::Xml::ParseOptions(), 4);
+
+	using Event = Xela::Xml::Reader::Event;
+	std::vector<std::string> events;
+	Xela::Xml *record = nullptr;
+	for (Event event = reader.next(); event != Event::End; event = reader.next()) {
+		switch (event) {
+		case Event::StartElement:
+			if (reader.name() == "record" && reader.findAttribute("id")->value == "2") {
+				EXPECT_EQ(reader.depth(), 2);
+				record = reader.subtree();
+				EXPECT_EQ(reader.event(), Event::EndElement);
+				events.push_back("subtree");
+			}
+			else {
+				events.push_back("<" + std::string(reader.name()) + ">");
+				for (auto &attr : reader.attributes()) {
+					events.push_back(std::string(attr.name) + "=" + std::string(attr.value));
+				}
+			}
+			break;
+		case Event::EndElement:
+			events.push_back("</" + std::string(reader.name()) + ">");
+			break;
+		case Event::Comment:
+			events.push_back("!" + std::string(reader.text()));
+			break;
+		case Event::Text:
+			events.push_back(std::string(reader.text()));
+			break;
+		default:
+			break;
+		}
+	}
+
+	std::vector<std::string> expected = { "<feed>", "<record>", "id=1", "kind=a > b", "<name>", "</name>", "first", "</record>",
+		"! skip ", "subtree", "</feed>" };
+	EXPECT_EQ(events, expected);
+
+	ASSERT_NE(record, nullptr);
+	EXPECT_EQ(record->getType(), "record");
+	EXPECT_EQ(record->findAttribute("id")->value, "2");
+	EXPECT_EQ(record->getChildren().at("value")[0]->getChildren().at("unit").size(), 1);
+	EXPECT_EQ(record->getChildren().at("")[0]->getComment(), " c ");
+	delete record;
+
+	// Skipping an element, and errors
+	Xela::Xml::Reader skipping(std::string_view("<a><b><c/></b><d/></a>"));
+	skipping.next();
+	skipping.next();
+	skipping.skip();
+	EXPECT_EQ(skipping.name(), "b");
+	EXPECT_EQ(skipping.next(), Event::StartElement);
+	EXPECT_EQ(skipping.name(), "d");
+
+	auto drain = [](std::string_view text) {
+		Xela::Xml::Reader reader(text);
+		while (reader.next() != Event::End) {}
+	};
+	EXPECT_THROW(drain("<a><b></a>"), xml_parse_error);
+	EXPECT_THROW(drain("<a><b>"), xml_parse_error);
+	EXPECT_THROW(drain("<a><!-- x</a>"), xml_parse_error);
+	EXPECT_THROW(drain("text<a/>"), xml_parse_error);
+}
+TEST(Xml, Attributes) {
+	Xela::Xml *val = new Xela::Xml();
+	val->setType("a_fairly_long_tag_name_past_any_small_string_buffer");
+	val->setType(val->getType());
+	EXPECT_EQ(val->getType(), "a_fairly_long_tag_name_past_any_small_string_buffer");
+	EXPECT_EQ(val->getTypeId(), Xela::Xml::Names::npos);
+
+	// Attributes keep the order they were added in, and the first value of a key wins
+	val->addAttribute("b", "1");
+	val->addAttribute("a", "2");
+	val->addAttribute("c", "3");
+	val->addAttribute("a", "4");
+	ASSERT_EQ(val->getAttributes().size(), 3);
+	EXPECT_EQ(val->getAttributes()[1].name, "a");
+	EXPECT_EQ(val->findAttribute("a")->value, "2");
+	EXPECT_EQ(val->findAttribute("d"), nullptr);
+
+	val->removeAttribute("b");
+	ASSERT_EQ(val->getAttributes().size(), 2);
+	EXPECT_EQ(val->getAttributes()[0].name, "a");
+	EXPECT_EQ(val->getAttributes()[1].value, "3");
+
+	delete val;
+}
+TEST(Xml, Document) {
+	std::string str = "<xml a=\"1\"><item id=\"1\"/><item id=\"2\" a=\"x\"/><!-- comment --></xml>";
+
+	Xela::Xml::Document doc;
+	Xela::Xml *val = doc.parse(str);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(doc.getRoot(), val);
+	EXPECT_EQ(val->getNames(), &doc.getNames());
+
+	// Each distinct name is stored once, and shared by id
+	Xela::Xml::Names &names = doc.getNames();
+	EXPECT_EQ(names.size(), 4);
+	Xela::Xml *first = val->getFirstChild();
+	Xela::Xml *second = first->getNextSibling();
+	EXPECT_EQ(first->getTypeId(), names.find("item"));
+	EXPECT_EQ(first->getType().data(), second->getType().data());
+	EXPECT_EQ(first->getAttributes()[0].id, second->getAttributes()[0].id);
+	EXPECT_EQ(val->getAttributes()[0].id, second->findAttribute("a")->id);
+	EXPECT_EQ(second->findAttribute("a")->value, "x");
+	EXPECT_EQ(second->findAttribute("missing"), nullptr);
+	EXPECT_EQ(val->getLastChild()->getComment(), " comment ");
+	EXPECT_EQ(val->getLastChild()->getTypeId(), Xela::Xml::Names::npos);
+
+	// Nodes made by hand share the table
+	Xela::Xml *added = doc.create();
+	added->setType("item");
+	added->addAttribute("id", "3");
+	val->addChild(added);
+	EXPECT_EQ(added->getTypeId(), first->getTypeId());
+	EXPECT_EQ(names.size(), 4);
+	EXPECT_EQ(val->getChildren().at("item").size(), 3);
+
+	// Names too long to fit in a string are indexed in the arena as well, so clearing frees them
+	std::string longNames = "<root><a_rather_long_element_name/><a_rather_long_element_name/></root>";
+	val = doc.parse(longNames);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(val->getChildren().at("a_rather_long_element_name").size(), 2);
+
+	// Parsing again replaces everything
+	std::string other = "<other/>";
+	val = doc.parse(other);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(names.size(), 1);
+	EXPECT_EQ(val->getTypeId(), 0);
+	EXPECT_EQ(names.name(0), "other");
+}
+TEST(Xml, Borrow) {
+	std::string str = "<xml a=\"1\"><item id=\"2\"/><!-- comment --></xml>";
+	auto inside = [&str](std::string_view view) {
+		return view.data() >= str.data() && view.data() + view.size() <= str.data() + str.size();
+	};
+
+	Xela::Xml::ParseOptions options;
+	options.borrow = true;
+	Xela::Xml *val = Xela::Xml::fromString(str, options);
+	ASSERT_NE(val, nullptr);
+
+	// Names, values and comments all point into the input
+	Xela::Xml *item = val->getFirstChild();
+	EXPECT_TRUE(inside(val->getType()));
+	EXPECT_TRUE(inside(item->getAttributes()[0].name));
+	EXPECT_TRUE(inside(item->findAttribute("id")->value));
+	EXPECT_TRUE(inside(val->getLastChild()->getComment()));
+	EXPECT_EQ(item->findAttribute("id")->value, "2");
+
+	// Edits copy, and borrowed strings are never freed
+	item->setType("other");
+	EXPECT_FALSE(inside(item->getType()));
+	item->addAttribute("b", "3");
+	EXPECT_FALSE(inside(item->findAttribute("b")->value));
+	item->removeAttribute("id");
+	EXPECT_EQ(item->getAttributes().size(), 1);
+	val->getLastChild()->setComment("changed");
+	delete val;
+
+	// A document reading a file borrows from its own copy
+	std::filesystem::path file = std::filesystem::temp_directory_path() / "xela_borrow.xml";
+	std::ofstream(file) << str;
+	Xela::Xml::Document doc;
+	val = doc.parseFile(file);
+	std::filesystem::remove(file);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(val->getFirstChild()->findAttribute("id")->value, "2");
+	EXPECT_EQ(val->getLastChild()->getComment(), " comment ");
+
+	// Values from a reader over a buffer do too
+	Xela::Xml::Reader reader(std::string_view(str), options);
+	ASSERT_EQ(reader.next(), Xela::Xml::Reader::Event::StartElement);
+	val = reader.subtree();
+	EXPECT_TRUE(inside(val->findAttribute("a")->value));
+	delete val;
+}
+TEST(Xml, Text) {
+	std::string str = "<p t=\"say &quot;hi&quot; &#x1F600;\">Fish &amp; chips &lt;3 &#65;&#x42; caf&#xE9;<b>bold</b> tail "
+		"<![CDATA[<raw> & stuff]]></p>";
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions options;
+	options.borrow = true;
+	options.stats = &stats;
+	Xela::Xml *val = Xela::Xml::fromString(str, options);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(val->findAttribute("t")->value, "say \"hi\" \xF0\x9F\x98\x80");
+
+	// Text sits among the elements in document order, and CDATA is kept as written
+	std::vector<std::string> children;
+	for (Xela::Xml *child = val->getFirstChild(); child != nullptr; child = child->getNextSibling()) {
+		children.push_back(child->isText() ? std::string(child->getText()) : "<" + std::string(child->getType()) + ">");
+	}
+	EXPECT_EQ(children, (std::vector<std::string>{ "Fish & chips <3 AB caf\xC3\xA9", "<b>", " tail ", "<raw> & stuff" }));
+	EXPECT_EQ(val->getChildren().at("b")[0]->getFirstChild()->getText(), "bold");
+	EXPECT_EQ(val->getChildren().at("").size(), 3);
+	EXPECT_EQ(stats.texts, 4);
+
+	// Only text that needed decoding is copied
+	Xela::Xml *tail = val->getChildren().at("b")[0]->getNextSibling();
+	EXPECT_TRUE(tail->getText().data() > str.data() && tail->getText().data() < str.data() + str.size());
+	EXPECT_FALSE(val->getFirstChild()->getText().data() > str.data() && val->getFirstChild()->getText().data() < str.data() + str.size());
+
+	tail->setComment(" now a comment ");
+	EXPECT_FALSE(tail->isText());
+	EXPECT_EQ(tail->getText(), "");
+	delete val;
+
+	// Indentation is dropped unless asked for
+	std::string indented = "<a>\n\t<b/>\n</a>";
+	val = Xela::Xml::fromString(indented);
+	EXPECT_EQ(val->getChildCount(), 1);
+	delete val;
+	options = Xela::Xml::ParseOptions();
+	options.keepWhitespace = true;
+	val = Xela::Xml::fromString(indented, options);
+	EXPECT_EQ(val->getChildCount(), 3);
+	EXPECT_EQ(val->getFirstChild()->getText(), "\n\t");
+	delete val;
+
+	// Declarations and processing instructions are skipped, as the reader skips them
+	std::string declared = "<?xml version=\"1.0\"?>\n<?style href=\"a?b\"?>\n<a>x<?pi a > b?>y<b/></a>";
+	val = Xela::Xml::fromString(declared);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(val->getType(), "a");
+	EXPECT_EQ(val->getChildCount(), 3);
+	EXPECT_EQ(val->getFirstChild()->getText(), "x");
+	delete val;
+
+	for (std::string bad : { "<a>&bogus;</a>", "<a>&#0;</a>", "<a t=\"&#xD800;\"/>", "<a>&amp</a>", "<a><![CDATA[open</a>", "<![CDATA[x]]>", "<?xml?>", "<a><?pi</a>" }) {
+		EXPECT_THROW(Xela::Xml::fromString(bad), xml_parse_error) << bad;
+	}
+
+	// The reader decodes the same way
+	Xela::Xml::Reader reader{ std::string_view(str) };
+	std::vector<std::string> texts;
+	for (auto event = reader.next(); event != Xela::Xml::Reader::Event::End; event = reader.next()) {
+		if (event == Xela::Xml::Reader::Event::Text) {
+			texts.push_back(std::string(reader.text()));
+		}
+	}
+	EXPECT_EQ(texts, (std::vector<std::string>{ "Fish & chips <3 AB caf\xC3\xA9", "bold", " tail ", "<raw> & stuff" }));
+}
+TEST(Xml, Write) {
+	std::string str = "<doc a=\"x &amp; &quot;y&quot;\"><item id=\"1\"/><!-- note --><p>Fish &amp; <b>chips</b> &lt;3</p><empty></empty></doc>";
+	Xela::Xml *val = Xela::Xml::fromString(str);
+	ASSERT_NE(val, nullptr);
+
+	// Compact output is the input back, with empty elements closed in place
+	std::stringstream compact;
+	val->write(false, compact);
+	EXPECT_EQ(compact.str(), "<doc a=\"x &amp; &quot;y&quot;\"><item id=\"1\"/><!-- note --><p>Fish &amp; <b>chips</b> &lt;3</p><empty/></doc>");
+
+	// Pretty output indents everything but the inside of elements holding text
+	std::stringstream pretty;
+	val->write(true, pretty);
+	EXPECT_EQ(pretty.str(), "<doc a=\"x &amp; &quot;y&quot;\">\n\t<item id=\"1\"/>\n\t<!-- note -->\n\t<p>Fish &amp; <b>chips</b> &lt;3</p>\n\t<empty/>\n</doc>");
+
+	// Both parse back to the same tree
+	for (std::string text : { compact.str(), pretty.str() }) {
+		Xela::Xml *copy = Xela::Xml::fromString(text);
+		std::stringstream again;
+		copy->write(false, again);
+		EXPECT_EQ(again.str(), compact.str());
+		delete copy;
+	}
+
+	// The writer builds the same text without a tree
+	Xela::Xml::Writer writer;
+	writer.beginElement("doc").attribute("a", "x & \"y\"");
+	writer.beginElement("item").attribute("id", "1").endElement();
+	writer.comment(" note ");
+	writer.beginElement("p").text("Fish & ").beginElement("b").text("chips").endElement().text(" <3").endElement();
+	writer.beginElement("empty").endElement();
+	writer.endElement();
+	EXPECT_EQ(writer.str(), compact.str());
+
+	// Files go through the same path
+	std::filesystem::path file = std::filesystem::temp_directory_path() / "xela_write.xml";
+	val->writeFile(file, true);
+	delete val;
+	val = Xela::Xml::fromFile(file);
+	std::filesystem::remove(file);
+	std::stringstream reread;
+	val->write(false, reread);
+	EXPECT_EQ(reread.str(), compact.str());
+	delete val;
+
+	// Text reaches the sink in chunks as it is written
+	std::string joined;
+	size_t chunks = 0;
+	{
+		Xela::Xml::Writer chunked([&](const char *data, size_t size) { joined.append(data, size); chunks++; }, false, 16);
+		chunked.beginElement("list");
+		for (int i = 0; i < 10; i++) {
+			chunked.beginElement("value").text("v").endElement();
+		}
+		EXPECT_GE(chunks, 3);
+		chunked.endElement();
+	}
+	EXPECT_EQ(joined.size(), 13 + 10 * 16);
+
+	// The destructor drops errors from the sink, which an explicit flush() reports
+	{
+		Xela::Xml::Writer failing([](const char *, size_t) { throw std::runtime_error("full"); }, false);
+		failing.beginElement("lost").endElement();
+		EXPECT_THROW(failing.flush(), std::runtime_error);
+	}
+
+#ifndef NDEBUG
+	Xela::Xml::Writer invalid;
+	EXPECT_THROW(invalid.text("outside"), xml_write_error);
+	EXPECT_THROW(invalid.endElement(), xml_write_error);
+	invalid.beginElement("a").text("x");
+	EXPECT_THROW(invalid.attribute("b", "c"), xml_write_error);
+	invalid.endElement();
+	EXPECT_THROW(invalid.beginElement("second"), xml_write_error);
+#endif
+}
+TEST(Xml, Query) {
+	std::string str = "<lib><shelf id=\"a\"><book id=\"1\" lang=\"en\"/><book id=\"2\"/><!-- c --><box><book id=\"3\" lang=\"fr\"/></box></shelf>"
+		"<shelf id=\"b\"><book id=\"4\" lang=\"en\"/></shelf></lib>";
+	Xela::Xml *val = Xela::Xml::fromString(str);
+	ASSERT_NE(val, nullptr);
+
+	auto ids = [](const std::vector<Xela::Xml *> &nodes) {
+		std::string ret;
+		for (Xela::Xml *node : nodes) {
+			ret += node->findAttribute("id")->value;
+		}
+		return ret;
+	};
+	auto select = [&](std::string_view path, Xela::Xml *context) {
+		return ids(Xela::Xml::Query::compile(path).select(context));
+	};
+
+	EXPECT_EQ(select("/lib/shelf", val), "ab");
+	EXPECT_EQ(select("/lib/shelf/book", val), "124");
+	EXPECT_EQ(select("//book", val), "1234");
+	EXPECT_EQ(select("//shelf//book", val), "1234");
+	EXPECT_EQ(select("/lib/*/book[@lang]", val), "14");
+	EXPECT_EQ(select("//book[@lang='en']", val), "14");
+	EXPECT_EQ(select("//book[ @lang != \"en\" ]", val), "3");
+	EXPECT_EQ(select("/lib/shelf[@id='a']/book[2]", val), "2");
+	EXPECT_EQ(select("//book[1]", val), "134");
+	EXPECT_EQ(select("/shelf", val), "");
+
+	// Relative paths start below the context, and absolute ones from its root
+	Xela::Xml *shelf = val->getChildren().at("shelf")[0];
+	EXPECT_EQ(select("book", shelf), "12");
+	EXPECT_EQ(select("box/book", shelf), "3");
+	EXPECT_EQ(select("/lib/shelf[@id='b']/book", shelf), "4");
+
+	Xela::Xml::Query query = Xela::Xml::Query::compile("//book[@lang='en']");
+	EXPECT_EQ(query.first(val)->findAttribute("id")->value, "1");
+	EXPECT_EQ(Xela::Xml::Query::compile("//missing").first(val), nullptr);
+	delete val;
+
+	// Streaming builds only the matches, each with its descendants
+	std::vector<Xela::Xml *> streamed;
+	Xela::Xml::Reader reader{ std::string_view(str) };
+	Xela::Xml::Query::compile("//book[@lang] ").select(reader, [&](Xela::Xml *match) { streamed.push_back(match); });
+	EXPECT_EQ(ids(streamed), "134");
+	for (Xela::Xml *match : streamed) {
+		delete match;
+	}
+	streamed.clear();
+
+	Xela::Xml::Reader shelves{ std::string_view(str) };
+	Xela::Xml::Query::compile("/lib/shelf[1]").select(shelves, [&](Xela::Xml *match) { streamed.push_back(match); });
+	ASSERT_EQ(ids(streamed), "a");
+	EXPECT_EQ(streamed[0]->getChildren().at("box")[0]->getChildren().at("book").size(), 1);
+	delete streamed[0];
+
+	for (std::string_view path : { "", "/", "a/", "a b", "a[", "a[@]", "a[@b=c]", "a[@b='c]", "a[0]", "a[x]" }) {
+		EXPECT_THROW(Xela::Xml::Query::compile(path), xml_query_error) << path;
+	}
+}
+TEST(Xml, Keys) {
+	std::string str = "<lib><shelf id=\"a\"><book id=\"1\" isbn=\"x\"/><book id=\"2\" isbn=\"x\"/></shelf><shelf id=\"b\"/></lib>";
+	Xela::Xml::Keys keys{ "id", "isbn" };
+	Xela::Xml::ParseOptions options;
+	options.keys = &keys;
+	Xela::Xml *val = Xela::Xml::fromString(str, options);
+	ASSERT_NE(val, nullptr);
+
+	EXPECT_EQ(keys.size(), 6);
+	Xela::Xml *book = keys.find("id", "2");
+	ASSERT_NE(book, nullptr);
+	EXPECT_EQ(book->getType(), "book");
+	EXPECT_EQ(keys.find("id", "3"), nullptr);
+	EXPECT_EQ(keys.find("kind", "a"), nullptr);
+	EXPECT_EQ(keys.findAll("isbn", "x").size(), 2);
+
+	// Attribute edits are followed
+	book->removeAttribute("id");
+	EXPECT_EQ(keys.find("id", "2"), nullptr);
+	book->addAttribute("id", "3");
+	EXPECT_EQ(keys.find("id", "3"), book);
+
+	// Detached subtrees leave, and join again when added back
+	Xela::Xml *shelf = keys.find("id", "a");
+	val->removeChild(shelf);
+	EXPECT_EQ(keys.find("id", "1"), nullptr);
+	EXPECT_EQ(keys.findAll("isbn", "x").size(), 0);
+	keys.find("id", "b")->addChild(shelf);
+	EXPECT_EQ(keys.find("id", "1")->getParent(), shelf);
+	EXPECT_EQ(keys.size(), 6);
+
+	// Nodes built by hand join when added under an indexed element
+	Xela::Xml *extra = new Xela::Xml();
+	extra->setType("book");
+	extra->addAttribute("id", "4");
+	EXPECT_EQ(keys.find("id", "4"), nullptr);
+	shelf->addChild(extra);
+	EXPECT_EQ(keys.find("id", "4"), extra);
+	delete extra;
+	EXPECT_EQ(keys.find("id", "4"), nullptr);
+
+	delete val;
+	EXPECT_EQ(keys.size(), 0);
+
+	// Documents fill the table too, which is cleared along with them
+	Xela::Xml::Document document;
+	document.parse(str, options);
+	EXPECT_EQ(keys.find("id", "b")->getType(), "shelf");
+	keys.clear();
+	document.clear();
+	EXPECT_EQ(keys.size(), 0);
+}
+TEST(Xml, Parallel) {
+	std::string str = "<?xml version=\"1.0\"?>\n<records version=\"2\">\n";
+	for (size_t i = 0; i < 1000; i++) {
+		str += "\t<record id=\"" + std::to_string(i) + "\" note=\"a > b\" path=\"</records>\"><name>n &amp; " + std::to_string(i) + "</name>"
+			"<!-- <records> --><data><![CDATA[</record>]]></data><?pi <record> ?><empty/></record>\n";
+	}
+	str += "\ttail text\n</records>\n";
+
+	auto write = [](Xela::Xml *xml) {
+		std::stringstream out;
+		xml->write(false, out);
+		return out.str();
+	};
+
+	Xela::Xml::Stats sequentialStats, parallelStats;
+	Xela::Xml::SourceMap sequentialMap, parallelMap;
+	Xela::Xml::ParseOptions options;
+	options.stats = &sequentialStats;
+	options.locations = &sequentialMap;
+	Xela::Xml *sequential = Xela::Xml::fromString(str, options);
+
+	options.threads = 4;
+	options.stats = &parallelStats;
+	options.locations = &parallelMap;
+	Xela::Xml *parallel = Xela::Xml::fromString(str, options);
+
+	ASSERT_NE(parallel, nullptr);
+	EXPECT_EQ(write(parallel), write(sequential));
+	EXPECT_EQ(parallel->getChildCount(), 1001);
+	EXPECT_EQ(parallel->getChildren().at("record").size(), 1000);
+	EXPECT_EQ(parallel->getLastChild()->getText(), "\n\ttail text\n");
+	EXPECT_EQ(parallel->getLastChild()->getPrevSibling()->getParent(), parallel);
+
+	// Counted and located as if parsed in one piece
+	EXPECT_EQ(parallelStats.tags, sequentialStats.tags);
+	EXPECT_EQ(parallelStats.comments, sequentialStats.comments);
+	EXPECT_EQ(parallelStats.texts, sequentialStats.texts);
+	EXPECT_EQ(parallelStats.maxDepth, sequentialStats.maxDepth);
+	EXPECT_EQ(parallelStats.bytes, str.size());
+	EXPECT_EQ(parallelMap.size(), sequentialMap.size());
+	Xela::Xml *record = parallel->getChildren().at("record")[700];
+	EXPECT_EQ(parallelMap.offset(record), sequentialMap.offset(sequential->getChildren().at("record")[700]));
+	delete sequential;
+	delete parallel;
+
+	// Runs can go on a pool of the caller's, and their trees can still grow once the parse is done
+	Xela::ThreadPool pool(2);
+	Xela::Xml::ParseOptions poolOptions;
+	poolOptions.threads = 4;
+	poolOptions.pool = &pool;
+	parallel = Xela::Xml::fromString(str, poolOptions);
+	ASSERT_EQ(parallel->getChildCount(), 1001);
+	record = parallel->getChildren().at("record")[999];
+	for (size_t i = 0; i < 100; i++) {
+		record->addAttribute("added" + std::to_string(i), "value " + std::to_string(i));
+	}
+	delete record->getFirstChild();
+	EXPECT_EQ(record->getAttributes().size(), 103);
+	EXPECT_EQ(record->getChildCount(), 3);
+	delete parallel;
+
+	// Documents give each thread its own arena, and names end up with the ids a sequential parse gives them
+	Xela::Xml::Keys keys{ "id" };
+	Xela::Xml::ParseOptions documentOptions;
+	documentOptions.threads = 3;
+	documentOptions.keys = &keys;
+	Xela::Xml::Document document;
+	Xela::Xml *root = document.parse(str, documentOptions);
+	EXPECT_EQ(document.getNames().find("records"), 0);
+	EXPECT_EQ(document.getNames().find("record"), 2);
+	record = keys.find("id", "999");
+	ASSERT_NE(record, nullptr);
+	EXPECT_EQ(record->getTypeId(), 2);
+	EXPECT_EQ(record->getParent(), root);
+	EXPECT_EQ(record->findAttribute("path")->value, "</records>");
+	EXPECT_EQ(keys.size(), 1000);
+	keys.clear();
+	document.clear();
+
+	// Errors match the sequential parser
+	std::string bad = str;
+	bad.replace(bad.find("<empty/>", bad.size() / 2), 8, "<empty>");
+	std::string sequentialError, parallelError;
+	try {
+		Xela::Xml::fromString(bad);
+	}
+	catch (xml_parse_error &err) {
+		sequentialError = err.what();
+	}
+	try {
+		Xela::Xml::fromString(bad, options);
+	}
+	catch (xml_parse_error &err) {
+		parallelError = err.what();
+	}
+	EXPECT_NE(sequentialError, "");
+	EXPECT_EQ(sequentialError, parallelError);
+
+	// A root without children to split is parsed sequentially
+	std::string small = "<a/>";
+	Xela::Xml *single = Xela::Xml::fromString(small, options);
+	EXPECT_EQ(single->getType(), "a");
+	delete single;
+}
+TEST(Xml, Resource) {
+	std::string str = "<xml><b></b><b></b><!-- c --></xml>";
+
+	alignas(std::max_align_t) static char buffer[1 << 14];
+	std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+	Xela::Xml::ParseOptions options;
+	options.resource = &arena;
+
+	Xela::Xml *val = Xela::Xml::fromString(str, options);
+	ASSERT_NE(val, nullptr);
+	EXPECT_TRUE((char *)val >= buffer && (char *)val < buffer + sizeof(buffer));
+	EXPECT_EQ(val->getChildren().at("b").size(), 2);
+	EXPECT_EQ(val->getChildren().at("b")[0]->getChildren().get_allocator().resource(), &arena);
+
+	val->addChild(new Xela::Xml());
+	delete val;
+}
+TEST(Xml, Stats) {
+	std::string str = "<xml><a><b/></a><!-- c --></xml>";
+
+	Xela::Xml::Stats stats;
+	Xela::Xml::ParseOptions options;
+	options.stats = &stats;
+
+	Xela::Xml *val = Xela::Xml::fromString(str, options);
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(stats.bytes, str.size());
+	EXPECT_EQ(stats.tags, 3);
+	EXPECT_EQ(stats.comments, 1);
+	EXPECT_EQ(stats.maxDepth, 3);
+	EXPECT_EQ(stats.allocations, 4);
+	delete val;
+}
+TEST(Xml, SourceMap) {
+	std::string str = "<xml>\n  <a></a>\n  <!-- comment -->\n</xml>";
+
+	Xela::Xml::SourceMap locations;
+	Xela::Xml::ParseOptions options;
+	options.locations = &locations;
+
+	Xela::Xml *val = Xela::Xml::fromString(str, options);
+
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(locations.size(), 3);
+
+	Xela::Xml *a = val->getChildren().find("a")->second[0];
+	Xela::Xml *comment = val->getChildren().find("")->second[0];
+
+	EXPECT_EQ(locations.locate(val).line, 1);
+	EXPECT_EQ(locations.locate(a).line, 2);
+	EXPECT_EQ(locations.locate(a).col, 3);
+	EXPECT_EQ(locations.locate(comment).line, 3);
+
+	delete val;
+}
 
 // TODO - Test Xss
+TEST(Xml, Async) {
+	std::filesystem::path file = std::filesystem::temp_directory_path() / "xela_async.xml";
+	std::ofstream(file) << "<xml><child/></xml>";
+
+	Xela::Xml *val = Xela::Xml::fromFileAsync(file).get();
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(val->getType(), "xml");
+	EXPECT_EQ(val->getChildren().size(), 1);
+	delete val;
+
+	std::filesystem::remove(file);
+	EXPECT_THROW(Xela::Xml::fromFileAsync(file).get(), xml_file_error);
+}
 TEST(Xss, Root) {
 	std::string xss = "";
 
 	Xela::Xss *val = Xela::Xss::fromString(xss);
 
 	ASSERT_NE(val, nullptr);
+}
+TEST(Xss, SourceMap) {
+	std::string xss = "\n  #a {}";
+
+	Xela::Xss::SourceMap locations;
+	Xela::Xss::ParseOptions options;
+	options.locations = &locations;
+
+	Xela::Xss *val = Xela::Xss::fromString(xss, options);
+
+	ASSERT_NE(val, nullptr);
+	ASSERT_EQ(locations.size(), 2);
+	EXPECT_EQ(locations.locate(val).line, 1);
+	delete val;
+}
+TEST(Xss, Async) {
+	std::filesystem::path file = std::filesystem::temp_directory_path() / "xela_async.xss";
+	std::ofstream(file) << "#a {}";
+
+	Xela::Xss::SourceMap locations;
+	Xela::Xss::ParseOptions options;
+	options.locations = &locations;
+
+	Xela::Xss *val = Xela::Xss::fromFileAsync(file, options).get();
+	ASSERT_NE(val, nullptr);
+	EXPECT_EQ(locations.size(), 2);
+	delete val;
+
+	std::filesystem::remove(file);
+	EXPECT_THROW(Xela::Xss::fromFileAsync(file).get(), Xela::xss_file_error);
 }
\ No newline at end of file